@@ -0,0 +1,336 @@
+/* address.c
+ * Addressing methods for proxies and servants
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "incl.h"
+
+//Addresses
+
+int sme_address_from_msg(MmcMsg *msg, uint32_t *address)
+{
+	size_t len, i;
+	uint32_t comp;
+
+	if (msg->mem_len % sizeof(uint32_t) != 0)
+		return -1;
+	len = msg->mem_len / sizeof(uint32_t);
+	if (len == 0 || len > SME_ADDRESS_MAX_LEN)
+		return -1;
+
+	for (i = 0; i < len; i++)
+	{
+		memcpy(&comp, MDSL_PTR_ADD(msg->mem, i * sizeof(uint32_t)), 
+				sizeof(uint32_t));
+		address[i] = ssc_uint32_from_le(comp);
+	}
+
+	return len;
+}
+
+MmcMsg *sme_address_msg_new
+	(const uint32_t *address, size_t len, size_t n_submsgs)
+{
+	MmcMsg *msg;
+	size_t i;
+	uint32_t comp;
+
+	sme_assert(len > 0 && len <= SME_ADDRESS_MAX_LEN,
+			"Invalid address length %d", (int) len);
+
+	msg = mmc_msg_newa(len * sizeof(uint32_t), n_submsgs);
+	for (i = 0; i < len; i++)
+	{
+		comp = ssc_uint32_to_le(address[i]);
+		memcpy(MDSL_PTR_ADD(msg->mem, i * sizeof(uint32_t)), &comp,
+				sizeof(uint32_t));
+	}
+
+	return msg;
+}
+
+//Router
+
+//Hash table entry, free when link is NULL
+typedef struct
+{
+	uint32_t hash;
+	uint32_t len;
+	uint32_t *prefix;
+	SmeLink *link;
+} RouteEntry;
+
+struct _SmeRouter
+{
+	MdslRC parent;
+
+	//Open addressing with linear probing
+	RouteEntry *table;
+	size_t n_buckets;
+	size_t n_entries;
+
+	//Longest prefix ever added, lookups start from here
+	size_t max_len;
+
+	size_t n_dropped;
+};
+
+#define ROUTER_INITIAL_BUCKETS 16
+
+//FNV-1a, one step per component so that prefixes hash incrementally
+#define ROUTER_HASH_INIT ((uint32_t) 2166136261u)
+
+static uint32_t router_hash_step(uint32_t hash, uint32_t comp)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+	{
+		hash ^= (comp >> (i * 8)) & 0xff;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static uint32_t router_hash(const uint32_t *prefix, size_t len)
+{
+	uint32_t hash = ROUTER_HASH_INIT;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		hash = router_hash_step(hash, prefix[i]);
+
+	return hash;
+}
+
+//Returns bucket holding the prefix, or the free bucket where it would go
+static RouteEntry *router_find
+	(SmeRouter *router, uint32_t hash, const uint32_t *prefix, size_t len)
+{
+	size_t mask = router->n_buckets - 1;
+	size_t i = hash & mask;
+
+	while (router->table[i].link)
+	{
+		RouteEntry *entry = router->table + i;
+
+		if (entry->hash == hash && entry->len == len
+				&& memcmp(entry->prefix, prefix, len * sizeof(uint32_t)) == 0)
+			break;
+
+		i = (i + 1) & mask;
+	}
+
+	return router->table + i;
+}
+
+static void router_resize(SmeRouter *router, size_t n_buckets)
+{
+	RouteEntry *old_table = router->table;
+	size_t old_n_buckets = router->n_buckets;
+	size_t i;
+
+	router->table = (RouteEntry *) mdsl_alloc(sizeof(RouteEntry) * n_buckets);
+	memset(router->table, 0, sizeof(RouteEntry) * n_buckets);
+	router->n_buckets = n_buckets;
+
+	for (i = 0; i < old_n_buckets; i++)
+	{
+		RouteEntry *entry = old_table + i;
+		if (entry->link)
+			*router_find(router, entry->hash, entry->prefix, entry->len)
+				= *entry;
+	}
+
+	free(old_table);
+}
+
+//Removes entry, shifting back following entries of the same cluster
+static void router_remove_entry(SmeRouter *router, RouteEntry *entry)
+{
+	size_t mask = router->n_buckets - 1;
+	size_t i = entry - router->table;
+	size_t j, home;
+
+	sme_link_remove_dest_router(entry->link, router);
+	free(entry->prefix);
+	entry->link = NULL;
+	router->n_entries--;
+
+	for (j = (i + 1) & mask; router->table[j].link; j = (j + 1) & mask)
+	{
+		home = router->table[j].hash & mask;
+
+		//Move entry j to i if i lies cyclically in [home, j)
+		if (((j - home) & mask) >= ((j - i) & mask))
+		{
+			router->table[i] = router->table[j];
+			router->table[j].link = NULL;
+			i = j;
+		}
+	}
+}
+
+mdsl_rc_define(SmeRouter, sme_router);
+
+static void sme_router_destroy(SmeRouter *router)
+{
+	size_t i;
+
+	for (i = 0; i < router->n_buckets; i++)
+	{
+		if (router->table[i].link)
+		{
+			sme_link_remove_dest_router(router->table[i].link, router);
+			free(router->table[i].prefix);
+		}
+	}
+	free(router->table);
+
+	free(router);
+}
+
+SmeRouter *sme_router_new()
+{
+	SmeRouter *router;
+
+	router = (SmeRouter *) mdsl_alloc(sizeof(SmeRouter));
+
+	mdsl_rc_init(router);
+
+	router->table = NULL;
+	router->n_buckets = 0;
+	router->n_entries = 0;
+	router->max_len = 0;
+	router->n_dropped = 0;
+	router_resize(router, ROUTER_INITIAL_BUCKETS);
+
+	return router;
+}
+
+void sme_router_add_route(SmeRouter *router, 
+		const uint32_t *prefix, size_t len, SmeLink *link)
+{
+	uint32_t hash;
+	RouteEntry *entry;
+
+	sme_assert(len > 0 && len <= SME_ADDRESS_MAX_LEN,
+			"Invalid prefix length %d", (int) len);
+
+	hash = router_hash(prefix, len);
+	entry = router_find(router, hash, prefix, len);
+	if (! entry->link)
+	{
+		//Keep load factor below 1/2
+		if ((router->n_entries + 1) * 2 > router->n_buckets)
+		{
+			router_resize(router, router->n_buckets * 2);
+			entry = router_find(router, hash, prefix, len);
+		}
+		entry->hash = hash;
+		entry->len = len;
+		entry->prefix = (uint32_t *) mdsl_alloc(len * sizeof(uint32_t));
+		memcpy(entry->prefix, prefix, len * sizeof(uint32_t));
+		router->n_entries++;
+	}
+	else
+	{
+		sme_link_remove_dest_router(entry->link, router);
+	}
+	entry->link = link;
+	sme_link_add_dest_router(link, router);
+
+	if (router->max_len < len)
+		router->max_len = len;
+}
+
+int sme_router_remove_route
+	(SmeRouter *router, const uint32_t *prefix, size_t len)
+{
+	RouteEntry *entry;
+
+	entry = router_find(router, router_hash(prefix, len), prefix, len);
+	if (! entry->link)
+		return 0;
+
+	router_remove_entry(router, entry);
+	return 1;
+}
+
+void sme_router_remove_link(SmeRouter *router, SmeLink *link)
+{
+	size_t i;
+
+	//Removal shifts following entries back into bucket i, 
+	//so recheck the same bucket after removal.
+	for (i = 0; i < router->n_buckets; )
+	{
+		if (router->table[i].link == link)
+			router_remove_entry(router, router->table + i);
+		else
+			i++;
+	}
+}
+
+SmeLink *sme_router_lookup
+	(SmeRouter *router, const uint32_t *address, size_t len)
+{
+	uint32_t hashes[SME_ADDRESS_MAX_LEN + 1];
+	size_t i;
+
+	if (len > router->max_len)
+		len = router->max_len;
+
+	hashes[0] = ROUTER_HASH_INIT;
+	for (i = 0; i < len; i++)
+		hashes[i + 1] = router_hash_step(hashes[i], address[i]);
+
+	//Longest prefix first
+	for (i = len; i > 0; i--)
+	{
+		RouteEntry *entry = router_find(router, hashes[i], address, i);
+		if (entry->link)
+			return entry->link;
+	}
+
+	return NULL;
+}
+
+int sme_router_route(SmeRouter *router, MmcMsg *msg)
+{
+	uint32_t address[SME_ADDRESS_MAX_LEN];
+	SmeLink *dest;
+	int len;
+
+	len = sme_address_from_msg(msg, address);
+	dest = len > 0 ? sme_router_lookup(router, address, len) : NULL;
+	if (! dest)
+	{
+		router->n_dropped++;
+		return 0;
+	}
+
+	sme_link_send(dest, msg);
+	return 1;
+}
+
+size_t sme_router_get_n_dropped(SmeRouter *router)
+{
+	return router->n_dropped;
+}
@@ -19,3 +19,49 @@
  */
 
 
+
+/* Addresses are sequences of 32-bit components. A message routed by
+ * SmeRouter carries its destination address in its own memory block,
+ * as little endian 32-bit integers; payload goes in submessages.
+ * Forwarding passes the same MmcMsg to the destination link.
+ */
+
+#define SME_ADDRESS_MAX_LEN 32
+
+//Returns number of components written to address, or -1 if message 
+//does not hold a valid address.
+int sme_address_from_msg(MmcMsg *msg, uint32_t *address);
+
+//Creates a message addressed to given destination
+MmcMsg *sme_address_msg_new
+	(const uint32_t *address, size_t len, size_t n_submsgs);
+
+//Router: maps address prefixes to links, using longest prefix match.
+//Not thread-safe, links sharing a router should run on the same loop.
+typedef struct _SmeRouter SmeRouter;
+
+struct _SmeLink;
+
+mdsl_rc_declare(SmeRouter, sme_router);
+
+SmeRouter *sme_router_new();
+
+//Replaces existing route with same prefix
+void sme_router_add_route(SmeRouter *router, 
+		const uint32_t *prefix, size_t len, struct _SmeLink *link);
+
+//Returns 0 if there was no such route
+int sme_router_remove_route
+	(SmeRouter *router, const uint32_t *prefix, size_t len);
+
+void sme_router_remove_link(SmeRouter *router, struct _SmeLink *link);
+
+struct _SmeLink *sme_router_lookup
+	(SmeRouter *router, const uint32_t *address, size_t len);
+
+//Forwards the message to the link for its address.
+//Returns 0 if message was dropped.
+int sme_router_route(SmeRouter *router, MmcMsg *msg);
+
+size_t sme_router_get_n_dropped(SmeRouter *router);
+
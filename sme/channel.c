@@ -25,6 +25,18 @@
 
 mdsl_rc_define(SmeChannel, sme_channel);
 
+//Statistics
+
+void sme_channel_get_stats(SmeChannel *channel, SmeChannelStats *stats)
+{
+	*stats = channel->stats;
+}
+
+void sme_channel_reset_stats(SmeChannel *channel)
+{
+	memset(&(channel->stats), 0, sizeof(SmeChannelStats));
+}
+
 void sme_channel_cleanup(SmeChannel *channel)
 {
 
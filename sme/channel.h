@@ -27,6 +27,10 @@ typedef struct
 	void *source_ptr;
 
 	void (*notify)(void *source_ptr, int n_jobs);
+
+	//Optional, informs number of bytes transferred, 
+	//called before notify() for the same IO.
+	void (*progress)(void *source_ptr, size_t n_bytes);
 } SmeJobSource;
 
 //Interface to handle event driven IO failures.
@@ -37,11 +41,32 @@ typedef struct
 } SmeChannelCB;
 
 
+//IO statistics for one direction of a channel
+typedef struct
+{
+	uint64_t n_syscalls;
+	uint64_t n_bytes;
+	uint64_t n_partial;
+	uint64_t n_eagain;
+	uint64_t n_jobs;
+	uint64_t n_iovecs;
+	size_t max_queue_len;
+	size_t max_queue_bytes;
+} SmeLaneStats;
+
+typedef struct
+{
+	SmeLaneStats read, write;
+} SmeChannelStats;
+
 //Channel base class
 struct _SmeChannel
 {
 	MdslRC parent;
 
+	//Statistics, filled in by backends
+	SmeChannelStats stats;
+
 	//Virtual functions
 	void (*destroy) (SmeChannel *channel);
 	void (*close) (SmeChannel *channel);
@@ -57,8 +82,16 @@ struct _SmeChannel
 		(SmeChannel *channel, SscMBlock *blocks, size_t n_blocks);
 	void (*add_write_job)
 		(SmeChannel *channel, SscMBlock *blocks, size_t n_blocks);
+	//Optional, channels implementing it must call progress() of 
+	//the write source
+	void (*insert_write_job) (SmeChannel *channel, 
+			int pos, SscMBlock *blocks, size_t n_blocks);
+	//Optional, same requirement as insert_write_job
+	void (*remove_write_job) (SmeChannel *channel, int pos);
 	ssize_t (*read) (SmeChannel *channel);
 	ssize_t (*write) (SmeChannel *channel);
+	//Optional, kernel receive timestamp of the bytes read last
+	uint64_t (*get_rx_timestamp) (SmeChannel *channel);
 	void (*attach)(SmeChannel *channel, struct ev_loop *loop);
 	void (*detach)(SmeChannel *channel);
 };
@@ -99,6 +132,31 @@ static inline void sme_channel_add_write_job
 	(* channel->add_write_job)(channel, blocks, n_blocks);
 }
 
+//Inserts write job before job at given position in the queue, 
+//that job should not have been started. 
+static inline void sme_channel_insert_write_job
+	(SmeChannel *channel, int pos, SscMBlock *blocks, size_t n_blocks)
+{
+	(* channel->insert_write_job)(channel, pos, blocks, n_blocks);
+}
+
+static inline int sme_channel_can_insert_write_job(SmeChannel *channel)
+{
+	return channel->insert_write_job ? 1 : 0;
+}
+
+//Removes write job at given position in the queue without notifying,
+//that job should not have been started.
+static inline void sme_channel_remove_write_job(SmeChannel *channel, int pos)
+{
+	(* channel->remove_write_job)(channel, pos);
+}
+
+static inline int sme_channel_can_remove_write_job(SmeChannel *channel)
+{
+	return channel->remove_write_job ? 1 : 0;
+}
+
 static inline ssize_t sme_channel_read (SmeChannel *channel)
 {
 	return (* channel->read)(channel);
@@ -109,6 +167,18 @@ static inline ssize_t sme_channel_write (SmeChannel *channel)
 	return (* channel->write)(channel);
 }
 
+//Kernel receive timestamp of the bytes read by the last read, 
+//CLOCK_REALTIME in nanoseconds, 0 if not known.
+static inline uint64_t sme_channel_get_rx_timestamp (SmeChannel *channel)
+{
+	return (* channel->get_rx_timestamp)(channel);
+}
+
+static inline int sme_channel_can_get_rx_timestamp(SmeChannel *channel)
+{
+	return channel->get_rx_timestamp ? 1 : 0;
+}
+
 static inline void sme_channel_attach
 	(SmeChannel *channel, struct ev_loop *loop)
 {
@@ -120,6 +190,10 @@ static inline void sme_channel_detach (SmeChannel *channel)
 	(* channel->detach)(channel);
 }
 
+void sme_channel_get_stats(SmeChannel *channel, SmeChannelStats *stats);
+
+void sme_channel_reset_stats(SmeChannel *channel);
+
 void sme_channel_cleanup(SmeChannel *channel);
 
 void sme_channel_init(SmeChannel *channel);
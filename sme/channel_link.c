@@ -19,6 +19,17 @@
  */
 
 #include "incl.h"
+#include "probes.h"
+
+#include <stdatomic.h>
+
+//Node of lock-free stack of messages sent from other threads
+typedef struct _SendNode SendNode;
+struct _SendNode
+{
+	SendNode *next;
+	MmcMsg *msg;
+};
 
 struct _SmeChannelLink
 {
@@ -27,12 +38,27 @@ struct _SmeChannelLink
 	SmeChannel *channel;
 	SmeMsgReader *reader;
 	SmeMsgWriter *writer;
+
+	//Used instead of reader and writer in multiplexed mode
+	SmeMuxReader *mux_reader;
+	SmeMuxWriter *mux_writer;
+
+	SmeLatency *latency;
+
+	//Thread-safe sending
+	struct ev_loop *loop;
+	ev_async async;
+	_Atomic(SendNode *) send_head;
+	atomic_int wakeup_pending;
+	size_t n_wakeups;
 };
 
 static void sme_channel_link_notify_msg_cb(MmcMsg *msg, void *data)
 {
 	SmeChannelLink *link = data;
 
+	sme_probe2(link_receive, link, msg);
+
 	sme_link_receive((SmeLink*) link, msg);
 }
 
@@ -40,23 +66,138 @@ static void sme_channel_link_send(SmeLink *base_type, MmcMsg *msg)
 {
 	SmeChannelLink *link = (SmeChannelLink*) base_type;
 
-	sme_msg_writer_add_msg(link->writer, msg);
+	sme_probe2(link_send, link, msg);
+
+	if (link->mux_writer)
+		sme_mux_writer_add_msg(link->mux_writer, 0, msg);
+	else
+		sme_msg_writer_add_msg(link->writer, msg);
+}
+
+static void sme_channel_link_send_deadline
+	(SmeLink *base_type, MmcMsg *msg, uint64_t deadline)
+{
+	SmeChannelLink *link = (SmeChannelLink*) base_type;
+
+	sme_probe2(link_send, link, msg);
+
+	if (link->mux_writer)
+		sme_mux_writer_add_msg(link->mux_writer, 0, msg);
+	else
+		sme_msg_writer_add_msg_deadline
+			(link->writer, msg, SME_MSG_WRITER_DEFAULT_PRIO, deadline);
+}
+
+//Thread-safe sending
+static void sme_channel_link_drain_send_queue(SmeChannelLink *link)
+{
+	SendNode *node, *prev, *next;
+
+	//Take the whole batch, it is in reverse order of sending
+	node = atomic_exchange(&(link->send_head), NULL);
+	prev = NULL;
+	while (node)
+	{
+		next = node->next;
+		node->next = prev;
+		prev = node;
+		node = next;
+	}
+
+	//Queue on the writer
+	for (node = prev; node; node = next)
+	{
+		next = node->next;
+		sme_channel_link_send((SmeLink *) link, node->msg);
+		mmc_msg_unref(node->msg);
+		mdsl_free(node);
+	}
+}
+
+static void sme_channel_link_async_cb(EV_P_ ev_async *w, int revents)
+{
+	SmeChannelLink *link = w->data;
+
+	//Clear before draining so that messages sent from now on 
+	//cause another wakeup
+	atomic_store(&(link->wakeup_pending), 0);
+	link->n_wakeups++;
+
+	sme_channel_link_drain_send_queue(link);
+}
+
+void sme_channel_link_start_mt_send(SmeChannelLink *link, struct ev_loop *loop)
+{
+	sme_assert(! link->loop, "Thread-safe sending already started");
+
+	link->loop = loop;
+	ev_async_init(&(link->async), sme_channel_link_async_cb);
+	link->async.data = link;
+	ev_async_start(loop, &(link->async));
+}
+
+void sme_channel_link_stop_mt_send(SmeChannelLink *link)
+{
+	if (! link->loop)
+		return;
+
+	ev_async_stop(link->loop, &(link->async));
+	sme_channel_link_drain_send_queue(link);
+	atomic_store(&(link->wakeup_pending), 0);
+	link->loop = NULL;
+}
+
+size_t sme_channel_link_get_n_mt_wakeups(SmeChannelLink *link)
+{
+	return link->n_wakeups;
+}
+
+void sme_channel_link_send_mt(SmeChannelLink *link, MmcMsg *msg)
+{
+	SendNode *node;
+
+	sme_assert(link->loop, "Thread-safe sending not started");
+
+	node = (SendNode *) mdsl_alloc(sizeof(SendNode));
+	node->msg = msg;
+
+	//Push
+	node->next = atomic_load(&(link->send_head));
+	while (! atomic_compare_exchange_weak
+			(&(link->send_head), &(node->next), node))
+		;
+
+	//Only the first message of a batch wakes up the loop
+	if (! atomic_exchange(&(link->wakeup_pending), 1))
+		ev_async_send(link->loop, &(link->async));
 }
 
 static void sme_channel_link_destroy(SmeLink *base_type)
 {
 	SmeChannelLink *link = (SmeChannelLink*) base_type;
 
+	sme_channel_link_stop_mt_send(link);
+
 	sme_channel_unref(link->channel);
-	sme_msg_reader_unref(link->reader);
-	sme_msg_writer_unref(link->writer);
+	if (link->mux_writer)
+	{
+		sme_mux_reader_unref(link->mux_reader);
+		sme_mux_writer_unref(link->mux_writer);
+	}
+	else
+	{
+		sme_msg_reader_unref(link->reader);
+		sme_msg_writer_unref(link->writer);
+	}
+	if (link->latency)
+		mdsl_free(link->latency);
 
 	sme_link_cleanup(base_type);
 
 	mdsl_free(link);
 }
 
-SmeChannelLink *sme_channel_link_new(SmeChannel *channel)
+static SmeChannelLink *sme_channel_link_alloc(SmeChannel *channel)
 {
 	SmeChannelLink *link =  mdsl_alloc(sizeof(SmeChannelLink));
 
@@ -64,12 +205,142 @@ SmeChannelLink *sme_channel_link_new(SmeChannel *channel)
 	sme_link_init((SmeLink*) link);
 	link->parent.destroy = sme_channel_link_destroy;
 	link->parent.send = sme_channel_link_send;
+	link->parent.send_deadline = sme_channel_link_send_deadline;
 
 	sme_channel_ref(channel);
 	link->channel = channel;
+	link->reader = NULL;
+	link->writer = NULL;
+	link->mux_reader = NULL;
+	link->mux_writer = NULL;
+	link->latency = NULL;
+	link->loop = NULL;
+	link->n_wakeups = 0;
+	atomic_init(&(link->send_head), NULL);
+	atomic_init(&(link->wakeup_pending), 0);
+
+	return link;
+}
+
+SmeChannelLink *sme_channel_link_new(SmeChannel *channel)
+{
+	SmeChannelLink *link = sme_channel_link_alloc(channel);
+
 	SmeMsgReaderNotify notify = { sme_channel_link_notify_msg_cb, link};
 	link->reader = sme_msg_reader_new(link->channel, notify);
 	link->writer = sme_msg_writer_new(link->channel);
 
 	return link;
 }
+
+//Multiplexed mode
+SmeChannelLink *sme_channel_link_new_mux(SmeChannel *channel, int n_streams)
+{
+	SmeChannelLink *link = sme_channel_link_alloc(channel);
+
+	SmeMsgReaderNotify notify = { sme_channel_link_notify_msg_cb, link};
+	link->mux_reader = sme_mux_reader_new(link->channel, n_streams, notify);
+	link->mux_writer = sme_mux_writer_new(link->channel, n_streams);
+
+	return link;
+}
+
+void sme_channel_link_send_prio
+	(SmeChannelLink *link, MmcMsg *msg, int prio)
+{
+	sme_assert(link->writer, 
+			"Priorities are not supported on multiplexed links");
+
+	sme_probe2(link_send, link, msg);
+
+	sme_msg_writer_add_msg_prio(link->writer, msg, prio);
+}
+
+void sme_channel_link_send_prepared
+	(SmeChannelLink *link, SmePreparedMsg *prepared)
+{
+	sme_probe2(link_send, link, sme_prepared_msg_get_msg(prepared));
+
+	//Multiplexed links cut the message into chunks of their own
+	if (link->mux_writer)
+		sme_mux_writer_add_msg
+			(link->mux_writer, 0, sme_prepared_msg_get_msg(prepared));
+	else
+		sme_msg_writer_add_prepared(link->writer, prepared);
+}
+
+void sme_channel_link_send_stream
+	(SmeChannelLink *link, int stream, MmcMsg *msg)
+{
+	sme_assert(link->mux_writer, "Link is not multiplexed");
+
+	sme_probe2(link_send, link, msg);
+
+	sme_mux_writer_add_msg(link->mux_writer, stream, msg);
+}
+
+int sme_channel_link_get_stream_queue_len(SmeChannelLink *link, int stream)
+{
+	sme_assert(link->mux_writer, "Link is not multiplexed");
+
+	return sme_mux_writer_get_queue_len(link->mux_writer, stream);
+}
+
+//Deadlines
+void sme_channel_link_set_timer_wheel
+	(SmeChannelLink *link, SmeTimerWheel *wheel)
+{
+	if (link->writer)
+		sme_msg_writer_set_timer_wheel(link->writer, wheel);
+}
+
+//CRC32C trailers
+void sme_channel_link_set_crc(SmeChannelLink *link, int enabled)
+{
+	sme_assert(link->writer, 
+			"CRC trailers are not supported on multiplexed links");
+
+	sme_msg_writer_set_crc(link->writer, enabled);
+	sme_msg_reader_set_crc(link->reader, enabled);
+}
+
+//Latency measurement
+void sme_channel_link_enable_latency(SmeChannelLink *link)
+{
+	if (link->latency)
+		return;
+	sme_assert(link->writer, "Latency is not measured on multiplexed links");
+
+	link->latency = mdsl_alloc(sizeof(SmeLatency));
+	sme_latency_reset(link->latency);
+
+	sme_msg_writer_set_latency(link->writer, link->latency);
+	sme_msg_reader_set_latency(link->reader, link->latency);
+}
+
+void sme_channel_link_disable_latency(SmeChannelLink *link)
+{
+	if (! link->latency)
+		return;
+
+	sme_msg_writer_set_latency(link->writer, NULL);
+	sme_msg_reader_set_latency(link->reader, NULL);
+
+	mdsl_free(link->latency);
+	link->latency = NULL;
+}
+
+int sme_channel_link_get_latency(SmeChannelLink *link, SmeLatency *snapshot)
+{
+	if (! link->latency)
+		return 0;
+
+	*snapshot = *(link->latency);
+	return 1;
+}
+
+void sme_channel_link_reset_latency(SmeChannelLink *link)
+{
+	if (link->latency)
+		sme_latency_reset(link->latency);
+}
@@ -22,3 +22,61 @@ typedef struct _SmeChannelLink SmeChannelLink;
 
 SmeChannelLink *sme_channel_link_new(SmeChannel *channel);
 
+//Sends with priority class as in sme_msg_writer_add_msg_prio()
+void sme_channel_link_send_prio
+	(SmeChannelLink *link, MmcMsg *msg, int prio);
+
+//Sends a prepared message, for publishing one message on many links.
+//On multiplexed links the message is sent on stream 0 as usual.
+void sme_channel_link_send_prepared
+	(SmeChannelLink *link, SmePreparedMsg *prepared);
+
+//Multiplexed mode, protocol is described in mux.h.
+//sme_link_send() sends on stream 0.
+SmeChannelLink *sme_channel_link_new_mux(SmeChannel *channel, int n_streams);
+
+void sme_channel_link_send_stream
+	(SmeChannelLink *link, int stream, MmcMsg *msg);
+
+int sme_channel_link_get_stream_queue_len(SmeChannelLink *link, int stream);
+
+//Thread-safe sending.
+//After sme_channel_link_start_mt_send(), any thread can call 
+//sme_channel_link_send_mt(). Messages are passed to the loop thread 
+//through a lock-free queue and queued on the writer there, in batches 
+//with one wakeup per batch. Messages from one thread are sent in order.
+//Reference counting of messages is not atomic, so the caller's reference
+//is taken over and the message must not be used by the caller afterwards.
+//All producer threads must have returned from their last 
+//sme_channel_link_send_mt() before sme_channel_link_stop_mt_send() is 
+//called or the link is destroyed, the link does not wait for them.
+void sme_channel_link_start_mt_send(SmeChannelLink *link, struct ev_loop *loop);
+
+void sme_channel_link_send_mt(SmeChannelLink *link, MmcMsg *msg);
+
+//Called on the loop thread. Messages still in the queue are queued on 
+//the writer. Thread-safe sending can be started again afterwards.
+void sme_channel_link_stop_mt_send(SmeChannelLink *link);
+
+//Number of times the loop thread was woken up, each takes one batch
+size_t sme_channel_link_get_n_mt_wakeups(SmeChannelLink *link);
+
+//Timer wheel for deadlines given to sme_link_send_deadline().
+//Deadlines are not supported on multiplexed links.
+void sme_channel_link_set_timer_wheel
+	(SmeChannelLink *link, SmeTimerWheel *wheel);
+
+//CRC32C trailer on every message, see sme_msg_writer_set_crc().
+//Both ends must enable it before the first message.
+void sme_channel_link_set_crc(SmeChannelLink *link, int enabled);
+
+//Latency measurement
+void sme_channel_link_enable_latency(SmeChannelLink *link);
+
+void sme_channel_link_disable_latency(SmeChannelLink *link);
+
+//Copies current histograms, returns 0 if measurement is disabled
+int sme_channel_link_get_latency(SmeChannelLink *link, SmeLatency *snapshot);
+
+void sme_channel_link_reset_latency(SmeChannelLink *link);
+
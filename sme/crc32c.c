@@ -0,0 +1,173 @@
+/* crc32c.c
+ * CRC32C (Castagnoli) checksums
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "incl.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define CRC32C_HAVE_SSE42 1
+#endif
+
+//Reflected Castagnoli polynomial
+#define CRC32C_POLY 0x82F63B78
+
+//Slicing-by-8 tables, table[k][b] is CRC of byte b followed by k zeros
+static uint32_t crc32c_table[8][256];
+
+typedef uint32_t (*Crc32cFn)(uint32_t crc, const unsigned char *p, size_t len);
+
+static Crc32cFn crc32c_impl;
+
+//Portable implementation
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	//Byte-wise until aligned
+	while (len > 0 && ((uintptr_t) p & 7) != 0)
+	{
+		crc = crc32c_table[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+		p++;
+		len--;
+	}
+
+	//8 bytes at a time
+	while (len >= 8)
+	{
+		uint32_t lo = crc ^ ((uint32_t) p[0] | ((uint32_t) p[1] << 8)
+				| ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24));
+		uint32_t hi = (uint32_t) p[4] | ((uint32_t) p[5] << 8)
+				| ((uint32_t) p[6] << 16) | ((uint32_t) p[7] << 24);
+
+		crc = crc32c_table[7][lo & 0xff]
+			^ crc32c_table[6][(lo >> 8) & 0xff]
+			^ crc32c_table[5][(lo >> 16) & 0xff]
+			^ crc32c_table[4][lo >> 24]
+			^ crc32c_table[3][hi & 0xff]
+			^ crc32c_table[2][(hi >> 8) & 0xff]
+			^ crc32c_table[1][(hi >> 16) & 0xff]
+			^ crc32c_table[0][hi >> 24];
+		p += 8;
+		len -= 8;
+	}
+
+	while (len > 0)
+	{
+		crc = crc32c_table[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+		p++;
+		len--;
+	}
+
+	return crc;
+}
+
+#ifdef CRC32C_HAVE_SSE42
+//Hardware implementation
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	while (len > 0 && ((uintptr_t) p & 7) != 0)
+	{
+		crc = _mm_crc32_u8(crc, *p);
+		p++;
+		len--;
+	}
+
+#ifdef __x86_64__
+	{
+		uint64_t crc64 = crc;
+		uint64_t v;
+
+		while (len >= 8)
+		{
+			memcpy(&v, p, 8);
+			crc64 = _mm_crc32_u64(crc64, v);
+			p += 8;
+			len -= 8;
+		}
+		crc = (uint32_t) crc64;
+	}
+#endif
+	while (len >= 4)
+	{
+		uint32_t v;
+
+		memcpy(&v, p, 4);
+		crc = _mm_crc32_u32(crc, v);
+		p += 4;
+		len -= 4;
+	}
+
+	while (len > 0)
+	{
+		crc = _mm_crc32_u8(crc, *p);
+		p++;
+		len--;
+	}
+
+	return crc;
+}
+#endif
+
+//Tables and dispatch are set up once, when the library is loaded
+__attribute__((constructor))
+static void crc32c_init(void)
+{
+	uint32_t crc;
+	int i, j, k;
+
+	for (i = 0; i < 256; i++)
+	{
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+		crc32c_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++)
+	{
+		crc = crc32c_table[0][i];
+		for (k = 1; k < 8; k++)
+		{
+			crc = crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+			crc32c_table[k][i] = crc;
+		}
+	}
+
+	crc32c_impl = crc32c_sw;
+#ifdef CRC32C_HAVE_SSE42
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2"))
+		crc32c_impl = crc32c_hw;
+#endif
+}
+
+uint32_t sme_crc32c_update(uint32_t crc, const void *data, size_t len)
+{
+	return ~ (*crc32c_impl)(~ crc, (const unsigned char *) data, len);
+}
+
+uint32_t sme_crc32c_update_sw(uint32_t crc, const void *data, size_t len)
+{
+	return ~ crc32c_sw(~ crc, (const unsigned char *) data, len);
+}
+
+int sme_crc32c_is_hw(void)
+{
+	return crc32c_impl != crc32c_sw;
+}
+
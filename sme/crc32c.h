@@ -0,0 +1,41 @@
+/* crc32c.h
+ * CRC32C (Castagnoli) checksums
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//Updates CRC32C of a byte sequence with following bytes. 
+//Start with crc = 0; the result of each call is the CRC32C of all bytes 
+//so far. Uses SSE4.2 crc32 instruction when the CPU supports it.
+uint32_t sme_crc32c_update(uint32_t crc, const void *data, size_t len);
+
+static inline uint32_t sme_crc32c(const void *data, size_t len)
+{
+	return sme_crc32c_update(0, data, len);
+}
+
+//Testing
+#ifndef SME_PUBLIC_HEADER
+
+//Portable slicing-by-8 implementation
+uint32_t sme_crc32c_update_sw(uint32_t crc, const void *data, size_t len);
+
+//Returns 1 if hardware implementation is in use
+int sme_crc32c_is_hw(void);
+
+#endif //SME_PUBLIC_HEADER
+
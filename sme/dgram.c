@@ -0,0 +1,364 @@
+/* dgram.c
+ * Message-oriented channel over datagram sockets
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "incl.h"
+#include "probes.h"
+
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+mdsl_declare_queue(struct iovec, DgramIovQueue, dgram_iov_queue);
+mdsl_declare_queue(int, DgramIntQueue, dgram_int_queue);
+
+//Datagram channel
+
+struct _SmeDgramChannel
+{
+	SmeChannel parent;
+	int fd;
+
+	int enabled;
+	SmeJobSource source;
+	DgramIovQueue iov[1];
+	DgramIntQueue compl[1];
+	size_t n_bytes;
+
+	uint64_t n_dropped;
+};
+
+static void sme_dgram_channel_destroy(SmeChannel *base_type)
+{
+	SmeDgramChannel *channel = (SmeDgramChannel *) base_type;
+
+	sme_channel_unset_write_source(base_type);
+
+	sme_channel_cleanup(base_type);
+
+	free(channel);
+}
+
+static void sme_dgram_channel_set_write_source
+	(SmeChannel *base_type, SmeJobSource source)
+{
+	SmeDgramChannel *channel = (SmeDgramChannel *) base_type;
+
+	if (channel->enabled)
+		sme_error("Cannot set source more than once");	
+
+	channel->source = source;
+	channel->enabled = 1;
+	channel->n_bytes = 0;
+	dgram_iov_queue_init(channel->iov);
+	dgram_int_queue_init(channel->compl);
+}
+
+static void sme_dgram_channel_unset_write_source(SmeChannel *base_type)
+{
+	SmeDgramChannel *channel = (SmeDgramChannel *) base_type;
+
+	if (channel->enabled)
+	{
+		channel->enabled = 0;
+		dgram_iov_queue_destroy(channel->iov);
+		dgram_int_queue_destroy(channel->compl);
+	}
+}
+
+static void sme_dgram_channel_set_read_source
+	(SmeChannel *base_type, SmeJobSource source)
+{
+	sme_error("Datagram channel cannot be read from, use SmeDgramReader");
+}
+
+static void sme_dgram_channel_unset_read_source(SmeChannel *base_type)
+{
+
+}
+
+static void sme_dgram_channel_add_read_job
+	(SmeChannel *base_type, SscMBlock *blocks, size_t n_blocks)
+{
+	sme_error("Datagram channel cannot be read from, use SmeDgramReader");
+}
+
+static ssize_t sme_dgram_channel_read(SmeChannel *base_type)
+{
+	sme_error("Datagram channel cannot be read from, use SmeDgramReader");
+	return -1;
+}
+
+static void sme_dgram_channel_add_write_job
+	(SmeChannel *base_type, SscMBlock *blocks, size_t n_blocks)
+{
+	SmeDgramChannel *channel = (SmeDgramChannel *) base_type;
+	SmeLaneStats *stats = &(channel->parent.stats.write);
+	struct iovec *allocd;
+	size_t queue_len;
+	int i;
+
+	allocd = dgram_iov_queue_alloc_n(channel->iov, n_blocks);
+	for (i = 0; i < n_blocks; i++)
+	{
+		allocd[i].iov_base = blocks[i].mem;
+		allocd[i].iov_len  = blocks[i].len;
+		channel->n_bytes += blocks[i].len;
+	}
+
+	dgram_int_queue_push(channel->compl, (int) n_blocks);
+
+	queue_len = dgram_int_queue_size(channel->compl);
+	if (stats->max_queue_len < queue_len)
+		stats->max_queue_len = queue_len;
+	if (stats->max_queue_bytes < channel->n_bytes)
+		stats->max_queue_bytes = channel->n_bytes;
+}
+
+//Removes first n_jobs jobs from the queue
+static void sme_dgram_channel_pop_jobs(SmeDgramChannel *channel, int n_jobs)
+{
+	struct iovec *iov = dgram_iov_queue_head(channel->iov);
+	int *compl = dgram_int_queue_head(channel->compl);
+	int i, j, n_blocks = 0;
+
+	for (i = 0; i < n_jobs; i++)
+	{
+		for (j = 0; j < compl[i]; j++)
+			channel->n_bytes -= iov[n_blocks + j].iov_len;
+		n_blocks += compl[i];
+	}
+
+	dgram_iov_queue_pop_n(channel->iov, n_blocks);
+	dgram_int_queue_pop_n(channel->compl, n_jobs);
+}
+
+static ssize_t sme_dgram_channel_write(SmeChannel *base_type)
+{
+	SmeDgramChannel *channel = (SmeDgramChannel *) base_type;
+	SmeLaneStats *stats = &(channel->parent.stats.write);
+	struct mmsghdr msgs[SME_DGRAM_BATCH];
+	struct iovec *iov;
+	int *compl;
+	int n_jobs, n_blocks, i;
+	int res;
+	ssize_t n_bytes = 0;
+
+	if (! channel->enabled)
+		sme_error("No job source");
+
+	//One datagram for every job
+	iov = dgram_iov_queue_head(channel->iov);
+	compl = dgram_int_queue_head(channel->compl);
+	n_jobs = dgram_int_queue_size(channel->compl);
+	if (n_jobs > SME_DGRAM_BATCH)
+		n_jobs = SME_DGRAM_BATCH;
+	if (n_jobs == 0)
+		return 0;
+
+	n_blocks = 0;
+	for (i = 0; i < n_jobs; i++)
+	{
+		memset(&(msgs[i].msg_hdr), 0, sizeof(struct msghdr));
+		msgs[i].msg_hdr.msg_iov = iov + n_blocks;
+		msgs[i].msg_hdr.msg_iovlen = compl[i];
+		msgs[i].msg_len = 0;
+		n_blocks += compl[i];
+	}
+
+	sme_probe4(lane_io_entry, channel, channel->fd, n_blocks, 
+			channel->n_bytes);
+	res = sendmmsg(channel->fd, msgs, n_jobs, MSG_DONTWAIT | MSG_NOSIGNAL);
+	sme_probe3(lane_io_return, channel, channel->fd, res);
+	stats->n_syscalls++;
+
+	if (res < 0)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			stats->n_eagain++;
+			return -1;
+		}
+		if (errno != EMSGSIZE)
+			return -1;
+
+		//First datagram can never be sent, drop it
+		channel->n_dropped++;
+		res = 1;
+	}
+	else
+	{
+		for (i = 0; i < res; i++)
+		{
+			stats->n_iovecs += compl[i];
+			n_bytes += msgs[i].msg_len;
+		}
+		stats->n_bytes += n_bytes;
+		if (res < n_jobs)
+			stats->n_partial++;
+	}
+
+	sme_dgram_channel_pop_jobs(channel, res);
+
+	stats->n_jobs += res;
+	(* channel->source.notify)(channel->source.source_ptr, res);
+
+	return n_bytes;
+}
+
+int sme_dgram_channel_get_write_queue_len(SmeDgramChannel *channel)
+{
+	return dgram_int_queue_size(channel->compl);
+}
+
+uint64_t sme_dgram_channel_get_n_dropped(SmeDgramChannel *channel)
+{
+	return channel->n_dropped;
+}
+
+SmeDgramChannel *sme_dgram_channel_new(int fd)
+{
+	SmeDgramChannel *channel;
+
+	channel = (SmeDgramChannel *) mdsl_alloc(sizeof(SmeDgramChannel));
+
+	sme_channel_init((SmeChannel*) channel);
+
+	channel->fd = fd;
+	channel->enabled = 0;
+	channel->n_bytes = 0;
+	channel->n_dropped = 0;
+
+	//Setup virtual functions
+	channel->parent.destroy = sme_dgram_channel_destroy;
+	channel->parent.set_read_source = sme_dgram_channel_set_read_source;
+	channel->parent.unset_read_source = sme_dgram_channel_unset_read_source;
+	channel->parent.set_write_source = sme_dgram_channel_set_write_source;
+	channel->parent.unset_write_source 
+		= sme_dgram_channel_unset_write_source;
+	channel->parent.add_read_job = sme_dgram_channel_add_read_job;
+	channel->parent.add_write_job = sme_dgram_channel_add_write_job;
+	channel->parent.read = sme_dgram_channel_read;
+	channel->parent.write = sme_dgram_channel_write;
+
+	return channel;
+}
+
+//Datagram reader
+
+struct _SmeDgramReader
+{
+	MdslRC parent;
+
+	int fd;
+	size_t max_size;
+	SmeMsgReaderNotify notify;
+
+	//Receive buffers, one per datagram in a batch
+	char *buf;
+	struct iovec iov[SME_DGRAM_BATCH];
+	struct mmsghdr msgs[SME_DGRAM_BATCH];
+
+	uint64_t n_dropped;
+};
+
+mdsl_rc_define(SmeDgramReader, sme_dgram_reader);
+
+static void sme_dgram_reader_destroy(SmeDgramReader *reader)
+{
+	free(reader->buf);
+	free(reader);
+}
+
+SmeDgramReader *sme_dgram_reader_new
+	(int fd, size_t max_size, SmeMsgReaderNotify notify)
+{
+	SmeDgramReader *reader;
+	int i;
+
+	reader = (SmeDgramReader *) mdsl_alloc(sizeof(SmeDgramReader));
+
+	mdsl_rc_init(reader);
+
+	reader->fd = fd;
+	reader->max_size = max_size;
+	reader->notify = notify;
+	reader->n_dropped = 0;
+	reader->buf = (char *) mdsl_alloc(max_size * SME_DGRAM_BATCH);
+	for (i = 0; i < SME_DGRAM_BATCH; i++)
+	{
+		reader->iov[i].iov_base = reader->buf + max_size * i;
+		reader->iov[i].iov_len = max_size;
+	}
+
+	return reader;
+}
+
+ssize_t sme_dgram_reader_read(SmeDgramReader *reader)
+{
+	MmcMsg *msg;
+	int res, i;
+
+	for (i = 0; i < SME_DGRAM_BATCH; i++)
+	{
+		memset(&(reader->msgs[i].msg_hdr), 0, sizeof(struct msghdr));
+		reader->msgs[i].msg_hdr.msg_iov = reader->iov + i;
+		reader->msgs[i].msg_hdr.msg_iovlen = 1;
+		reader->msgs[i].msg_len = 0;
+	}
+
+	res = recvmmsg(reader->fd, reader->msgs, SME_DGRAM_BATCH, 
+			MSG_DONTWAIT, NULL);
+	if (res < 0)
+		return -1;
+
+	//Keep a reference in case notify function drops the last one
+	sme_dgram_reader_ref(reader);
+
+	for (i = 0; i < res; i++)
+	{
+		if (reader->msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+		{
+			reader->n_dropped++;
+			continue;
+		}
+
+		msg = sme_msg_parse(reader->iov[i].iov_base, reader->msgs[i].msg_len);
+		if (! msg)
+		{
+			reader->n_dropped++;
+			continue;
+		}
+
+		sme_probe2(reader_deliver, reader, msg);
+		(* reader->notify.call)(msg, reader->notify.data);
+	}
+
+	sme_dgram_reader_unref(reader);
+
+	return res;
+}
+
+uint64_t sme_dgram_reader_get_n_dropped(SmeDgramReader *reader)
+{
+	return reader->n_dropped;
+}
+
@@ -0,0 +1,57 @@
+/* dgram.h
+ * Message-oriented channel over datagram sockets
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* For SOCK_SEQPACKET and SOCK_DGRAM sockets, every write job is sent as 
+ * one datagram, so a message written by SmeMsgWriter is exactly one 
+ * datagram. Up to SME_DGRAM_BATCH datagrams are sent or received per 
+ * syscall using sendmmsg() and recvmmsg().
+ * 
+ * SmeDgramChannel only implements the writing side of SmeChannel. 
+ * Messages are received with SmeDgramReader, which parses every datagram
+ * as a whole message and so does not need separate reads for size, 
+ * layout and data. Datagrams that are truncated or malformed are dropped.
+ */
+
+#define SME_DGRAM_BATCH 32
+
+typedef struct _SmeDgramChannel SmeDgramChannel;
+
+SmeDgramChannel *sme_dgram_channel_new(int fd);
+
+int sme_dgram_channel_get_write_queue_len(SmeDgramChannel *channel);
+
+//Number of jobs that could not be sent because they were too large
+uint64_t sme_dgram_channel_get_n_dropped(SmeDgramChannel *channel);
+
+//Datagram reader
+typedef struct _SmeDgramReader SmeDgramReader;
+
+mdsl_rc_declare(SmeDgramReader, sme_dgram_reader);
+
+//Datagrams longer than max_size are dropped
+SmeDgramReader *sme_dgram_reader_new
+	(int fd, size_t max_size, SmeMsgReaderNotify notify);
+
+//Receives one batch of datagrams, returns number of datagrams received
+//or -1 on error.
+ssize_t sme_dgram_reader_read(SmeDgramReader *reader);
+
+uint64_t sme_dgram_reader_get_n_dropped(SmeDgramReader *reader);
+
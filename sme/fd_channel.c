@@ -18,12 +18,23 @@
  * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
 #include "incl.h"
+#include "probes.h"
 
 
 //TODO: Fix IOV_MAX stuff
 #include <limits.h> 
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <event2/event.h>
+#ifdef SO_TIMESTAMPING
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#endif
 
 //Declarations
 mdsl_declare_queue(struct iovec, IovQueue, iov_queue);
@@ -34,23 +45,59 @@ typedef struct
 	int enabled;
 	IovQueue iov[1];
 	IntQueue compl[1];
+	//Completed jobs not yet notified, and whether to keep holding them
 	int n_pending_compl;
+	int hold;
+	size_t n_bytes;
 	SmeJobSource source;
+	SmeLaneStats *stats;
 } ChannelLane;
 
 struct _SmeFdChannel
 {
 	SmeChannel parent;
-	int fd;
+	int fd, write_fd;
 
 	ChannelLane write[1], read[1];
 	size_t iov_max;
+
+	//Gifting pages to a pipe with vmsplice(), bytes written since
+	//enabled and end of last gifted block
+	int vmsplice;
+	size_t page_size;
+	uint64_t n_written, gift_end;
+
+	//Kernel receive timestamps, of the latest read that had one
+	int timestamping;
+	uint64_t rx_timestamp;
+
+	//Busy polling, budgets in nanoseconds, 0 if disabled
+	uint64_t busy_poll_max;
+	uint64_t busy_poll_budget;
+
+	//libevent integration, ev_read is NULL if not attached.
+	//ev_held polls held completions instead of ev_write.
+	struct event *ev_read, *ev_write, *ev_held;
+	int ev_read_added, ev_write_added, ev_held_added;
+	SmeChannelCB ev_cb;
 };
 
 //Channel lane
-static void channel_lane_init(ChannelLane *lane)
+static void channel_lane_init(ChannelLane *lane, SmeLaneStats *stats)
 {
 	lane->enabled = 0;
+	lane->stats = stats;
+}
+
+static void channel_lane_update_watermarks(ChannelLane *lane)
+{
+	size_t queue_len;
+
+	queue_len = int_queue_size(lane->compl);
+	if (lane->stats->max_queue_len < queue_len)
+		lane->stats->max_queue_len = queue_len;
+	if (lane->stats->max_queue_bytes < lane->n_bytes)
+		lane->stats->max_queue_bytes = lane->n_bytes;
 }
 
 static void channel_lane_add_job
@@ -66,9 +113,89 @@ static void channel_lane_add_job
 	{
 		allocd[i].iov_base = blocks[i].mem;
 		allocd[i].iov_len  = blocks[i].len;
+		lane->n_bytes += blocks[i].len;
 	}
 
 	int_queue_push(lane->compl, (int) n_blocks);
+
+	channel_lane_update_watermarks(lane);
+}
+
+//Inserts a job before job at position pos
+static void channel_lane_insert_job
+	(ChannelLane *lane, int pos, SscMBlock *blocks, size_t n_blocks)
+{
+	struct iovec *iov;
+	int *compl;
+	int len, iov_len, iov_pos;
+	int i;
+
+	//Held jobs are not in the queue any more
+	pos -= lane->n_pending_compl;
+	len = int_queue_size(lane->compl);
+	if (pos >= len)
+	{
+		channel_lane_add_job(lane, blocks, n_blocks);
+		return;
+	}
+
+	//Find position of first block of the job
+	compl = int_queue_head(lane->compl);
+	iov_pos = 0;
+	for (i = 0; i < pos; i++)
+		iov_pos += compl[i];
+
+	//Make room for completion
+	int_queue_alloc_n(lane->compl, 1);
+	compl = int_queue_head(lane->compl);
+	memmove(compl + pos + 1, compl + pos, sizeof(int) * (len - pos));
+	compl[pos] = (int) n_blocks;
+
+	//Make room for blocks
+	iov_len = iov_queue_size(lane->iov);
+	iov_queue_alloc_n(lane->iov, n_blocks);
+	iov = iov_queue_head(lane->iov);
+	memmove(iov + iov_pos + n_blocks, iov + iov_pos, 
+			sizeof(struct iovec) * (iov_len - iov_pos));
+	for (i = 0; i < n_blocks; i++)
+	{
+		iov[iov_pos + i].iov_base = blocks[i].mem;
+		iov[iov_pos + i].iov_len  = blocks[i].len;
+		lane->n_bytes += blocks[i].len;
+	}
+
+	channel_lane_update_watermarks(lane);
+}
+
+//Removes job at position pos, which must not have been started
+static void channel_lane_remove_job(ChannelLane *lane, int pos)
+{
+	struct iovec *iov;
+	int *compl;
+	int len, iov_pos, n_blocks;
+	int i;
+
+	pos -= lane->n_pending_compl;
+	len = int_queue_size(lane->compl);
+	sme_assert(pos >= 0 && pos < len, "Invalid job position %d", pos);
+
+	//Find blocks of the job
+	compl = int_queue_head(lane->compl);
+	iov_pos = 0;
+	for (i = 0; i < pos; i++)
+		iov_pos += compl[i];
+	n_blocks = compl[pos];
+
+	//Remove by moving the preceding entries over it 
+	//and popping from the head
+	memmove(compl + 1, compl, sizeof(int) * pos);
+	int_queue_pop_n(lane->compl, 1);
+
+	iov = iov_queue_head(lane->iov);
+	for (i = 0; i < n_blocks; i++)
+		lane->n_bytes -= iov[iov_pos + i].iov_len;
+	memmove(iov + n_blocks, iov, sizeof(struct iovec) * iov_pos);
+	iov_queue_pop_n(lane->iov, n_blocks);
 }
 
 static void channel_lane_enable
@@ -82,6 +209,8 @@ static void channel_lane_enable
 	lane->source = source;
 	lane->enabled = 1;
 	lane->n_pending_compl = 0;
+	lane->hold = 0;
+	lane->n_bytes = 0;
 	iov_queue_init(lane->iov);
 	int_queue_init(lane->compl);
 }
@@ -96,13 +225,18 @@ static void channel_lane_disable(ChannelLane *lane)
 	}
 }
 
-static void channel_lane_pop_bytes(ChannelLane *lane, size_t n_bytes)
+//Returns number of blocks that were completed
+static int channel_lane_pop_bytes(ChannelLane *lane, size_t n_bytes)
 {
 	struct iovec *dv;
 	int *head;
 	int i;
 	int len, cnt, blk, job;
 	
+	lane->n_bytes -= n_bytes;
+	if (n_bytes > 0 && lane->source.progress)
+		(* lane->source.progress)(lane->source.source_ptr, n_bytes);
+
 	//Adjust iov, remove completed blocks
 	dv = iov_queue_head(lane->iov);
 	len = iov_queue_size(lane->iov);
@@ -133,10 +267,16 @@ static void channel_lane_pop_bytes(ChannelLane *lane, size_t n_bytes)
 	job = i;
 	int_queue_pop_n(lane->compl, job);
 
-	//Inform completions
-	if (job > 0)
+	//Inform completions, unless they are held back. Once one job is held
+	//later ones are held too, so that completions stay in order.
+	lane->stats->n_jobs += job;
+	if (lane->hold || lane->n_pending_compl > 0)
+		lane->n_pending_compl += job;
+	else if (job > 0)
 		(* lane->source.notify)
 			(lane->source.source_ptr, job);
+
+	return blk;
 }
 
 #define channel_lane_io(lane, fd, fn, iov_max, res) \
@@ -146,21 +286,161 @@ do { \
 	size_t size = iov_queue_size(lane->iov); \
 	if (size > iov_max) \
 		size = iov_max; \
+	sme_probe4(lane_io_entry, lane, fd, size, lane->n_bytes); \
 	res = fn(fd, iov_queue_head(lane->iov), size); \
+	sme_probe3(lane_io_return, lane, fd, res); \
+	lane->stats->n_syscalls++; \
+	lane->stats->n_iovecs += size; \
 	if (res >= 0) \
-		channel_lane_pop_bytes(lane, res); \
+	{ \
+		lane->stats->n_bytes += res; \
+		if (channel_lane_pop_bytes(lane, res) < size && res > 0) \
+			lane->stats->n_partial++; \
+	} \
+	else if (errno == EAGAIN || errno == EWOULDBLOCK) \
+	{ \
+		lane->stats->n_eagain++; \
+	} \
 } while (0)
 
+//Gifting pages to a pipe
+
+#ifdef HAVE_VMSPLICE
+
+/* Pages of a block that start on a page boundary and span at least one
+ * page are gifted to the pipe instead of copied. The pipe keeps referring
+ * to them until the reader consumes them, so completions of all jobs are
+ * held from the first gifted byte until the pipe has drained past the
+ * last one, which is found out with FIONREAD on every write.
+ */
+
+//Returns number of leading blocks that should be gifted if gift is set,
+//or copied otherwise
+static size_t channel_lane_count_gift
+	(ChannelLane *lane, size_t page_size, int gift, size_t iov_max)
+{
+	struct iovec *iov = iov_queue_head(lane->iov);
+	size_t size = iov_queue_size(lane->iov);
+	size_t i;
+
+	if (size > iov_max)
+		size = iov_max;
+	for (i = 0; i < size; i++)
+	{
+		int giftable = ((uintptr_t) iov[i].iov_base & (page_size - 1)) == 0
+			&& iov[i].iov_len >= page_size;
+		if (giftable != gift)
+			break;
+	}
+
+	return i;
+}
+
+//Informs held completions
+static void channel_lane_release(ChannelLane *lane)
+{
+	int job = lane->n_pending_compl;
+
+	lane->hold = 0;
+	lane->n_pending_compl = 0;
+	if (job > 0)
+		(* lane->source.notify)
+			(lane->source.source_ptr, job);
+}
+
+static ssize_t vmsplice_gift(int fd, struct iovec *iov, size_t iov_len)
+{
+	return vmsplice(fd, iov, iov_len, SPLICE_F_GIFT | SPLICE_F_NONBLOCK);
+}
+
+//Releases held completions once the reader has consumed gifted pages
+static void sme_fd_channel_release_gifts(SmeFdChannel *channel)
+{
+	int in_pipe;
+
+	if (! channel->write->hold)
+		return;
+	if (ioctl(channel->write_fd, FIONREAD, &in_pipe) < 0)
+		return;
+	if (channel->n_written - in_pipe >= channel->gift_end)
+		channel_lane_release(channel->write);
+}
+
+#endif //HAVE_VMSPLICE
+
+//Kernel receive timestamps
+
+#ifdef SO_TIMESTAMPING
+
+static ssize_t timestamp_recv
+	(SmeFdChannel *channel, int fd, struct iovec *iov, size_t iov_len)
+{
+	union
+	{
+		char buf[CMSG_SPACE(sizeof(struct scm_timestamping))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct scm_timestamping ts;
+	ssize_t res;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iov_len;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	res = recvmsg(fd, &msg, 0);
+	if (res <= 0)
+		return res;
+
+	//Software timestamp is the first one
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if (cmsg->cmsg_level != SOL_SOCKET 
+			|| cmsg->cmsg_type != SCM_TIMESTAMPING)
+			continue;
+		memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+		if (ts.ts[0].tv_sec || ts.ts[0].tv_nsec)
+			channel->rx_timestamp = ((uint64_t) ts.ts[0].tv_sec) * 1000000000
+				+ ts.ts[0].tv_nsec;
+	}
+
+	return res;
+}
+
+//channel_lane_io() passes only the fd to the IO function
+#define channel_timestamp_recv(fd, iov, iov_len) \
+	timestamp_recv(channel, fd, iov, iov_len)
+
+#endif //SO_TIMESTAMPING
+
 static int channel_lane_get_queue_len(ChannelLane *lane)
 {
-	return int_queue_size(lane->compl);
+	//Queues exist only while the lane is enabled
+	if (! lane->enabled)
+		return 0;
+	return int_queue_size(lane->compl) + lane->n_pending_compl;
+}
+
+//Nothing is left to do but informing held completions
+static int channel_lane_is_held(ChannelLane *lane)
+{
+	if (! lane->enabled)
+		return 0;
+	return int_queue_size(lane->compl) == 0 && lane->n_pending_compl > 0;
 }
 
+//libevent integration
+static void sme_fd_channel_event_update(SmeFdChannel *channel);
+
 //Virtual function implementations
 static void sme_fd_channel_destroy(SmeChannel *base_type)
 {
 	SmeFdChannel *channel = (SmeFdChannel *) base_type;
 
+	sme_fd_channel_detach_event_base(channel);
 	channel_lane_disable(channel->write);
 	channel_lane_disable(channel->read);
 
@@ -182,6 +462,7 @@ static void sme_fd_channel_unset_write_source(SmeChannel *base_type)
 	SmeFdChannel *channel = (SmeFdChannel *) base_type;
 
 	channel_lane_disable(channel->write);
+	sme_fd_channel_event_update(channel);
 }
 
 static void sme_fd_channel_add_write_job
@@ -190,14 +471,64 @@ static void sme_fd_channel_add_write_job
 	SmeFdChannel *channel = (SmeFdChannel *) base_type;
 
 	channel_lane_add_job(channel->write, blocks, n_blocks);	
+	sme_fd_channel_event_update(channel);
+}
+
+static void sme_fd_channel_insert_write_job
+	(SmeChannel *base_type, int pos, SscMBlock *blocks, size_t n_blocks)
+{
+	SmeFdChannel *channel = (SmeFdChannel *) base_type;
+
+	channel_lane_insert_job(channel->write, pos, blocks, n_blocks);	
+	sme_fd_channel_event_update(channel);
+}
+
+static void sme_fd_channel_remove_write_job(SmeChannel *base_type, int pos)
+{
+	SmeFdChannel *channel = (SmeFdChannel *) base_type;
+
+	channel_lane_remove_job(channel->write, pos);	
 }
 
 static ssize_t sme_fd_channel_write(SmeChannel *base_type)
 {
 	SmeFdChannel *channel = (SmeFdChannel *) base_type;
 	ssize_t res;
+	size_t iov_max = channel->iov_max;
+
+#ifdef HAVE_VMSPLICE
+	if (channel->vmsplice)
+	{
+		//Without anything to write only held completions are checked
+		sme_fd_channel_release_gifts(channel);
+		if (iov_queue_size(channel->write->iov) == 0)
+			return 0;
+		iov_max = channel_lane_count_gift
+			(channel->write, channel->page_size, 0, iov_max);
+		if (iov_max == 0 && iov_queue_size(channel->write->iov) > 0)
+		{
+			iov_max = channel_lane_count_gift
+				(channel->write, channel->page_size, 1, channel->iov_max);
+			channel->write->hold = 1;
+			channel_lane_io
+				(channel->write, channel->write_fd, vmsplice_gift, 
+				 iov_max, res);
+			if (res > 0)
+				channel->gift_end = channel->n_written + res;
+		}
+		else
+		{
+			channel_lane_io
+				(channel->write, channel->write_fd, writev, iov_max, res);
+		}
+		if (res > 0)
+			channel->n_written += res;
+		return res;
+	}
+#endif
+
 	channel_lane_io
-		(channel->write, channel->fd, writev, channel->iov_max, res);
+		(channel->write, channel->write_fd, writev, iov_max, res);
 	return res;
 }
 
@@ -213,6 +544,7 @@ static void sme_fd_channel_unset_read_source(SmeChannel *base_type)
 {
 	SmeFdChannel *channel = (SmeFdChannel *) base_type;
 	channel_lane_disable(channel->read);
+	sme_fd_channel_event_update(channel);
 }
 
 static void sme_fd_channel_add_read_job
@@ -221,30 +553,359 @@ static void sme_fd_channel_add_read_job
 	SmeFdChannel *channel = (SmeFdChannel *) base_type;
 
 	channel_lane_add_job(channel->read, blocks, n_blocks);	
+	sme_fd_channel_event_update(channel);
+}
+
+static ssize_t sme_fd_channel_read_once(SmeFdChannel *channel)
+{
+	ssize_t res;
+	size_t iov_max = channel->iov_max;
+
+#ifdef SO_TIMESTAMPING
+	if (channel->timestamping)
+	{
+		channel_lane_io
+			(channel->read, channel->fd, channel_timestamp_recv, 
+			 iov_max, res);
+		return res;
+	}
+#endif
+
+	channel_lane_io
+		(channel->read, channel->fd, readv, iov_max, res);
+	return res;
+}
+
+//Keeps reading for up to the current budget after data has arrived.
+//Budget doubles when spinning finds new data and halves when it does not,
+//within [busy_poll_max / SME_FD_CHANNEL_BUSY_POLL_RANGE, busy_poll_max].
+static ssize_t sme_fd_channel_busy_poll(SmeFdChannel *channel, ssize_t total)
+{
+	uint64_t start = sme_latency_now();
+	uint64_t min_budget;
+	ssize_t res;
+	int waited = 0, found = 0;
+
+	while (channel_lane_get_queue_len(channel->read) > 0)
+	{
+		res = sme_fd_channel_read_once(channel);
+		if (res > 0)
+		{
+			//Data that was already there does not count as a hit
+			total += res;
+			found |= waited;
+		}
+		else
+		{
+			//End of file and errors are reported by the next read
+			if (res == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+				break;
+			waited = 1;
+		}
+
+		//Reader adds jobs as it goes, so a peer that keeps sending 
+		//would otherwise keep us here
+		if (sme_latency_now() - start >= channel->busy_poll_budget)
+			break;
+	}
+
+	min_budget = channel->busy_poll_max / SME_FD_CHANNEL_BUSY_POLL_RANGE;
+	if (found)
+		channel->busy_poll_budget *= 2;
+	else
+		channel->busy_poll_budget /= 2;
+	if (channel->busy_poll_budget > channel->busy_poll_max)
+		channel->busy_poll_budget = channel->busy_poll_max;
+	if (channel->busy_poll_budget < min_budget)
+		channel->busy_poll_budget = min_budget;
+
+	return total;
 }
 
 static ssize_t sme_fd_channel_read(SmeChannel *base_type)
 {
 	SmeFdChannel *channel = (SmeFdChannel *) base_type;
 	ssize_t res;
-	channel_lane_io
-		(channel->read, channel->fd, readv, channel->iov_max, res);
+
+	res = sme_fd_channel_read_once(channel);
+	if (res > 0 && channel->busy_poll_max)
+		res = sme_fd_channel_busy_poll(channel, res);
+
 	return res;
 }
 
+static uint64_t sme_fd_channel_get_rx_timestamp_fn(SmeChannel *base_type)
+{
+	SmeFdChannel *channel = (SmeFdChannel *) base_type;
+
+	return channel->rx_timestamp;
+}
+
+//libevent integration
+
+//Read and write events are added only while the lane has jobs.
+//While the write lane only has held completions the fd stays writable,
+//so a timer polls them instead.
+static void sme_fd_channel_event_update(SmeFdChannel *channel)
+{
+	struct timeval tv = {0, SME_FD_CHANNEL_HELD_POLL_MS * 1000};
+	int want, held;
+
+	if (! channel->ev_read)
+		return;
+
+	want = channel_lane_get_queue_len(channel->read) > 0;
+	if (want != channel->ev_read_added)
+	{
+		if (want)
+			event_add(channel->ev_read, NULL);
+		else
+			event_del(channel->ev_read);
+		channel->ev_read_added = want;
+	}
+
+	held = channel_lane_is_held(channel->write);
+	want = channel_lane_get_queue_len(channel->write) > 0 && ! held;
+	if (want != channel->ev_write_added)
+	{
+		if (want)
+			event_add(channel->ev_write, NULL);
+		else
+			event_del(channel->ev_write);
+		channel->ev_write_added = want;
+	}
+
+	if (held != channel->ev_held_added)
+	{
+		if (held)
+			event_add(channel->ev_held, &tv);
+		else
+			event_del(channel->ev_held);
+		channel->ev_held_added = held;
+	}
+}
+
+static void sme_fd_channel_event_fail(SmeFdChannel *channel)
+{
+	SmeChannelCB cb = channel->ev_cb;
+
+	sme_fd_channel_detach_event_base(channel);
+	if (cb.failed)
+		(* cb.failed)((SmeChannel *) channel, cb.ptr);
+}
+
+static void sme_fd_channel_event_cb(evutil_socket_t fd, short what, void *arg)
+{
+	SmeFdChannel *channel = (SmeFdChannel *) arg;
+	ChannelLane *lane = (what & EV_WRITE) ? channel->write : channel->read;
+	ssize_t res;
+	int i;
+
+	//Job source may drop the last reference
+	sme_channel_ref((SmeChannel *) channel);
+
+	for (i = 0; i < SME_FD_CHANNEL_EVENT_IO_LIMIT; i++)
+	{
+		if (! channel->ev_read || channel_lane_get_queue_len(lane) == 0)
+			break;
+
+		if (what & EV_WRITE)
+			res = sme_fd_channel_write((SmeChannel *) channel);
+		else
+			res = sme_fd_channel_read((SmeChannel *) channel);
+
+		if (res > 0 || (res == 0 && (what & EV_WRITE)))
+		{
+			//Left to the timer
+			if (channel_lane_is_held(lane))
+				break;
+			continue;
+		}
+		if (res < 0 && errno == EINTR)
+			continue;
+		if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+
+		//End of file or failure
+		sme_fd_channel_event_fail(channel);
+		break;
+	}
+
+	sme_fd_channel_event_update(channel);
+
+	sme_channel_unref((SmeChannel *) channel);
+}
+
+static void sme_fd_channel_held_cb(evutil_socket_t fd, short what, void *arg)
+{
+	SmeFdChannel *channel = (SmeFdChannel *) arg;
+
+	//Job source may drop the last reference
+	sme_channel_ref((SmeChannel *) channel);
+
+	//Timer is not persistent
+	channel->ev_held_added = 0;
+#ifdef HAVE_VMSPLICE
+	sme_fd_channel_release_gifts(channel);
+#endif
+	sme_fd_channel_event_update(channel);
+
+	sme_channel_unref((SmeChannel *) channel);
+}
+
+int sme_fd_channel_attach_event_base
+	(SmeFdChannel *channel, struct event_base *base, SmeChannelCB cb)
+{
+	sme_assert(! channel->ev_read, "Channel is already attached");
+
+	channel->ev_read = event_new(base, channel->fd, EV_READ | EV_PERSIST,
+			sme_fd_channel_event_cb, channel);
+	channel->ev_write = event_new(base, channel->write_fd, EV_WRITE | EV_PERSIST,
+			sme_fd_channel_event_cb, channel);
+	channel->ev_held = evtimer_new(base, sme_fd_channel_held_cb, channel);
+	if (! channel->ev_read || ! channel->ev_write || ! channel->ev_held)
+	{
+		if (channel->ev_read)
+			event_free(channel->ev_read);
+		if (channel->ev_write)
+			event_free(channel->ev_write);
+		if (channel->ev_held)
+			event_free(channel->ev_held);
+		channel->ev_read = channel->ev_write = channel->ev_held = NULL;
+		errno = ENOMEM;
+		return -1;
+	}
+
+	channel->ev_read_added = channel->ev_write_added = 0;
+	channel->ev_held_added = 0;
+	channel->ev_cb = cb;
+	sme_fd_channel_event_update(channel);
+
+	return 0;
+}
+
+void sme_fd_channel_detach_event_base(SmeFdChannel *channel)
+{
+	if (! channel->ev_read)
+		return;
+
+	//event_free() removes pending events
+	event_free(channel->ev_read);
+	event_free(channel->ev_write);
+	event_free(channel->ev_held);
+	channel->ev_read = channel->ev_write = channel->ev_held = NULL;
+	channel->ev_read_added = channel->ev_write_added = 0;
+	channel->ev_held_added = 0;
+}
+
+int sme_fd_channel_get_fd(SmeFdChannel *channel)
+{
+	return channel->fd;
+}
+
+int sme_fd_channel_get_write_fd(SmeFdChannel *channel)
+{
+	return channel->write_fd;
+}
+
 //Writing
 int sme_fd_channel_get_write_queue_len(SmeFdChannel *channel)
 {
 	return channel_lane_get_queue_len(channel->write);
 }
 
+int sme_fd_channel_is_write_held(SmeFdChannel *channel)
+{
+	return channel_lane_is_held(channel->write);
+}
+
 //Reading
 int sme_fd_channel_get_read_queue_len(SmeFdChannel *channel)
 {
 	return channel_lane_get_queue_len(channel->read);
 }
 
+//Busy polling
+int sme_fd_channel_set_busy_poll
+	(SmeFdChannel *channel, uint64_t budget_ns, int so_busy_poll_us)
+{
+#ifdef SO_BUSY_POLL
+	if (so_busy_poll_us > 0
+		&& setsockopt(channel->fd, SOL_SOCKET, SO_BUSY_POLL,
+			&so_busy_poll_us, sizeof(so_busy_poll_us)) < 0)
+		return -1;
+#else
+	if (so_busy_poll_us > 0)
+	{
+		errno = ENOPROTOOPT;
+		return -1;
+	}
+#endif
+
+	channel->busy_poll_max = budget_ns;
+	channel->busy_poll_budget = budget_ns;
+	return 0;
+}
+
+uint64_t sme_fd_channel_get_busy_poll_budget(SmeFdChannel *channel)
+{
+	return channel->busy_poll_budget;
+}
+
+//Kernel receive timestamps
+int sme_fd_channel_set_timestamping(SmeFdChannel *channel, int enabled)
+{
+#ifdef SO_TIMESTAMPING
+	int flags = 0;
+
+	if (enabled)
+		flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+	if (setsockopt(channel->fd, SOL_SOCKET, SO_TIMESTAMPING, 
+			&flags, sizeof(flags)) < 0)
+		return -1;
+
+	channel->timestamping = enabled ? 1 : 0;
+	channel->rx_timestamp = 0;
+	return 0;
+#else
+	channel->timestamping = 0;
+	if (enabled)
+	{
+		errno = ENOPROTOOPT;
+		return -1;
+	}
+	return 0;
+#endif
+}
+
+uint64_t sme_fd_channel_get_rx_timestamp(SmeFdChannel *channel)
+{
+	return channel->rx_timestamp;
+}
+
+//Gifting pages to a pipe
+int sme_fd_channel_set_vmsplice(SmeFdChannel *channel, int enabled)
+{
+#ifdef HAVE_VMSPLICE
+	if (! enabled)
+		sme_assert(! channel->write->hold, 
+			"Gifted pages are still in the pipe");
+	channel->vmsplice = enabled;
+	channel->n_written = 0;
+	channel->gift_end = 0;
+	return 0;
+#else
+	channel->vmsplice = 0;
+	return enabled ? -1 : 0;
+#endif
+}
+
 SmeFdChannel *sme_fd_channel_new(int fd)
+{
+	return sme_fd_channel_new_pair(fd, fd);
+}
+
+SmeFdChannel *sme_fd_channel_new_pair(int read_fd, int write_fd)
 {
 	SmeFdChannel *channel;
 
@@ -252,7 +913,18 @@ SmeFdChannel *sme_fd_channel_new(int fd)
 
 	sme_channel_init((SmeChannel*) channel);
 
-	channel->fd = fd;
+	channel->fd = read_fd;
+	channel->write_fd = write_fd;
+	channel->vmsplice = 0;
+	channel->page_size = sysconf(_SC_PAGESIZE);
+	channel->n_written = channel->gift_end = 0;
+	channel->timestamping = 0;
+	channel->rx_timestamp = 0;
+	channel->busy_poll_max = 0;
+	channel->busy_poll_budget = 0;
+	channel->ev_read = channel->ev_write = channel->ev_held = NULL;
+	channel->ev_read_added = channel->ev_write_added = 0;
+	channel->ev_held_added = 0;
 
 	//IOV_MAX restriction?
 #ifdef IOV_MAX
@@ -262,8 +934,8 @@ SmeFdChannel *sme_fd_channel_new(int fd)
 #endif
 
 	//Initialize lanes
-	channel_lane_init(channel->write);
-	channel_lane_init(channel->read);
+	channel_lane_init(channel->write, &(channel->parent.stats.write));
+	channel_lane_init(channel->read, &(channel->parent.stats.read));
 	
 	//Setup virtual functions
 	channel->parent.destroy = sme_fd_channel_destroy;
@@ -273,8 +945,11 @@ SmeFdChannel *sme_fd_channel_new(int fd)
 	channel->parent.unset_write_source = sme_fd_channel_unset_write_source;
 	channel->parent.add_read_job = sme_fd_channel_add_read_job;
 	channel->parent.add_write_job = sme_fd_channel_add_write_job;
+	channel->parent.insert_write_job = sme_fd_channel_insert_write_job;
+	channel->parent.remove_write_job = sme_fd_channel_remove_write_job;
 	channel->parent.read = sme_fd_channel_read;
 	channel->parent.write = sme_fd_channel_write;
+	channel->parent.get_rx_timestamp = sme_fd_channel_get_rx_timestamp_fn;
 
 	return channel;
 }
@@ -284,7 +959,7 @@ ssize_t sme_fd_channel_test_write(SmeFdChannel *channel, SmeVectorIOFn fn)
 {
 	ssize_t res;
 	channel_lane_io
-		(channel->write, channel->fd, (*fn), channel->iov_max, res);
+		(channel->write, channel->write_fd, (*fn), channel->iov_max, res);
 	return res;
 }
 
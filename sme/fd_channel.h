@@ -22,18 +22,86 @@
 //Implementation for file descriptor backend using libev
 typedef struct _SmeFdChannel SmeFdChannel;
 
+struct event_base;
+
 
 SmeFdChannel *sme_fd_channel_new(int fd);
 
+//Reads from read_fd and writes to write_fd, e.g. ends of two pipes
+SmeFdChannel *sme_fd_channel_new_pair(int read_fd, int write_fd);
+
+//File descriptor that is read from
+int sme_fd_channel_get_fd(SmeFdChannel *channel);
+
+//File descriptor that is written to, same as above unless created as pair
+int sme_fd_channel_get_write_fd(SmeFdChannel *channel);
+
 
 //Writing
 
 int sme_fd_channel_get_write_queue_len(SmeFdChannel *channel);
 
+//Whether the write lane only has completions that are held back, see
+//sme_fd_channel_set_vmsplice(). Writing then only checks whether they
+//can be released, and the fd being writable says nothing about that.
+int sme_fd_channel_is_write_held(SmeFdChannel *channel);
+
 //Reading
 
 int sme_fd_channel_get_read_queue_len(SmeFdChannel *channel);
 
+//Runs the channel on a libevent event base. The read event is
+//persistent while the read lane has jobs; the write event is added only
+//while the write lane has jobs. Each event runs at most
+//SME_FD_CHANNEL_EVENT_IO_LIMIT reads or writes. While the write lane
+//only has held completions a timer checks them every 
+//SME_FD_CHANNEL_HELD_POLL_MS instead of the write event. On end of file 
+//or IO failure the channel is detached and cb.failed() is called.
+//Returns -1 if events cannot be created.
+#define SME_FD_CHANNEL_EVENT_IO_LIMIT 16
+#define SME_FD_CHANNEL_HELD_POLL_MS 1
+
+int sme_fd_channel_attach_event_base
+	(SmeFdChannel *channel, struct event_base *base, SmeChannelCB cb);
+
+void sme_fd_channel_detach_event_base(SmeFdChannel *channel);
+
+//Busy polling: after a read that got data, keep reading without 
+//returning to the event loop for up to the current budget, also when 
+//data keeps arriving. The budget 
+//starts at budget_ns, halves every time spinning finds nothing and 
+//doubles when it does, but stays within 
+//[budget_ns / SME_FD_CHANNEL_BUSY_POLL_RANGE, budget_ns]. 0 disables.
+//If so_busy_poll_us is positive SO_BUSY_POLL is also set on the socket.
+//Returns -1 if setting SO_BUSY_POLL fails.
+#define SME_FD_CHANNEL_BUSY_POLL_RANGE 16
+
+int sme_fd_channel_set_busy_poll
+	(SmeFdChannel *channel, uint64_t budget_ns, int so_busy_poll_us);
+
+uint64_t sme_fd_channel_get_busy_poll_budget(SmeFdChannel *channel);
+
+//Kernel receive timestamps: with SO_TIMESTAMPING set on the socket, 
+//reads use recvmsg() and keep the software receive timestamp of the 
+//data, which SmeMsgReader reports for every message it delivers. 
+//Timestamps are CLOCK_REALTIME in nanoseconds. Stream sockets only 
+//report them for TCP, not for AF_UNIX.
+//Returns -1 if SO_TIMESTAMPING cannot be set.
+int sme_fd_channel_set_timestamping(SmeFdChannel *channel, int enabled);
+
+//Timestamp of the latest read that had one, 0 if none
+uint64_t sme_fd_channel_get_rx_timestamp(SmeFdChannel *channel);
+
+//Gifting pages to a pipe: write ends that are pipes can pass blocks that
+//start on a page boundary and are at least a page long with
+//vmsplice(SPLICE_F_GIFT), other blocks are written as usual. The reader
+//side just reads. Completions are held back while gifted pages are in
+//the pipe, and released by a later write once the reader has consumed
+//them, so the write lane has to be polled until its queue is empty;
+//libevent integration and SmeReactor poll it with a timer.
+//Returns -1 if vmsplice is not supported.
+int sme_fd_channel_set_vmsplice(SmeFdChannel *channel, int enabled);
+
 //Testing
 #ifndef SME_PUBLIC_HEADER
 
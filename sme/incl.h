@@ -35,11 +35,19 @@
 //Include all modules in dependency-based order
 
 #include "channel.h"
+#include "latency.h"
+#include "crc32c.h"
+#include "timer_wheel.h"
 #include "msg.h"
+#include "mux.h"
 #include "fd_channel.h"
+#include "dgram.h"
 #include "address.h"
 #include "link.h"
 #include "channel_link.h"
+#include "relay.h"
+#include "listener.h"
+#include "reactor.h"
 
 #define sme_error(...) mdsl_context_error("SME", __VA_ARGS__)
 #define sme_warn(...) mdsl_context_warn("SME", __VA_ARGS__) 
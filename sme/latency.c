@@ -0,0 +1,144 @@
+/* latency.c
+ * Latency histograms
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "incl.h"
+
+#include <time.h>
+
+#define SUB_BITS SME_HISTOGRAM_SUB_BITS
+#define SUB_COUNT (1 << SUB_BITS)
+#define MAX_VALUE ((((uint64_t) 1) << SME_HISTOGRAM_MAX_BITS) - 1)
+
+//Histogram
+
+static int sme_histogram_index(uint64_t value)
+{
+	int exp, shift;
+
+	if (value < SUB_COUNT)
+		return (int) value;
+
+	exp = 63 - __builtin_clzll(value);
+	shift = exp - SUB_BITS;
+
+	return ((shift + 1) << SUB_BITS) + (int) ((value >> shift) - SUB_COUNT);
+}
+
+//Returns highest value that falls in the bucket
+static uint64_t sme_histogram_bucket_value(int index)
+{
+	int group = index >> SUB_BITS;
+	int sub = index & (SUB_COUNT - 1);
+	int shift;
+
+	if (group == 0)
+		return sub;
+
+	shift = group - 1;
+	return ((((uint64_t) (sub + SUB_COUNT)) << shift) 
+			+ (((uint64_t) 1) << shift)) - 1;
+}
+
+void sme_histogram_reset(SmeHistogram *hist)
+{
+	memset(hist, 0, sizeof(SmeHistogram));
+}
+
+void sme_histogram_record(SmeHistogram *hist, uint64_t value)
+{
+	if (value > MAX_VALUE)
+		value = MAX_VALUE;
+
+	if (hist->count == 0 || value < hist->min)
+		hist->min = value;
+	if (value > hist->max)
+		hist->max = value;
+	hist->count++;
+	hist->sum += value;
+	hist->buckets[sme_histogram_index(value)]++;
+}
+
+uint64_t sme_histogram_quantile(SmeHistogram *hist, double q)
+{
+	uint64_t rank, seen;
+	int i;
+
+	if (hist->count == 0)
+		return 0;
+
+	if (q <= 0.0)
+		return hist->min;
+	if (q >= 1.0)
+		return hist->max;
+
+	rank = (uint64_t) (q * hist->count);
+	if (rank >= hist->count)
+		rank = hist->count - 1;
+
+	seen = 0;
+	for (i = 0; i < SME_HISTOGRAM_N_BUCKETS; i++)
+	{
+		seen += hist->buckets[i];
+		if (seen > rank)
+		{
+			uint64_t value = sme_histogram_bucket_value(i);
+			return value < hist->max ? value : hist->max;
+		}
+	}
+
+	return hist->max;
+}
+
+double sme_histogram_mean(SmeHistogram *hist)
+{
+	if (hist->count == 0)
+		return 0.0;
+
+	return (double) hist->sum / hist->count;
+}
+
+//Link latencies
+
+void sme_latency_reset(SmeLatency *latency)
+{
+	sme_histogram_reset(&(latency->queue));
+	sme_histogram_reset(&(latency->write));
+	sme_histogram_reset(&(latency->send));
+	sme_histogram_reset(&(latency->receive));
+	sme_histogram_reset(&(latency->wire));
+}
+
+uint64_t sme_latency_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t) ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t sme_latency_now_realtime()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	return ((uint64_t) ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
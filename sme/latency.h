@@ -0,0 +1,68 @@
+/* latency.h
+ * Latency histograms
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//Log-linear histogram with fixed memory. Values below 2^SUB_BITS are 
+//recorded exactly, above that each power of two is split into 
+//2^SUB_BITS linear buckets, giving relative error below 1/2^SUB_BITS.
+#define SME_HISTOGRAM_SUB_BITS 4
+#define SME_HISTOGRAM_MAX_BITS 40
+#define SME_HISTOGRAM_N_BUCKETS \
+	((SME_HISTOGRAM_MAX_BITS - SME_HISTOGRAM_SUB_BITS + 1) \
+	 << SME_HISTOGRAM_SUB_BITS)
+
+typedef struct
+{
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min, max;
+	uint64_t buckets[SME_HISTOGRAM_N_BUCKETS];
+} SmeHistogram;
+
+void sme_histogram_reset(SmeHistogram *hist);
+
+void sme_histogram_record(SmeHistogram *hist, uint64_t value);
+
+uint64_t sme_histogram_quantile(SmeHistogram *hist, double q);
+
+double sme_histogram_mean(SmeHistogram *hist);
+
+//Latencies of messages passing through a link, in nanoseconds
+typedef struct
+{
+	//Send: from sme_link_send to first byte handed to kernel
+	SmeHistogram queue;
+	//Send: from first byte handed to kernel to job completion
+	SmeHistogram write;
+	//Send: from sme_link_send to job completion
+	SmeHistogram send;
+	//Receive: from header arrival to delivery
+	SmeHistogram receive;
+	//Receive: from kernel receive timestamp of header to delivery, 
+	//only for channels that provide timestamps
+	SmeHistogram wire;
+} SmeLatency;
+
+void sme_latency_reset(SmeLatency *latency);
+
+uint64_t sme_latency_now();
+
+//CLOCK_REALTIME, comparable to kernel timestamps
+uint64_t sme_latency_now_realtime();
+
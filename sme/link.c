@@ -24,14 +24,63 @@ mdsl_rc_define(SmeLink, sme_link);
 
 void sme_link_receive(SmeLink *link, MmcMsg *msg)
 {
-	//TODO: implementation
+	if (link->router)
+		sme_router_route(link->router, msg);
 
 	mmc_msg_unref(msg);
 }
 
+void sme_link_set_router(SmeLink *link, SmeRouter *router)
+{
+	if (router)
+		sme_router_ref(router);
+	if (link->router)
+	{
+		sme_router_remove_link(link->router, link);
+		sme_router_unref(link->router);
+	}
+	link->router = router;
+}
+
+void sme_link_add_dest_router(SmeLink *link, SmeRouter *router)
+{
+	if (link->n_dest_routers == link->dest_routers_alloc)
+	{
+		link->dest_routers_alloc = link->dest_routers_alloc * 2 + 4;
+		link->dest_routers = (SmeRouter **) mdsl_realloc(link->dest_routers,
+				link->dest_routers_alloc * sizeof(SmeRouter *));
+	}
+	link->dest_routers[link->n_dest_routers++] = router;
+}
+
+void sme_link_remove_dest_router(SmeLink *link, SmeRouter *router)
+{
+	size_t i;
+
+	for (i = 0; i < link->n_dest_routers; i++)
+	{
+		if (link->dest_routers[i] == router)
+		{
+			link->n_dest_routers--;
+			link->dest_routers[i] = link->dest_routers[link->n_dest_routers];
+			return;
+		}
+	}
+
+	sme_error("Router has no route to the link");
+}
+
 void sme_link_cleanup(SmeLink *link)
 {
+	sme_link_set_router(link, NULL);
 
+	//Removal of a router's routes drops all its entries
+	while (link->n_dest_routers > 0)
+		sme_router_remove_link
+			(link->dest_routers[link->n_dest_routers - 1], link);
+	free(link->dest_routers);
+	link->dest_routers = NULL;
+	link->dest_routers_alloc = 0;
 }
 
 static void sme_link_destroy(SmeLink *link)
@@ -43,6 +92,12 @@ void sme_link_init(SmeLink *link)
 {
 	mdsl_rc_init(link);
 
+	link->router = NULL;
+	link->dest_routers = NULL;
+	link->n_dest_routers = 0;
+	link->dest_routers_alloc = 0;
+	link->send_deadline = NULL;
+
 	link->destroy = sme_link_cleanup;
 }
 
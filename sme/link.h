@@ -26,11 +26,18 @@ struct _SmeLink
 {
 	MdslRC parent;
 
-	//TODO: Address space
+	//Router for received messages
+	SmeRouter *router;
+
+	//Routers that have routes to this link, once per route
+	SmeRouter **dest_routers;
+	size_t n_dest_routers, dest_routers_alloc;
 
 	//Virtual functions
 	void (*destroy) (SmeLink *link);
 	void (*send) (SmeLink *link, MmcMsg *msg);
+	//Optional
+	void (*send_deadline) (SmeLink *link, MmcMsg *msg, uint64_t deadline);
 };
 
 mdsl_rc_declare(SmeLink, sme_link);
@@ -40,8 +47,30 @@ static inline void sme_link_send(SmeLink *link, MmcMsg *msg)
 	(* link->send)(link, msg);
 }
 
+//Message is dropped if it has not started going out by the deadline
+//(nanoseconds, sme_latency_now() clock). Links that do not support 
+//deadlines send it normally.
+static inline void sme_link_send_deadline
+	(SmeLink *link, MmcMsg *msg, uint64_t deadline)
+{
+	if (link->send_deadline)
+		(* link->send_deadline)(link, msg, deadline);
+	else
+		(* link->send)(link, msg);
+}
+
 void sme_link_receive(SmeLink *link, MmcMsg *msg);
 
+//Received messages are forwarded using given router. 
+//Routes to this link are removed when link is destroyed, from 
+//all routers.
+void sme_link_set_router(SmeLink *link, SmeRouter *router);
+
+//Used by SmeRouter to track routes to the link
+void sme_link_add_dest_router(SmeLink *link, SmeRouter *router);
+
+void sme_link_remove_dest_router(SmeLink *link, SmeRouter *router);
+
 void sme_link_cleanup(SmeLink *link);
 
 void sme_link_init(SmeLink *link);
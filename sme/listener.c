@@ -0,0 +1,260 @@
+/* listener.c
+ * Accepting connections as channel links
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "incl.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+struct _SmeListener
+{
+	MdslRC parent;
+
+	int fd;
+	SmeListenerNotify notify;
+
+	struct ev_loop *loop;
+	ev_io watcher;
+
+	//Restarts the watcher after running out of descriptors
+	ev_timer backoff;
+
+	uint64_t n_accepted;
+	uint64_t n_backoffs;
+};
+
+mdsl_rc_define(SmeListener, sme_listener);
+
+static void sme_listener_destroy(SmeListener *listener)
+{
+	sme_listener_stop(listener);
+
+	free(listener);
+}
+
+int sme_listener_bind_tcp
+	(const char *address, int port, int backlog, int reuseport)
+{
+	struct addrinfo hints, *res, *iter;
+	char service[16];
+	int fd = -1;
+	int one = 1;
+	int status, saved_errno = EADDRNOTAVAIL;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+	snprintf(service, sizeof(service), "%d", port);
+
+	status = getaddrinfo(address, service, &hints, &res);
+	if (status != 0)
+	{
+		errno = status == EAI_SYSTEM ? errno : EADDRNOTAVAIL;
+		return -1;
+	}
+
+	for (iter = res; iter; iter = iter->ai_next)
+	{
+		fd = socket(iter->ai_family, 
+				iter->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, 
+				iter->ai_protocol);
+		if (fd < 0)
+		{
+			saved_errno = errno;
+			continue;
+		}
+
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+#ifdef SO_REUSEPORT
+		if (reuseport 
+			&& setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0)
+		{
+			saved_errno = errno;
+			close(fd);
+			fd = -1;
+			continue;
+		}
+#else
+		if (reuseport)
+		{
+			saved_errno = ENOPROTOOPT;
+			close(fd);
+			fd = -1;
+			continue;
+		}
+#endif
+
+		if (bind(fd, iter->ai_addr, iter->ai_addrlen) == 0
+			&& listen(fd, backlog) == 0)
+			break;
+
+		saved_errno = errno;
+		close(fd);
+		fd = -1;
+	}
+
+	freeaddrinfo(res);
+
+	if (fd < 0)
+		errno = saved_errno;
+	return fd;
+}
+
+static void sme_listener_cb(EV_P_ ev_io *w, int revents)
+{
+	SmeListener *listener = w->data;
+
+	sme_listener_accept(listener);
+}
+
+static void sme_listener_backoff_cb(EV_P_ ev_timer *w, int revents)
+{
+	SmeListener *listener = w->data;
+
+	ev_io_start(listener->loop, &(listener->watcher));
+}
+
+SmeListener *sme_listener_new(int fd, SmeListenerNotify notify)
+{
+	SmeListener *listener;
+
+	listener = (SmeListener *) mdsl_alloc(sizeof(SmeListener));
+
+	mdsl_rc_init(listener);
+
+	listener->fd = fd;
+	listener->notify = notify;
+	listener->loop = NULL;
+	listener->n_accepted = 0;
+	listener->n_backoffs = 0;
+	ev_io_init(&(listener->watcher), sme_listener_cb, fd, EV_READ);
+	listener->watcher.data = listener;
+	ev_timer_init(&(listener->backoff), sme_listener_backoff_cb, 
+			SME_LISTENER_BACKOFF_MS / 1000.0, 0.0);
+	listener->backoff.data = listener;
+
+	return listener;
+}
+
+void sme_listener_start(SmeListener *listener, struct ev_loop *loop)
+{
+	sme_assert(! listener->loop, "Listener already started");
+
+	listener->loop = loop;
+	ev_io_start(loop, &(listener->watcher));
+}
+
+void sme_listener_stop(SmeListener *listener)
+{
+	if (! listener->loop)
+		return;
+
+	ev_io_stop(listener->loop, &(listener->watcher));
+	ev_timer_stop(listener->loop, &(listener->backoff));
+	listener->loop = NULL;
+}
+
+static int sme_listener_accept_one(SmeListener *listener)
+{
+#ifdef HAVE_ACCEPT4
+	return accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+	int fd = accept(listener->fd, NULL, NULL);
+	if (fd >= 0)
+	{
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+	return fd;
+#endif
+}
+
+//Level triggered watcher would keep firing while connections wait for
+//descriptors that are not there, so it is stopped for a while.
+static void sme_listener_back_off(SmeListener *listener)
+{
+	listener->n_backoffs++;
+
+	if (listener->loop && ev_is_active(&(listener->watcher)))
+	{
+		ev_io_stop(listener->loop, &(listener->watcher));
+		ev_timer_start(listener->loop, &(listener->backoff));
+	}
+}
+
+int sme_listener_accept(SmeListener *listener)
+{
+	struct ev_loop *loop = listener->loop;
+	int n = 0;
+	int fd;
+	SmeFdChannel *channel;
+	SmeChannelLink *link;
+
+	//Callback may drop the last reference
+	sme_listener_ref(listener);
+
+	//Stops if the listener is stopped from the callback
+	while (listener->loop == loop)
+	{
+		fd = sme_listener_accept_one(listener);
+		if (fd < 0)
+		{
+			//Connection was reset before we got to it
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+
+			if (errno == EMFILE || errno == ENFILE
+				|| errno == ENOBUFS || errno == ENOMEM)
+				sme_listener_back_off(listener);
+
+			break;
+		}
+
+		channel = sme_fd_channel_new(fd);
+		link = sme_channel_link_new((SmeChannel *) channel);
+		sme_channel_unref((SmeChannel *) channel);
+
+		listener->n_accepted++;
+		n++;
+
+		(* listener->notify.accepted)
+			(link, channel, fd, listener->notify.data);
+	}
+
+	sme_listener_unref(listener);
+
+	return n;
+}
+
+uint64_t sme_listener_get_n_accepted(SmeListener *listener)
+{
+	return listener->n_accepted;
+}
+
+uint64_t sme_listener_get_n_backoffs(SmeListener *listener)
+{
+	return listener->n_backoffs;
+}
+
@@ -0,0 +1,74 @@
+/* listener.h
+ * Accepting connections as channel links
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Listener accepts connections on a listening socket when it becomes 
+ * readable, until accept() would block, and wraps every accepted socket
+ * in a SmeFdChannel and SmeChannelLink. The channel is not attached to 
+ * anything: the loop the listener is started on only watches the 
+ * listening socket, and the callee drives the channel, e.g. with 
+ * sme_reactor_add_channel() or sme_fd_channel_attach_event_base().
+ * 
+ * To spread connections over several loop threads, create one socket per
+ * thread with sme_listener_bind_tcp(..., reuseport = 1) and one listener
+ * per loop; the kernel then balances incoming connections between them.
+ */
+
+typedef struct _SmeListener SmeListener;
+
+//Called for every accepted connection. Callee owns the link reference
+//and the socket, which should be closed after the link is destroyed.
+//The channel is held by the link; callee takes its own reference to 
+//keep it beyond that.
+typedef struct
+{
+	void (*accepted)
+		(SmeChannelLink *link, SmeFdChannel *channel, int fd, void *data);
+	void *data;
+} SmeListenerNotify;
+
+mdsl_rc_declare(SmeListener, sme_listener);
+
+//Creates a non-blocking TCP socket listening on given address and port,
+//address may be NULL for all addresses. Returns -1 and sets errno 
+//on failure.
+int sme_listener_bind_tcp
+	(const char *address, int port, int backlog, int reuseport);
+
+//Listener does not take ownership of listening socket.
+SmeListener *sme_listener_new(int fd, SmeListenerNotify notify);
+
+void sme_listener_start(SmeListener *listener, struct ev_loop *loop);
+
+void sme_listener_stop(SmeListener *listener);
+
+//Accepts pending connections until accept() would block. 
+//Called by the watcher, useful when driving the listener manually.
+//When out of descriptors or memory, the watcher is stopped for 
+//SME_LISTENER_BACKOFF_MS instead of firing again right away.
+//Returns number of connections accepted.
+#define SME_LISTENER_BACKOFF_MS 100
+
+int sme_listener_accept(SmeListener *listener);
+
+uint64_t sme_listener_get_n_accepted(SmeListener *listener);
+
+//Number of times accepting stopped for lack of resources
+uint64_t sme_listener_get_n_backoffs(SmeListener *listener);
+
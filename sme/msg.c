@@ -19,123 +19,1080 @@
  */
 
 #include "incl.h"
+#include "probes.h"
+
+
+//Layouts
+
+void sme_layout_iter_init
+	(SmeLayoutIter *iter, const uint32_t *layout, size_t size)
+{
+	iter->layout = layout;
+	iter->size = size;
+	iter->pos = 0;
+	iter->pending = 1;
+}
+
+int sme_layout_iter_next(SmeLayoutIter *iter, size_t *len)
+{
+	uint32_t entry[2];
+	uint32_t mem_len;
+
+	while (iter->pending > 0)
+	{
+		//Every pending message needs two more entries
+		if ((iter->size - iter->pos) / 2 < iter->pending)
+			return -1;
+
+		memcpy(entry, iter->layout + iter->pos, sizeof(entry));
+		iter->pos += 2;
+		iter->pending += ssc_uint32_from_le(entry[1]);
+		iter->pending--;
+
+		mem_len = ssc_uint32_from_le(entry[0]);
+		if (mem_len > 0)
+		{
+			*len = mem_len;
+			return 1;
+		}
+	}
+
+	return iter->pos == iter->size ? 0 : -1;
+}
+
+int sme_layout_get_body_size(const uint32_t *layout, size_t size, 
+		size_t *n_blocks, uint64_t *body_size)
+{
+	SmeLayoutIter iter;
+	size_t len;
+	int res;
+
+	*n_blocks = 0;
+	*body_size = 0;
+	sme_layout_iter_init(&iter, layout, size);
+	while ((res = sme_layout_iter_next(&iter, &len)) > 0)
+	{
+		(*n_blocks)++;
+		*body_size += len;
+	}
+
+	return res;
+}
 
 
 //Message writer
 
-typedef struct
+//Prepared message
+
+struct _SmePreparedMsg
 {
+	MdslRC parent;
+
 	MmcMsg *msg;
+	size_t n_blocks;
+	size_t size;
+
+	//Preamble and blocks, stored in the same allocation
+	//along with copies of small blocks right after the preamble.
+	//iov has room for CRC trailer after the blocks.
+	SscMBlock *iov;
+	uint32_t *preamble;
+
+	//CRC trailer, computed when first needed
+	int has_crc;
+	uint32_t crc_le;
+};
+
+mdsl_rc_define(SmePreparedMsg, sme_prepared_msg);
+
+static void sme_prepared_msg_destroy(SmePreparedMsg *prepared)
+{
+	mmc_msg_unref(prepared->msg);
+	free(prepared);
+}
+
+//Encoding: one traversal of the message with an explicit stack gives 
+//both the layout and the list of non-empty blocks, in the order ssc 
+//reads them. Arrays start in the encoder and move to the heap if the 
+//message is larger.
+#define MSG_ENCODER_INIT_SIZE 64
+
+typedef struct
+{
+	//Layout entries, little endian
+	uint32_t *layout;
+	size_t layout_len, layout_alloc;
+
+	SscMBlock *blocks;
+	size_t n_blocks, blocks_alloc;
+
+	//Messages yet to be visited, next one on top
+	MmcMsg **stack;
+	size_t stack_len, stack_alloc;
+
+	uint32_t layout_init[MSG_ENCODER_INIT_SIZE];
+	SscMBlock blocks_init[MSG_ENCODER_INIT_SIZE];
+	MmcMsg *stack_init[MSG_ENCODER_INIT_SIZE];
+} MsgEncoder;
+
+static void msg_encoder_init(MsgEncoder *enc)
+{
+	enc->layout = enc->layout_init;
+	enc->layout_len = 0;
+	enc->layout_alloc = MSG_ENCODER_INIT_SIZE;
+	enc->blocks = enc->blocks_init;
+	enc->n_blocks = 0;
+	enc->blocks_alloc = MSG_ENCODER_INIT_SIZE;
+	enc->stack = enc->stack_init;
+	enc->stack_len = 0;
+	enc->stack_alloc = MSG_ENCODER_INIT_SIZE;
+}
+
+//Returns array with room for at least need elements
+static void *msg_encoder_grow
+	(void *array, void *init, size_t *alloc, size_t need, size_t elem_size)
+{
+	size_t new_alloc = *alloc;
+	void *res;
+
+	while (new_alloc < need)
+		new_alloc *= 2;
+	res = mdsl_alloc(new_alloc * elem_size);
+	memcpy(res, array, *alloc * elem_size);
+	if (array != init)
+		free(array);
+	*alloc = new_alloc;
+
+	return res;
+}
+
+#define msg_encoder_reserve(enc, field, need) \
+do { \
+	if ((need) > enc->field##_alloc) \
+		enc->field = msg_encoder_grow(enc->field, enc->field##_init, \
+				&(enc->field##_alloc), (need), sizeof(enc->field[0])); \
+} while (0)
+
+static void msg_encoder_run(MsgEncoder *enc, MmcMsg *msg)
+{
+	MmcMsg *node;
+	size_t i;
+
+	enc->stack[enc->stack_len++] = msg;
+	while (enc->stack_len > 0)
+	{
+		node = enc->stack[--enc->stack_len];
+
+		msg_encoder_reserve(enc, layout, enc->layout_len + 2);
+		enc->layout[enc->layout_len++] 
+			= ssc_uint32_to_le((uint32_t) node->mem_len);
+		enc->layout[enc->layout_len++] 
+			= ssc_uint32_to_le((uint32_t) node->submsgs_len);
+
+		if (node->mem_len > 0)
+		{
+			msg_encoder_reserve(enc, blocks, enc->n_blocks + 1);
+			enc->blocks[enc->n_blocks].mem = node->mem;
+			enc->blocks[enc->n_blocks].len = node->mem_len;
+			enc->n_blocks++;
+		}
+
+		//Children in reverse, so that the first one is visited next
+		msg_encoder_reserve(enc, stack, 
+				enc->stack_len + node->submsgs_len);
+		for (i = node->submsgs_len; i > 0; i--)
+			enc->stack[enc->stack_len++] = node->submsgs[i - 1];
+	}
+}
+
+static void msg_encoder_destroy(MsgEncoder *enc)
+{
+	if (enc->layout != enc->layout_init)
+		free(enc->layout);
+	if (enc->blocks != enc->blocks_init)
+		free(enc->blocks);
+	if (enc->stack != enc->stack_init)
+		free(enc->stack);
+}
+
+//Single pass over the block list: copies blocks smaller than threshold 
+//into space after preamble while it lasts, merging them with preceding 
+//preamble or copies, and sums up the size.
+//Returns new number of entries in iov, including preamble.
+static size_t sme_prepared_msg_pack
+	(SscMBlock *iov, size_t n_blocks, size_t threshold, size_t avail,
+	 size_t *size)
+{
+	char *cursor = MDSL_PTR_ADD(iov[0].mem, iov[0].len);
+	size_t out = 0, i;
+	int in_copy = 1;
+	SscMBlock block;
+
+	*size = iov[0].len;
+	for (i = 1; i < n_blocks; i++)
+	{
+		block = iov[i];
+		*size += block.len;
+		if (block.len < threshold && block.len <= avail)
+		{
+			memcpy(cursor, block.mem, block.len);
+			if (in_copy)
+			{
+				iov[out].len += block.len;
+			}
+			else
+			{
+				out++;
+				iov[out].mem = cursor;
+				iov[out].len = block.len;
+				in_copy = 1;
+			}
+			cursor += block.len;
+			avail -= block.len;
+		}
+		else
+		{
+			out++;
+			iov[out] = block;
+			in_copy = 0;
+		}
+	}
+
+	return out + 1;
+}
+
+SmePreparedMsg *sme_prepared_msg_new(MmcMsg *msg)
+{
+	return sme_prepared_msg_new_inline(msg, SME_MSG_INLINE_THRESHOLD);
+}
+
+SmePreparedMsg *sme_prepared_msg_new_inline
+	(MmcMsg *msg, size_t inline_threshold)
+{
+	SmePreparedMsg *prepared;
+	MsgEncoder enc[1];
+	size_t len, n_blocks;
+	size_t inline_max = 0;
+
+	msg_encoder_init(enc);
+	msg_encoder_run(enc, msg);
+	len = enc->layout_len;
+	n_blocks = enc->n_blocks;
+
+	//Each copied block is smaller than the threshold
+	if (inline_threshold)
+	{
+		inline_max = SME_MSG_INLINE_MAX;
+		if (n_blocks < inline_max / inline_threshold)
+			inline_max = n_blocks * inline_threshold;
+	}
+
+	prepared = (SmePreparedMsg *) mdsl_alloc
+		(sizeof(SmePreparedMsg) 
+		 + sizeof(SscMBlock) * (n_blocks + 2)
+		 + sizeof(uint32_t) * (len + 1)
+		 + inline_max);
+
+	mdsl_rc_init(prepared);
+
+	prepared->msg = msg;
+	mmc_msg_ref(msg);
+	prepared->iov = (SscMBlock *) (prepared + 1);
+	prepared->preamble = (uint32_t *) (prepared->iov + n_blocks + 2);
+	prepared->has_crc = 0;
+
+	//Add preamble (size + layout)
+	prepared->preamble[0] = ssc_uint32_to_le((uint32_t) len);
+	memcpy(prepared->preamble + 1, enc->layout, len * sizeof(uint32_t));
+	prepared->iov[0].mem = prepared->preamble;
+	prepared->iov[0].len = (len + 1) * sizeof(uint32_t);
+
+	//Add data
+	memcpy(prepared->iov + 1, enc->blocks, n_blocks * sizeof(SscMBlock));
+	msg_encoder_destroy(enc);
+	prepared->n_blocks = sme_prepared_msg_pack
+		(prepared->iov, n_blocks + 1, inline_threshold, inline_max,
+		 &(prepared->size));
+
+	//Trailer
+	prepared->iov[prepared->n_blocks].mem = &(prepared->crc_le);
+	prepared->iov[prepared->n_blocks].len = sizeof(uint32_t);
+
+	return prepared;
+}
+
+static void sme_prepared_msg_compute_crc(SmePreparedMsg *prepared)
+{
+	uint32_t crc = 0;
+	size_t i;
+
+	if (prepared->has_crc)
+		return;
+
+	for (i = 0; i < prepared->n_blocks; i++)
+		crc = sme_crc32c_update
+			(crc, prepared->iov[i].mem, prepared->iov[i].len);
+	prepared->crc_le = ssc_uint32_to_le(crc);
+	prepared->has_crc = 1;
+}
+
+MmcMsg *sme_prepared_msg_get_msg(SmePreparedMsg *prepared)
+{
+	return prepared->msg;
+}
+
+size_t sme_prepared_msg_get_size(SmePreparedMsg *prepared)
+{
+	return prepared->size;
+}
+
+const SscMBlock *sme_prepared_msg_get_iov
+	(SmePreparedMsg *prepared, int crc, size_t *n_iov)
+{
+	*n_iov = prepared->n_blocks;
+	if (crc)
+	{
+		sme_prepared_msg_compute_crc(prepared);
+		(*n_iov)++;
+	}
+
+	return prepared->iov;
+}
+
+//Message writer
+
+//Deadline of a queued message
+typedef struct
+{
+	SmeTimer timer;
+	SmeMsgWriter *writer;
+	uint64_t expiry;
+} WriterDeadline;
+
+//Generated message, see sme_msg_writer_add_generated()
+typedef struct
+{
+	SmeMsgProducer producer;
+	int prio;
+	size_t chunk_size;
+
+	//Block lengths are taken from the layout in the preamble
+	SmeLayoutIter iter;
+	size_t n_blocks;
+
+	//Next chunk to produce
+	size_t block;
+	size_t block_len;
+	size_t offset;
+
 	uint32_t *preamble;
+	size_t preamble_len;
+
+	int crc;
+	uint32_t crc_value;
+	uint32_t crc_le;
+	int trailer_queued;
+
+	//Chunk buffers, allocated when writing starts
+	void *bufs[SME_MSG_WRITER_GEN_N_BUFS];
+
+	//Number of jobs on the channel
+	int n_jobs;
+
+	//Set once a job has been written
+	int begun;
+} WriterGen;
+
+//A job is either a whole prepared message or a part of generated message
+typedef struct
+{
+	SmePreparedMsg *prepared;
+	size_t size;
+	int prio;
+	uint64_t t_send;
+	uint64_t t_first;
+	WriterDeadline *deadline;
+	WriterGen *gen;
+	int gen_buf;
 } WriterJob;
 
 mdsl_declare_queue(WriterJob, WriterJobQueue, writer_job_queue);
 
+//Message held back while a generated message is being written, or 
+//generated message held back while another one is
+typedef struct
+{
+	SmePreparedMsg *prepared;
+	WriterGen *gen;
+	int prio;
+	uint64_t deadline;
+} WriterDeferred;
+
+mdsl_declare_queue(WriterDeferred, WriterDeferredQueue, writer_deferred_queue);
+
 struct _SmeMsgWriter
 {
 	MdslRC parent;
 
 	SmeChannel *channel;
 	WriterJobQueue job_queue[1];
+	int prio_len[SME_MSG_WRITER_N_PRIO];
+
+	//Progress tracking, offsets are relative to first job in queue
+	size_t n_written;
+	size_t started_end;
+	int n_started;
+
+	SmeLatency *latency;
+	int crc;
+
+	SmeTimerWheel *wheel;
+	uint64_t n_expired;
+
+	//Generated message being written, and messages held back meanwhile
+	WriterGen *gen;
+	WriterDeferredQueue deferred[1];
 };
 
+static void sme_msg_writer_gen_job_done(SmeMsgWriter *writer, WriterJob *job);
+
+static void sme_msg_writer_flush_deferred(SmeMsgWriter *writer);
+
+static void writer_gen_free(WriterGen *gen);
+
 //
 
+static void sme_msg_writer_progress_fn(void *source_ptr, size_t n_bytes)
+{
+	SmeMsgWriter *writer = source_ptr;
+	WriterJob *jobs;
+	int len;
+	uint64_t now = 0;
+
+	writer->n_written += n_bytes;
+
+	//Mark jobs whose first byte has been written
+	jobs = writer_job_queue_head(writer->job_queue);
+	len = writer_job_queue_size(writer->job_queue);
+	while (writer->n_started < len && writer->started_end < writer->n_written)
+	{
+		if (writer->latency && ! now)
+			now = sme_latency_now();
+		jobs[writer->n_started].t_first = now;
+		writer->started_end += jobs[writer->n_started].size;
+		writer->n_started++;
+	}
+}
+
 static void sme_msg_writer_notify_fn(void *source_ptr, int n_jobs)
 {
 	SmeMsgWriter *writer = source_ptr;
+	uint64_t now = 0;
+
+	if (writer->latency)
+		now = sme_latency_now();
 
 	while (n_jobs--)
 	{
 		WriterJob one_job = writer_job_queue_pop(writer->job_queue);	
-		mmc_msg_unref(one_job.msg);
-		free(one_job.preamble);
+
+		if (! one_job.gen)
+			writer->prio_len[one_job.prio]--;
+
+		if (writer->n_started > 0)
+		{
+			writer->n_started--;
+			writer->n_written -= one_job.size;
+			writer->started_end -= one_job.size;
+		}
+		else
+		{
+			//Channel does not report progress
+			one_job.t_first = now;
+		}
+
+		if (one_job.gen)
+		{
+			sme_msg_writer_gen_job_done(writer, &one_job);
+			continue;
+		}
+
+		sme_probe3(writer_job_done, writer, one_job.prepared->msg, 
+				one_job.size);
+
+		if (writer->latency && one_job.t_send && one_job.t_first)
+		{
+			sme_histogram_record(&(writer->latency->queue),
+					one_job.t_first - one_job.t_send);
+			sme_histogram_record(&(writer->latency->write),
+					now - one_job.t_first);
+			sme_histogram_record(&(writer->latency->send),
+					now - one_job.t_send);
+		}
+
+		if (one_job.deadline)
+		{
+			sme_timer_wheel_remove(writer->wheel, &(one_job.deadline->timer));
+			free(one_job.deadline);
+		}
+		sme_prepared_msg_unref(one_job.prepared);
+	}
+
+	if (! writer->gen)
+		sme_msg_writer_flush_deferred(writer);
+}
+
+//Drops a message whose deadline has passed, unless it has been started
+static void sme_msg_writer_deadline_cb(SmeTimer *timer, void *data)
+{
+	WriterDeadline *deadline = data;
+	SmeMsgWriter *writer = deadline->writer;
+	WriterJob *jobs, one_job;
+	int pos, len;
+
+	jobs = writer_job_queue_head(writer->job_queue);
+	len = writer_job_queue_size(writer->job_queue);
+	for (pos = 0; pos < len; pos++)
+	{
+		if (jobs[pos].deadline == deadline)
+			break;
+	}
+	sme_assert(pos < len, "Deadline of a job not in queue");
+
+	one_job = jobs[pos];
+	free(deadline);
+	if (pos < writer->n_started)
+	{
+		jobs[pos].deadline = NULL;
+		return;
+	}
+
+	//Remove from channel and queue
+	sme_channel_remove_write_job(writer->channel, pos);
+	memmove(jobs + 1, jobs, sizeof(WriterJob) * pos);
+	writer_job_queue_pop_n(writer->job_queue, 1);
+	writer->prio_len[one_job.prio]--;
+	writer->n_expired++;
+
+	sme_probe3(writer_job_expired, writer, one_job.prepared->msg, 
+			one_job.size);
+
+	sme_prepared_msg_unref(one_job.prepared);
+}
+
+//
+mdsl_rc_define(SmeMsgWriter, sme_msg_writer);
+
+static void sme_msg_writer_destroy(SmeMsgWriter *writer)
+{
+	int i, len;
+	WriterJob *jobs;
+
+	//Unref channel
+	sme_channel_unset_write_source(writer->channel);	
+	sme_channel_unref(writer->channel);
+	writer->channel = NULL;
+
+	//Destroy job queue
+	len = writer_job_queue_size(writer->job_queue);
+	jobs = writer_job_queue_head(writer->job_queue);
+	for (i = 0; i < len; i++)
+	{
+		if (jobs[i].deadline)
+		{
+			sme_timer_wheel_remove(writer->wheel, &(jobs[i].deadline->timer));
+			free(jobs[i].deadline);
+		}
+		if (jobs[i].prepared)
+			sme_prepared_msg_unref(jobs[i].prepared);
+	}
+	writer_job_queue_destroy(writer->job_queue);
+
+	//Destroy generated and held back messages
+	if (writer->gen)
+		writer_gen_free(writer->gen);
+	while (writer_deferred_queue_size(writer->deferred) > 0)
+	{
+		WriterDeferred one = writer_deferred_queue_pop(writer->deferred);
+		if (one.gen)
+			writer_gen_free(one.gen);
+		else
+			sme_prepared_msg_unref(one.prepared);
+	}
+	writer_deferred_queue_destroy(writer->deferred);
+
+	if (writer->wheel)
+		sme_timer_wheel_unref(writer->wheel);
+
+	free(writer);
+}
+
+SmeMsgWriter *sme_msg_writer_new(SmeChannel *channel)
+{
+	SmeMsgWriter *writer;
+	SmeJobSource js;
+	int i;
+
+	writer = (SmeMsgWriter *) mdsl_alloc(sizeof(SmeMsgWriter));
+
+	mdsl_rc_init(writer);
+	
+	writer_job_queue_init(writer->job_queue); 
+	writer->n_written = 0;
+	writer->started_end = 0;
+	writer->n_started = 0;
+	writer->latency = NULL;
+	writer->crc = 0;
+	writer->wheel = NULL;
+	writer->n_expired = 0;
+	writer->gen = NULL;
+	writer_deferred_queue_init(writer->deferred);
+	for (i = 0; i < SME_MSG_WRITER_N_PRIO; i++)
+		writer->prio_len[i] = 0;
+
+	sme_channel_ref(channel);
+	writer->channel = channel;
+	js.source_ptr = writer;
+	js.notify = sme_msg_writer_notify_fn;
+	js.progress = sme_msg_writer_progress_fn;
+	sme_channel_set_write_source(channel, js);	
+
+	return writer;
+}
+
+void sme_msg_writer_add_msg(SmeMsgWriter *writer, MmcMsg *msg)
+{
+	sme_msg_writer_add_msg_prio(writer, msg, SME_MSG_WRITER_DEFAULT_PRIO);
+}
+
+void sme_msg_writer_add_msg_prio(SmeMsgWriter *writer, MmcMsg *msg, int prio)
+{
+	SmePreparedMsg *prepared = sme_prepared_msg_new(msg);
+
+	sme_msg_writer_add_prepared_prio(writer, prepared, prio);
+
+	sme_prepared_msg_unref(prepared);
+}
+
+void sme_msg_writer_add_prepared(SmeMsgWriter *writer, SmePreparedMsg *prepared)
+{
+	sme_msg_writer_add_prepared_prio
+		(writer, prepared, SME_MSG_WRITER_DEFAULT_PRIO);
+}
+
+void sme_msg_writer_add_prepared_prio
+	(SmeMsgWriter *writer, SmePreparedMsg *prepared, int prio)
+{
+	sme_msg_writer_add_prepared_deadline(writer, prepared, prio, 0);
+}
+
+void sme_msg_writer_add_msg_deadline
+	(SmeMsgWriter *writer, MmcMsg *msg, int prio, uint64_t deadline)
+{
+	SmePreparedMsg *prepared = sme_prepared_msg_new(msg);
+
+	sme_msg_writer_add_prepared_deadline(writer, prepared, prio, deadline);
+
+	sme_prepared_msg_unref(prepared);
+}
+
+//Finds position for a job of given priority: after jobs of same or 
+//higher priority, but never before a job that has been started.
+static int sme_msg_writer_find_pos(SmeMsgWriter *writer, int prio)
+{
+	WriterJob *jobs;
+	int pos;
+
+	pos = writer_job_queue_size(writer->job_queue);
+	if (sme_channel_can_insert_write_job(writer->channel))
+	{
+		jobs = writer_job_queue_head(writer->job_queue);
+		while (pos > writer->n_started && jobs[pos - 1].prio > prio)
+			pos--;
+	}
+
+	return pos;
+}
+
+void sme_msg_writer_add_prepared_deadline
+	(SmeMsgWriter *writer, SmePreparedMsg *prepared, int prio, 
+	 uint64_t deadline)
+{
+	int pos, queue_len;
+	size_t n_blocks = prepared->n_blocks;
+	WriterJob new_job, *jobs;
+
+	sme_assert(prio >= 0 && prio < SME_MSG_WRITER_N_PRIO,
+			"Invalid priority %d", prio);
+
+	queue_len = writer_job_queue_size(writer->job_queue);
+	pos = sme_msg_writer_find_pos(writer, prio);
+
+	//Chunks of a generated message are at the end of the queue and 
+	//cannot be split, it can only be overtaken before it has started
+	if (writer->gen 
+		&& (writer->gen->begun || pos > queue_len - writer->gen->n_jobs))
+	{
+		WriterDeferred one = {prepared, NULL, prio, deadline};
+		sme_prepared_msg_ref(prepared);
+		writer_deferred_queue_push(writer->deferred, one);
+		return;
+	}
+
+	//Create job
+	new_job.prepared = prepared;
+	sme_prepared_msg_ref(prepared);
+	new_job.size = prepared->size;
+	if (writer->crc)
+	{
+		sme_prepared_msg_compute_crc(prepared);
+		n_blocks++;
+		new_job.size += sizeof(uint32_t);
 	}
+	new_job.prio = prio;
+	new_job.t_send = writer->latency ? sme_latency_now() : 0;
+	new_job.t_first = 0;
+	new_job.deadline = NULL;
+	new_job.gen = NULL;
+	new_job.gen_buf = -1;
+	if (deadline && writer->wheel 
+		&& sme_channel_can_remove_write_job(writer->channel))
+	{
+		new_job.deadline = (WriterDeadline *) mdsl_alloc
+			(sizeof(WriterDeadline));
+		new_job.deadline->writer = writer;
+		new_job.deadline->expiry = deadline;
+		sme_timer_init(&(new_job.deadline->timer), 
+				sme_msg_writer_deadline_cb, new_job.deadline);
+		sme_timer_wheel_add
+			(writer->wheel, &(new_job.deadline->timer), deadline);
+	}
+
+	//Add to queue
+	writer_job_queue_alloc_n(writer->job_queue, 1);
+	jobs = writer_job_queue_head(writer->job_queue);
+	memmove(jobs + pos + 1, jobs + pos, sizeof(WriterJob) * (queue_len - pos));
+	jobs[pos] = new_job;
+	writer->prio_len[prio]++;
+	sme_probe4(writer_add_msg, writer, prepared->msg, n_blocks, 
+			new_job.size);
+
+	//Assign job to channel
+	if (pos == queue_len)
+		sme_channel_add_write_job
+			(writer->channel, prepared->iov, n_blocks);
+	else
+		sme_channel_insert_write_job
+			(writer->channel, pos, prepared->iov, n_blocks);
+}
+
+int sme_msg_writer_get_queue_len(SmeMsgWriter *writer)
+{
+	return writer_job_queue_size(writer->job_queue)
+		+ writer_deferred_queue_size(writer->deferred);
+}
+
+//Generated messages
+
+//Returns NULL if the layout is malformed
+static WriterGen *writer_gen_new
+	(const uint32_t *layout, size_t len, int prio, 
+	 SmeMsgProducer producer, size_t chunk_size, int crc)
+{
+	WriterGen *gen;
+	size_t n_blocks;
+	uint64_t body_size;
+	int i;
+
+	if (len == 0 || len > UINT32_MAX
+		|| sme_layout_get_body_size(layout, len, &n_blocks, &body_size) < 0)
+		return NULL;
+
+	gen = (WriterGen *) mdsl_alloc
+		(sizeof(WriterGen) + sizeof(uint32_t) * (len + 1));
+
+	gen->producer = producer;
+	gen->prio = prio;
+	gen->chunk_size = chunk_size;
+	gen->preamble = (uint32_t *) (gen + 1);
+	gen->n_blocks = n_blocks;
+	gen->block = 0;
+	gen->block_len = 0;
+	gen->offset = 0;
+	gen->crc = crc;
+	gen->trailer_queued = 0;
+	for (i = 0; i < SME_MSG_WRITER_GEN_N_BUFS; i++)
+		gen->bufs[i] = NULL;
+	gen->n_jobs = 0;
+	gen->begun = 0;
+
+	gen->preamble[0] = ssc_uint32_to_le((uint32_t) len);
+	memcpy(gen->preamble + 1, layout, len * sizeof(uint32_t));
+	gen->preamble_len = (len + 1) * sizeof(uint32_t);
+
+	//Length of the first block
+	sme_layout_iter_init(&(gen->iter), gen->preamble + 1, len);
+	if (n_blocks > 0)
+		sme_layout_iter_next(&(gen->iter), &(gen->block_len));
+
+	return gen;
+}
+
+static void writer_gen_free(WriterGen *gen)
+{
+	if (gen->bufs[0])
+		free(gen->bufs[0]);
+	if (gen->producer.done)
+		(* gen->producer.done)(gen->producer.data);
+	free(gen);
+}
+
+static void sme_msg_writer_gen_push
+	(SmeMsgWriter *writer, WriterGen *gen, int buf, void *mem, size_t len)
+{
+	SscMBlock block = {mem, len};
+	WriterJob job;
+
+	job.prepared = NULL;
+	job.size = len;
+	job.prio = gen->prio;
+	job.t_send = 0;
+	job.t_first = 0;
+	job.deadline = NULL;
+	job.gen = gen;
+	job.gen_buf = buf;
+
+	writer_job_queue_push(writer->job_queue, job);
+	gen->n_jobs++;
+	sme_channel_add_write_job(writer->channel, &block, 1);
 }
 
-//
-mdsl_rc_define(SmeMsgWriter, sme_msg_writer);
+//Produces next chunk into given buffer and queues it, or queues the 
+//trailer. Returns 0 if there is nothing more to queue.
+static int sme_msg_writer_gen_next
+	(SmeMsgWriter *writer, WriterGen *gen, int buf)
+{
+	void *mem = gen->bufs[buf];
+	size_t len;
+
+	while (gen->block < gen->n_blocks && gen->offset == gen->block_len)
+	{
+		gen->block++;
+		gen->offset = 0;
+		if (gen->block < gen->n_blocks)
+			sme_layout_iter_next(&(gen->iter), &(gen->block_len));
+	}
+
+	if (gen->block < gen->n_blocks)
+	{
+		len = gen->block_len - gen->offset;
+		if (len > gen->chunk_size)
+			len = gen->chunk_size;
+
+		(* gen->producer.produce)
+			(gen->block, gen->offset, mem, len, gen->producer.data);
+		if (gen->crc)
+			gen->crc_value = sme_crc32c_update(gen->crc_value, mem, len);
+		gen->offset += len;
+
+		sme_msg_writer_gen_push(writer, gen, buf, mem, len);
+		return 1;
+	}
+
+	if (gen->crc && ! gen->trailer_queued)
+	{
+		gen->crc_le = ssc_uint32_to_le(gen->crc_value);
+		gen->trailer_queued = 1;
+		sme_msg_writer_gen_push
+			(writer, gen, -1, &(gen->crc_le), sizeof(uint32_t));
+		return 1;
+	}
+
+	return 0;
+}
+
+//Takes jobs from given position onwards off the channel and holds them
+//back. None of them may have been started.
+static void sme_msg_writer_hold_back(SmeMsgWriter *writer, int pos)
+{
+	WriterJob *jobs;
+	int i, len;
+
+	jobs = writer_job_queue_head(writer->job_queue);
+	len = writer_job_queue_size(writer->job_queue);
+	for (i = len - 1; i >= pos; i--)
+		sme_channel_remove_write_job(writer->channel, i);
+
+	for (i = pos; i < len; i++)
+	{
+		WriterDeferred one = {jobs[i].prepared, NULL, jobs[i].prio, 0};
+
+		if (jobs[i].deadline)
+		{
+			one.deadline = jobs[i].deadline->expiry;
+			sme_timer_wheel_remove
+				(writer->wheel, &(jobs[i].deadline->timer));
+			free(jobs[i].deadline);
+		}
+		writer->prio_len[jobs[i].prio]--;
+		writer_deferred_queue_push(writer->deferred, one);
+	}
+
+	memmove(jobs + len - pos, jobs, sizeof(WriterJob) * pos);
+	writer_job_queue_pop_n(writer->job_queue, len - pos);
+}
+
+static void sme_msg_writer_gen_start(SmeMsgWriter *writer, WriterGen *gen)
+{
+	int i, pos;
+
+	//Placed by priority. Its chunks have to follow each other, so less 
+	//urgent messages it overtakes are held back until it is done.
+	pos = sme_msg_writer_find_pos(writer, gen->prio);
+	if (sme_channel_can_remove_write_job(writer->channel))
+		sme_msg_writer_hold_back(writer, pos);
+
+	writer->gen = gen;
+	writer->prio_len[gen->prio]++;
+
+	gen->bufs[0] = mdsl_alloc(gen->chunk_size * SME_MSG_WRITER_GEN_N_BUFS);
+	for (i = 1; i < SME_MSG_WRITER_GEN_N_BUFS; i++)
+		gen->bufs[i] = MDSL_PTR_ADD(gen->bufs[0], gen->chunk_size * i);
+
+	if (gen->crc)
+		gen->crc_value = sme_crc32c(gen->preamble, gen->preamble_len);
+	sme_msg_writer_gen_push
+		(writer, gen, -1, gen->preamble, gen->preamble_len);
+
+	for (i = 0; i < SME_MSG_WRITER_GEN_N_BUFS; i++)
+	{
+		if (! sme_msg_writer_gen_next(writer, gen, i))
+			break;
+	}
+}
+
+//Refills the buffer of a written chunk
+static void sme_msg_writer_gen_job_done(SmeMsgWriter *writer, WriterJob *job)
+{
+	WriterGen *gen = job->gen;
+
+	gen->n_jobs--;
+	gen->begun = 1;
+	if (job->gen_buf >= 0)
+		sme_msg_writer_gen_next(writer, gen, job->gen_buf);
+
+	if (gen->n_jobs == 0)
+	{
+		writer->prio_len[gen->prio]--;
+		writer->gen = NULL;
+		writer_gen_free(gen);
+	}
+}
+
+//Queues a generated message, or holds it back behind the current one
+static void sme_msg_writer_add_gen(SmeMsgWriter *writer, WriterGen *gen)
+{
+	if (writer->gen)
+	{
+		WriterDeferred one = {NULL, gen, gen->prio, 0};
+		writer_deferred_queue_push(writer->deferred, one);
+		return;
+	}
+
+	sme_msg_writer_gen_start(writer, gen);
+}
 
-static void sme_msg_writer_destroy(SmeMsgWriter *writer)
+//Every held back message is added again once, in order. Those more 
+//urgent than a generated message that starts meanwhile go ahead of it,
+//others are held back again.
+static void sme_msg_writer_flush_deferred(SmeMsgWriter *writer)
 {
-	int i, len;
-	WriterJob *jobs;
-
-	//Unref channel
-	sme_channel_unset_write_source(writer->channel);	
-	sme_channel_unref(writer->channel);
-	writer->channel = NULL;
+	size_t n = writer_deferred_queue_size(writer->deferred);
 
-	//Destroy job queue
-	len = writer_job_queue_size(writer->job_queue);
-	jobs = writer_job_queue_head(writer->job_queue);
-	for (i = 0; i < len; i++)
+	while (n--)
 	{
-		mmc_msg_unref(jobs[i].msg);
-		free(jobs[i].preamble);
-	}
-	writer_job_queue_destroy(writer->job_queue);
+		WriterDeferred one = writer_deferred_queue_pop(writer->deferred);
 
-	free(writer);
+		if (one.gen)
+		{
+			sme_msg_writer_add_gen(writer, one.gen);
+		}
+		else
+		{
+			sme_msg_writer_add_prepared_deadline
+				(writer, one.prepared, one.prio, one.deadline);
+			sme_prepared_msg_unref(one.prepared);
+		}
+	}
 }
 
-SmeMsgWriter *sme_msg_writer_new(SmeChannel *channel)
+int sme_msg_writer_add_generated
+	(SmeMsgWriter *writer, const uint32_t *layout, size_t layout_size, 
+	 int prio, SmeMsgProducer producer, size_t chunk_size)
 {
-	SmeMsgWriter *writer;
-	SmeJobSource js;
+	WriterGen *gen;
 
-	writer = (SmeMsgWriter *) mdsl_alloc(sizeof(SmeMsgWriter));
+	sme_assert(prio >= 0 && prio < SME_MSG_WRITER_N_PRIO,
+			"Invalid priority %d", prio);
+	sme_assert(chunk_size > 0, "Chunk size must be positive");
 
-	mdsl_rc_init(writer);
-	
-	writer_job_queue_init(writer->job_queue); 
+	gen = writer_gen_new
+		(layout, layout_size, prio, producer, chunk_size, writer->crc);
+	if (! gen)
+		return -1;
 
-	sme_channel_ref(channel);
-	writer->channel = channel;
-	js.source_ptr = writer;
-	js.notify = sme_msg_writer_notify_fn;
-	sme_channel_set_write_source(channel, js);	
+	sme_msg_writer_add_gen(writer, gen);
 
-	return writer;
+	return 0;
 }
 
-void sme_msg_writer_add_msg(SmeMsgWriter *writer, MmcMsg *msg)
+int sme_msg_writer_get_prio_queue_len(SmeMsgWriter *writer, int prio)
 {
-	size_t len = ssc_msg_count(msg);
-	size_t n_blocks;
+	sme_assert(prio >= 0 && prio < SME_MSG_WRITER_N_PRIO,
+			"Invalid priority %d", prio);
 
-	WriterJob new_job;
-	SscMBlock *iov;
+	return writer->prio_len[prio];
+}
 
-	//Create job
-	new_job.msg = msg;
-	mmc_msg_ref(msg);
-	iov = (SscMBlock *) mdsl_alloc(sizeof(SscMBlock) * (len + 1));
+void sme_msg_writer_set_latency(SmeMsgWriter *writer, SmeLatency *latency)
+{
+	writer->latency = latency;
+}
 
-	//Add preamble (size + layout)
-	new_job.preamble = (uint32_t *) mdsl_alloc
-		((len + 1) * sizeof(uint32_t));
-	new_job.preamble[0] = ssc_uint32_to_le((uint32_t) len);
-	ssc_msg_create_layout(msg, len, new_job.preamble + 1);	
-	iov[0].mem = new_job.preamble;
-	iov[0].len = (len + 1) * sizeof(uint32_t);
+void sme_msg_writer_set_crc(SmeMsgWriter *writer, int enabled)
+{
+	writer->crc = enabled ? 1 : 0;
+}
 
-	//Add data
-	n_blocks = ssc_msg_get_blocks(msg, len, iov + 1);
+void sme_msg_writer_set_timer_wheel(SmeMsgWriter *writer, SmeTimerWheel *wheel)
+{
+	int i, len;
+	WriterJob *jobs;
 
-	//Add to queue
-	writer_job_queue_push(writer->job_queue, new_job);
+	if (wheel)
+		sme_timer_wheel_ref(wheel);
 
-	//Assign job to channel
-	sme_channel_add_write_job(writer->channel, iov, n_blocks + 1);
+	//Existing deadlines are dropped
+	len = writer_job_queue_size(writer->job_queue);
+	jobs = writer_job_queue_head(writer->job_queue);
+	for (i = 0; i < len; i++)
+	{
+		if (jobs[i].deadline)
+		{
+			sme_timer_wheel_remove(writer->wheel, &(jobs[i].deadline->timer));
+			free(jobs[i].deadline);
+			jobs[i].deadline = NULL;
+		}
+	}
 
-	//Free
-	free(iov);
+	if (writer->wheel)
+		sme_timer_wheel_unref(writer->wheel);
+	writer->wheel = wheel;
 }
 
-int sme_msg_writer_get_queue_len(SmeMsgWriter *writer)
+uint64_t sme_msg_writer_get_n_expired(SmeMsgWriter *writer)
 {
-	return writer_job_queue_size(writer->job_queue);
+	return writer->n_expired;
 }
 
 //Message reader
@@ -146,6 +1103,10 @@ typedef enum
 	READER_READ_SIZE,
 	READER_READ_LAYOUT,
 	READER_READ_MSG,
+	READER_READ_STREAM,
+	READER_READ_TRAILER,
+	READER_READ_VIEW_LAYOUT,
+	READER_READ_VIEW,
 	READER_DISPOSED,
 	READER_ERROR
 } ReaderState;
@@ -167,6 +1128,45 @@ struct _SmeMsgReader
 	void *layout;
 	uint32_t layout_size;
 	MmcMsg *msg;
+
+	SmeLatency *latency;
+	uint64_t t_header;
+
+	//Kernel receive timestamps of the header being read and of the
+	//message being delivered
+	uint64_t rx_header;
+	uint64_t rx_timestamp;
+
+	//CRC trailer checking
+	int crc;
+	uint32_t crc_value;
+	uint32_t crc_le;
+	SscMBlock *iov;
+	size_t n_blocks;
+
+	//Streaming, block lengths are taken from the layout as blocks begin
+	SmeMsgReaderStream stream;
+	void *stream_buf;
+	size_t chunk_size;
+	uint32_t *stream_layout;
+	SmeLayoutIter stream_iter;
+	size_t stream_block;
+	size_t stream_block_len;
+	size_t stream_offset;
+	size_t stream_chunk_len;
+
+	//Borrowed views, view_buf holds layout followed by blocks
+	SmeMsgReaderView view;
+	void *view_buf;
+	size_t view_buf_size;
+	int view_ready;
+
+	//Blocks pointing into view_buf for the last layout seen
+	uint32_t *view_layout;
+	uint32_t view_layout_size;
+	SscMBlock *view_blocks;
+	size_t view_n_blocks;
+	size_t view_body_len;
 };
 
 //
@@ -177,8 +1177,225 @@ static void sme_msg_reader_goto_read_size(SmeMsgReader *reader)
 	sme_channel_add_read_job(reader->channel, &iov, 1);
 }
 
+//Streaming
+
+//Takes over the layout, which is walked again as blocks begin. 
+//Nothing is allocated for message data.
+static int sme_msg_reader_stream_begin
+	(SmeMsgReader *reader, uint32_t *layout, uint32_t size)
+{
+	uint64_t body_size;
+
+	if (sme_layout_get_body_size
+			(layout, size, &(reader->n_blocks), &body_size) < 0)
+	{
+		free(layout);
+		return -1;
+	}
+
+	reader->stream_layout = layout;
+	sme_layout_iter_init(&(reader->stream_iter), layout, size);
+	reader->stream_block = 0;
+	reader->stream_offset = 0;
+	reader->stream_chunk_len = 0;
+	reader->rx_timestamp = reader->rx_header;
+
+	if (reader->stream.msg_begin)
+		(* reader->stream.msg_begin)(reader->n_blocks, reader->stream.data);
+
+	return 0;
+}
+
+static void sme_msg_reader_stream_end(SmeMsgReader *reader)
+{
+	free(reader->stream_layout);
+	reader->stream_layout = NULL;
+
+	if (reader->stream.msg_end)
+		(* reader->stream.msg_end)(reader->stream.data);
+
+	sme_msg_reader_goto_read_size(reader);
+}
+
+//Reports block boundaries and queues the next chunk, 
+//trailer, or the next message
+static void sme_msg_reader_stream_next(SmeMsgReader *reader)
+{
+	SscMBlock iov;
+	size_t len = 0;
+
+	while (reader->stream_block < reader->n_blocks)
+	{
+		if (reader->stream_offset == 0 && reader->stream_chunk_len == 0)
+		{
+			//Layout has been checked, it has this many blocks
+			sme_layout_iter_next
+				(&(reader->stream_iter), &(reader->stream_block_len));
+			(* reader->stream.block_begin)(reader->stream_block, 
+					reader->stream_block_len, reader->stream.data);
+		}
+		len = reader->stream_block_len;
+		if (reader->stream_offset < len)
+			break;
+
+		(* reader->stream.block_end)(reader->stream_block, reader->stream.data);
+		reader->stream_block++;
+		reader->stream_offset = 0;
+		reader->stream_chunk_len = 0;
+	}
+
+	if (reader->stream_block < reader->n_blocks)
+	{
+		iov.mem = reader->stream_buf;
+		iov.len = len - reader->stream_offset;
+		if (iov.len > reader->chunk_size)
+			iov.len = reader->chunk_size;
+		reader->stream_chunk_len = iov.len;
+		reader->state = READER_READ_STREAM;
+		sme_channel_add_read_job(reader->channel, &iov, 1);
+	}
+	else if (reader->crc)
+	{
+		iov.mem = &(reader->crc_le);
+		iov.len = sizeof(uint32_t);
+		reader->state = READER_READ_TRAILER;
+		sme_channel_add_read_job(reader->channel, &iov, 1);
+	}
+	else
+	{
+		sme_msg_reader_stream_end(reader);
+	}
+}
+
+//Checksum covers preamble as it was on the stream
+static void sme_msg_reader_crc_preamble
+	(SmeMsgReader *reader, uint32_t *layout, uint32_t size)
+{
+	reader->crc_value = sme_crc32c(&(reader->d), sizeof(uint32_t));
+	reader->crc_value = sme_crc32c_update
+		(reader->crc_value, layout, size * sizeof(uint32_t));
+}
+
+//Allocates the message and queues reading of its blocks
+static int sme_msg_reader_begin_msg
+	(SmeMsgReader *reader, uint32_t *layout, uint32_t size)
+{
+	uint32_t n_blocks;
+	MmcMsg *msg;
+	SscMBlock *iov;
+
+	//Allocate  vector, with room for CRC trailer
+	iov = (SscMBlock *) mdsl_tryalloc(sizeof(SscMBlock) * (size + 1));
+	if (! iov)
+		return -1;
+
+	//Allocate message
+	msg = ssc_msg_alloc_by_layout(size, layout);
+	if (! msg)
+	{
+		free(iov);
+		return -1;
+	}
+
+	//Fill data into vector
+	n_blocks = ssc_msg_get_blocks(msg, size, iov);
+
+	if (reader->crc)
+	{
+		//Blocks are checksummed when the message is complete
+		iov[n_blocks].mem = &(reader->crc_le);
+		iov[n_blocks].len = sizeof(uint32_t);
+
+		reader->msg = msg;
+		reader->iov = iov;
+		reader->n_blocks = n_blocks;
+		reader->state = READER_READ_MSG;
+
+		sme_channel_add_read_job(reader->channel, iov, n_blocks + 1);
+	}
+	else if (n_blocks == 0)
+	{
+		//Add finished message to queue and return 
+		sme_assert(! reader->msg_buf, "Message buffer overflow");
+		reader->msg_buf = msg;
+		sme_msg_reader_goto_read_size(reader);
+	}
+	else
+	{
+		//State change
+		reader->msg = msg;
+		reader->state = READER_READ_MSG;
+		
+		//Add job
+		sme_channel_add_read_job(reader->channel, iov, n_blocks);
+	}
+
+	//Cleanup
+	if (! reader->crc)
+		free(iov);
+
+	return 0;
+}
+
+//Borrowed views
+
+//Finds blocks for the layout, those of the last layout are reused if 
+//it is the same. Returns 1 if the message does not fit in the buffer,
+//-1 if the layout is malformed.
+static int sme_msg_reader_view_lookup
+	(SmeMsgReader *reader, uint32_t *layout, uint32_t size)
+{
+	size_t layout_len = size * sizeof(uint32_t);
+	SmeLayoutIter iter;
+	size_t n_blocks, i, offset;
+	uint64_t body_size;
+
+	if (reader->view_layout && reader->view_layout_size == size
+		&& memcmp(reader->view_layout, layout, layout_len) == 0)
+		return 0;
+
+	if (sme_layout_get_body_size(layout, size, &n_blocks, &body_size) < 0)
+		return -1;
+	if (body_size > reader->view_buf_size - layout_len)
+		return 1;
+
+	//One more block for the CRC trailer
+	free(reader->view_layout);
+	free(reader->view_blocks);
+	reader->view_layout = (uint32_t *) mdsl_tryalloc(layout_len);
+	reader->view_blocks = (SscMBlock *) mdsl_tryalloc
+		(sizeof(SscMBlock) * (n_blocks + 1));
+	if (! reader->view_layout || ! reader->view_blocks)
+	{
+		free(reader->view_layout);
+		free(reader->view_blocks);
+		reader->view_layout = NULL;
+		reader->view_blocks = NULL;
+		return -1;
+	}
+
+	//Blocks follow the layout in the buffer
+	sme_layout_iter_init(&iter, layout, size);
+	offset = layout_len;
+	for (i = 0; i < n_blocks; i++)
+	{
+		sme_layout_iter_next(&iter, &(reader->view_blocks[i].len));
+		reader->view_blocks[i].mem = MDSL_PTR_ADD(reader->view_buf, offset);
+		offset += reader->view_blocks[i].len;
+	}
+	reader->view_n_blocks = n_blocks;
+	reader->view_body_len = body_size;
+
+	memcpy(reader->view_layout, layout, layout_len);
+	reader->view_layout_size = size;
+
+	return 0;
+}
+
 static void sme_msg_reader_advance(SmeMsgReader *reader)
 {
+	ReaderState old_state = reader->state;
+
 	if (reader->state == READER_READ_SIZE)
 	{
 		uint32_t size;
@@ -186,11 +1403,27 @@ static void sme_msg_reader_advance(SmeMsgReader *reader)
 
 		//Fetch data
 		size = ssc_uint32_from_le(reader->d);
+		if (reader->latency)
+			reader->t_header = sme_latency_now();
+		if (sme_channel_can_get_rx_timestamp(reader->channel))
+			reader->rx_header = sme_channel_get_rx_timestamp(reader->channel);
 
 		//Checks
 		if (size == 0)
 			goto fail;
 
+		//Layout is read into the view buffer if it fits
+		if (reader->view_buf 
+			&& size <= reader->view_buf_size / sizeof(uint32_t))
+		{
+			iov.mem = reader->view_buf;
+			iov.len = size * sizeof(uint32_t);
+			reader->layout_size = size;
+			reader->state = READER_READ_VIEW_LAYOUT;
+			sme_channel_add_read_job(reader->channel, &iov, 1);
+			goto end;
+		}
+
 		//Allocate memory for layout
 		iov.len = size * sizeof(uint32_t);
 		iov.mem = mdsl_tryalloc(iov.len);
@@ -209,55 +1442,89 @@ static void sme_msg_reader_advance(SmeMsgReader *reader)
 	{
 		uint32_t *layout;
 		uint32_t size;
-		uint32_t n_blocks;
-		MmcMsg *msg;
-		SscMBlock *iov;
+		int res;
 
 		//Fetch data
 		layout = (uint32_t *) reader->layout;
 		size = reader->layout_size;
 		reader->layout = NULL;
 
+		if (reader->crc)
+			sme_msg_reader_crc_preamble(reader, layout, size);
 
-		//Allocate  vector
-		iov = (SscMBlock *) mdsl_tryalloc(sizeof(SscMBlock) * size);
-		if (! iov)
+		//Blocks are delivered in chunks as they arrive
+		if (reader->stream_buf)
 		{
-			free(layout);
-			goto fail;
+			res = sme_msg_reader_stream_begin(reader, layout, size);
+			if (res < 0)
+				goto fail;
+			sme_msg_reader_stream_next(reader);
+			goto end;
 		}
 
-		//Allocate message
-		msg = ssc_msg_alloc_by_layout(size, layout);
+		res = sme_msg_reader_begin_msg(reader, layout, size);
 		free(layout); //< Not needed anymore
-		if (! msg)
-		{
-			free(iov);
+		if (res < 0)
+			goto fail;
+	}
+	else if (reader->state == READER_READ_VIEW_LAYOUT)
+	{
+		uint32_t *layout = (uint32_t *) reader->view_buf;
+		uint32_t size = reader->layout_size;
+		size_t n_iov;
+		int res;
+
+		if (reader->crc)
+			sme_msg_reader_crc_preamble(reader, layout, size);
+
+		res = sme_msg_reader_view_lookup(reader, layout, size);
+		if (res < 0)
 			goto fail;
+
+		//Too large for the buffer, allocate as usual
+		if (res > 0)
+		{
+			if (sme_msg_reader_begin_msg(reader, layout, size) < 0)
+				goto fail;
+			goto end;
 		}
 
-		//Fill data into vector
-		n_blocks = ssc_msg_get_blocks(msg, size, iov);
-		
-		if (n_blocks == 0)
+		//Blocks are read as they would be into a message, so that 
+		//channels see the same blocks, followed by CRC trailer
+		n_iov = reader->view_n_blocks;
+		if (reader->crc)
 		{
-			//Add finished message to queue and return 
-			sme_assert(! reader->msg_buf, "Message buffer overflow");
-			reader->msg_buf = msg;
-			sme_msg_reader_goto_read_size(reader);
+			reader->view_blocks[n_iov].mem = &(reader->crc_le);
+			reader->view_blocks[n_iov].len = sizeof(uint32_t);
+			n_iov++;
+		}
+
+		if (n_iov > 0)
+		{
+			reader->state = READER_READ_VIEW;
+			sme_channel_add_read_job
+				(reader->channel, reader->view_blocks, n_iov);
 		}
 		else
 		{
-			//State change
-			reader->msg = msg;
-			reader->state = READER_READ_MSG;
-			
-			//Add job
-			sme_channel_add_read_job(reader->channel, iov, n_blocks);
+			reader->view_ready = 1;
+			sme_msg_reader_goto_read_size(reader);
+		}
+	}
+	else if (reader->state == READER_READ_VIEW)
+	{
+		if (reader->crc)
+		{
+			uint32_t crc = sme_crc32c_update(reader->crc_value, 
+					MDSL_PTR_ADD(reader->view_buf, 
+						reader->view_layout_size * sizeof(uint32_t)),
+					reader->view_body_len);
+			if (crc != ssc_uint32_from_le(reader->crc_le))
+				goto fail;
 		}
 
-		//Cleanup
-		free(iov);
+		reader->view_ready = 1;
+		sme_msg_reader_goto_read_size(reader);
 	}
 	else if (reader->state == READER_READ_MSG)
 	{
@@ -267,15 +1534,82 @@ static void sme_msg_reader_advance(SmeMsgReader *reader)
 		msg = reader->msg;
 		reader->msg = NULL;
 
+		//Verify CRC trailer
+		if (reader->iov)
+		{
+			uint32_t crc = reader->crc_value;
+			size_t i;
+
+			for (i = 0; i < reader->n_blocks; i++)
+				crc = sme_crc32c_update
+					(crc, reader->iov[i].mem, reader->iov[i].len);
+			free(reader->iov);
+			reader->iov = NULL;
+
+			if (crc != ssc_uint32_from_le(reader->crc_le))
+			{
+				mmc_msg_unref(msg);
+				goto fail;
+			}
+		}
+
 		//Add finished message to queue and return 
 		sme_assert(! reader->msg_buf, "Message buffer overflow");
 		reader->msg_buf = msg;
 		sme_msg_reader_goto_read_size(reader);
 	}
+	else if (reader->state == READER_READ_STREAM)
+	{
+		size_t len = reader->stream_chunk_len;
+
+		if (reader->crc)
+			reader->crc_value = sme_crc32c_update
+				(reader->crc_value, reader->stream_buf, len);
+		(* reader->stream.chunk)(reader->stream_buf, len, reader->stream.data);
+		reader->stream_offset += len;
+
+		sme_msg_reader_stream_next(reader);
+	}
+	else if (reader->state == READER_READ_TRAILER)
+	{
+		if (reader->crc_value != ssc_uint32_from_le(reader->crc_le))
+		{
+			free(reader->stream_layout);
+			reader->stream_layout = NULL;
+			goto fail;
+		}
+
+		sme_msg_reader_stream_end(reader);
+	}
 
+end:
+	sme_probe3(reader_state, reader, old_state, reader->state);
 	return;
 fail:
 	reader->state = READER_ERROR;
+	sme_probe3(reader_state, reader, old_state, reader->state);
+}
+
+//Called just before a message is delivered
+static void sme_msg_reader_deliver_begin(SmeMsgReader *reader)
+{
+	reader->rx_timestamp = reader->rx_header;
+
+	if (! reader->latency)
+		return;
+
+	if (reader->t_header)
+		sme_histogram_record(&(reader->latency->receive),
+				sme_latency_now() - reader->t_header);
+
+	//Clocks of different hosts may be apart
+	if (reader->rx_timestamp)
+	{
+		uint64_t now = sme_latency_now_realtime();
+		if (now >= reader->rx_timestamp)
+			sme_histogram_record(&(reader->latency->wire),
+					now - reader->rx_timestamp);
+	}
 }
 
 static void sme_msg_reader_notify_fn(void *source_ptr, int n_jobs)
@@ -291,8 +1625,32 @@ static void sme_msg_reader_notify_fn(void *source_ptr, int n_jobs)
 		MmcMsg *msg_tmp = reader->msg_buf;
 		reader->msg_buf = NULL;
 
+		sme_msg_reader_deliver_begin(reader);
+
+		sme_probe2(reader_deliver, reader, msg_tmp);
+
 		(* reader->notify.call)(msg_tmp, reader->notify.data);
 	}
+	else if (reader->view_ready)
+	{
+		SmeMsgView view;
+
+		reader->view_ready = 0;
+
+		sme_msg_reader_deliver_begin(reader);
+
+		view.layout = reader->view_layout;
+		view.layout_size = reader->view_layout_size;
+		view.blocks = reader->view_blocks;
+		view.n_blocks = reader->view_n_blocks;
+
+		sme_probe2(reader_deliver, reader, NULL);
+
+		//Buffer must outlive the call
+		sme_msg_reader_ref(reader);
+		(* reader->view.call)(&view, reader->view.data);
+		sme_msg_reader_unref(reader);
+	}
 }
 
 //
@@ -314,6 +1672,15 @@ static void sme_msg_reader_destroy(SmeMsgReader *reader)
 		free(reader->layout);
 	if (reader->msg)
 		mmc_msg_unref(reader->msg);
+	if (reader->iov)
+		free(reader->iov);
+	if (reader->stream_buf)
+		free(reader->stream_buf);
+	free(reader->stream_layout);
+	if (reader->view_buf)
+		free(reader->view_buf);
+	free(reader->view_layout);
+	free(reader->view_blocks);
 
 	free(reader);
 }
@@ -332,15 +1699,168 @@ SmeMsgReader *sme_msg_reader_new
 	reader->layout = NULL;
 	reader->msg = NULL;
 	reader->notify = notify;
+	reader->latency = NULL;
+	reader->t_header = 0;
+	reader->rx_header = 0;
+	reader->rx_timestamp = 0;
+	reader->crc = 0;
+	reader->iov = NULL;
+	reader->stream_buf = NULL;
+	reader->chunk_size = 0;
+	reader->stream_layout = NULL;
+	reader->view_buf = NULL;
+	reader->view_buf_size = 0;
+	reader->view_ready = 0;
+	reader->view_layout = NULL;
+	reader->view_layout_size = 0;
+	reader->view_blocks = NULL;
+	reader->view_n_blocks = 0;
+	reader->view_body_len = 0;
 
 	sme_channel_ref(channel);
 	reader->channel = channel;
 
 	js.source_ptr = reader;
 	js.notify = sme_msg_reader_notify_fn;
+	js.progress = NULL;
 	sme_channel_set_read_source(reader->channel, js);	
 
 	sme_msg_reader_goto_read_size(reader);
 
 	return reader;
 }
+
+void sme_msg_reader_set_latency(SmeMsgReader *reader, SmeLatency *latency)
+{
+	reader->latency = latency;
+	reader->t_header = 0;
+}
+
+void sme_msg_reader_set_crc(SmeMsgReader *reader, int enabled)
+{
+	reader->crc = enabled ? 1 : 0;
+}
+
+void sme_msg_reader_set_stream
+	(SmeMsgReader *reader, SmeMsgReaderStream stream, size_t chunk_size)
+{
+	sme_assert(chunk_size > 0, "Chunk size must be positive");
+	sme_assert(! reader->stream_buf, "Stream is already set");
+	sme_assert(! reader->view_buf, "Cannot stream with views set");
+
+	reader->stream = stream;
+	reader->chunk_size = chunk_size;
+	reader->stream_buf = mdsl_alloc(chunk_size);
+}
+
+void sme_msg_reader_set_view
+	(SmeMsgReader *reader, SmeMsgReaderView view, size_t buf_size)
+{
+	sme_assert(buf_size >= sizeof(uint32_t), "View buffer is too small");
+	sme_assert(! reader->view_buf, "View is already set");
+	sme_assert(! reader->stream_buf, "Cannot use views with stream set");
+
+	reader->view = view;
+	reader->view_buf_size = buf_size;
+	reader->view_buf = mdsl_alloc(buf_size);
+}
+
+MmcMsg *sme_msg_view_copy(SmeMsgView *view)
+{
+	SscMBlock *iov;
+	MmcMsg *msg;
+	size_t i;
+
+	iov = (SscMBlock *) mdsl_tryalloc(sizeof(SscMBlock) * view->layout_size);
+	if (! iov)
+		return NULL;
+
+	msg = ssc_msg_alloc_by_layout
+		(view->layout_size, (uint32_t *) view->layout);
+	if (! msg)
+	{
+		free(iov);
+		return NULL;
+	}
+
+	//Same layout gives the same blocks
+	ssc_msg_get_blocks(msg, view->layout_size, iov);
+	for (i = 0; i < view->n_blocks; i++)
+		memcpy(iov[i].mem, view->blocks[i].mem, view->blocks[i].len);
+	free(iov);
+
+	return msg;
+}
+
+uint64_t sme_msg_reader_get_rx_timestamp(SmeMsgReader *reader)
+{
+	return reader->rx_timestamp;
+}
+
+int sme_msg_reader_is_failed(SmeMsgReader *reader)
+{
+	return reader->state == READER_ERROR;
+}
+
+//Parsing from memory
+
+MmcMsg *sme_msg_parse(const void *data, size_t len)
+{
+	uint32_t size;
+	const uint32_t *layout;
+	uint32_t *layout_copy = NULL;
+	size_t n_blocks, i, offset;
+	uint64_t body_size;
+	SscMBlock *iov;
+	MmcMsg *msg;
+
+	//Data may be unaligned, e.g. a payload within a larger buffer
+	if (len < sizeof(uint32_t))
+		return NULL;
+	memcpy(&size, data, sizeof(uint32_t));
+	size = ssc_uint32_from_le(size);
+	if (size == 0 || (len / sizeof(uint32_t)) - 1 < size)
+		return NULL;
+	layout = (const uint32_t *) ((const char *) data + sizeof(uint32_t));
+	offset = (size + 1) * sizeof(uint32_t);
+
+	//Block lengths must add up to the data before anything is allocated
+	if (sme_layout_get_body_size(layout, size, &n_blocks, &body_size) < 0
+		|| body_size != len - offset)
+		return NULL;
+
+	if (((uintptr_t) layout) % sizeof(uint32_t) != 0)
+	{
+		layout_copy = (uint32_t *) mdsl_tryalloc(size * sizeof(uint32_t));
+		if (! layout_copy)
+			return NULL;
+		memcpy(layout_copy, layout, size * sizeof(uint32_t));
+		layout = layout_copy;
+	}
+
+	iov = (SscMBlock *) mdsl_tryalloc(sizeof(SscMBlock) * size);
+	if (! iov)
+	{
+		free(layout_copy);
+		return NULL;
+	}
+
+	msg = ssc_msg_alloc_by_layout(size, (uint32_t *) layout);
+	free(layout_copy);
+	if (! msg)
+	{
+		free(iov);
+		return NULL;
+	}
+
+	//Copy data into blocks
+	ssc_msg_get_blocks(msg, size, iov);
+	for (i = 0; i < n_blocks; i++)
+	{
+		memcpy(iov[i].mem, (const char *) data + offset, iov[i].len);
+		offset += iov[i].len;
+	}
+	free(iov);
+
+	return msg;
+}
@@ -21,6 +21,59 @@
 
 //Uses protocol as described in ssc/msg.h
 
+//Walks a layout as sent before every message, little endian and 
+//possibly unaligned, without building the message. Blocks are visited 
+//in the order they are sent, empty blocks are skipped.
+typedef struct
+{
+	const uint32_t *layout;
+	size_t size, pos;
+	uint64_t pending;
+} SmeLayoutIter;
+
+void sme_layout_iter_init
+	(SmeLayoutIter *iter, const uint32_t *layout, size_t size);
+
+//Returns 1 and stores length of the next block, 0 after the last one, 
+//-1 if the layout is malformed.
+int sme_layout_iter_next(SmeLayoutIter *iter, size_t *len);
+
+//Number of non-empty blocks and their total length.
+//Returns -1 if the layout is malformed.
+int sme_layout_get_body_size(const uint32_t *layout, size_t size, 
+		size_t *n_blocks, uint64_t *body_size);
+
+//Prepared message: a message with its preamble and block list computed
+//once, so that it can be queued on any number of writers. 
+//The message must not be modified while it is prepared.
+typedef struct _SmePreparedMsg SmePreparedMsg;
+
+mdsl_rc_declare(SmePreparedMsg, sme_prepared_msg);
+
+SmePreparedMsg *sme_prepared_msg_new(MmcMsg *msg);
+
+//Blocks smaller than the threshold are copied right after the preamble,
+//so that a message made of small blocks takes a single iovec. 
+//Copies take at most SME_MSG_INLINE_MAX bytes per message, 
+//larger blocks are referenced. sme_prepared_msg_new() and 
+//sme_msg_writer_add_msg*() use SME_MSG_INLINE_THRESHOLD. 
+//Threshold of 0 disables copying. Bytes on the stream are the same.
+#define SME_MSG_INLINE_THRESHOLD 256
+#define SME_MSG_INLINE_MAX 4096
+
+SmePreparedMsg *sme_prepared_msg_new_inline
+	(MmcMsg *msg, size_t inline_threshold);
+
+MmcMsg *sme_prepared_msg_get_msg(SmePreparedMsg *prepared);
+
+//Number of bytes on the stream
+size_t sme_prepared_msg_get_size(SmePreparedMsg *prepared);
+
+//Blocks to write, preamble first, followed by CRC trailer if crc is 
+//nonzero. Valid while the prepared message is referenced.
+const SscMBlock *sme_prepared_msg_get_iov
+	(SmePreparedMsg *prepared, int crc, size_t *n_iov);
+
 //Message writer
 typedef struct _SmeMsgWriter SmeMsgWriter;
 
@@ -32,6 +85,74 @@ void sme_msg_writer_add_msg(SmeMsgWriter *writer, MmcMsg *msg);
 
 int sme_msg_writer_get_queue_len(SmeMsgWriter *writer);
 
+//Priority classes, 0 is the most urgent.
+//A message is placed after queued messages of the same or more urgent 
+//classes, but never ahead of a message that has started being written.
+//Reordering needs channel support, otherwise messages are sent in order.
+#define SME_MSG_WRITER_N_PRIO 4
+#define SME_MSG_WRITER_DEFAULT_PRIO 2
+
+void sme_msg_writer_add_msg_prio(SmeMsgWriter *writer, MmcMsg *msg, int prio);
+
+int sme_msg_writer_get_prio_queue_len(SmeMsgWriter *writer, int prio);
+
+//Fan-out: queues a prepared message without encoding it again
+void sme_msg_writer_add_prepared(SmeMsgWriter *writer, SmePreparedMsg *prepared);
+
+void sme_msg_writer_add_prepared_prio
+	(SmeMsgWriter *writer, SmePreparedMsg *prepared, int prio);
+
+//Latency is recorded into given histograms when non-NULL
+void sme_msg_writer_set_latency(SmeMsgWriter *writer, SmeLatency *latency);
+
+//CRC32C trailer: when enabled, every message is followed by CRC32C of 
+//its size, layout and blocks as a little endian 32-bit integer. 
+//Applies to messages added afterwards; the reader must agree.
+void sme_msg_writer_set_crc(SmeMsgWriter *writer, int enabled);
+
+//Deadlines: a message that has not started being written by its 
+//deadline (nanoseconds, sme_latency_now() clock) is removed from the 
+//queue and dropped. Needs a timer wheel and channel support for removing
+//jobs, otherwise deadlines are ignored. Deadline of 0 means none.
+void sme_msg_writer_set_timer_wheel(SmeMsgWriter *writer, SmeTimerWheel *wheel);
+
+void sme_msg_writer_add_msg_deadline
+	(SmeMsgWriter *writer, MmcMsg *msg, int prio, uint64_t deadline);
+
+void sme_msg_writer_add_prepared_deadline
+	(SmeMsgWriter *writer, SmePreparedMsg *prepared, int prio, 
+	 uint64_t deadline);
+
+uint64_t sme_msg_writer_get_n_expired(SmeMsgWriter *writer);
+
+//Generated messages: only the layout is given, as in SmeMsgView: for 
+//every message in preorder its block length and number of submessages,
+//little endian. Blocks are numbered in order, skipping empty ones.
+//Block contents are produced into SME_MSG_WRITER_GEN_N_BUFS buffers of 
+//chunk_size bytes owned by the writer; produce() fills the next chunk 
+//when a buffer has been written out, and must fill len bytes of block
+//at given offset. Chunks do not cross blocks. done() is optional and is
+//called once the message is written or the writer is destroyed.
+//A generated message is queued by priority like others. As its chunks
+//have to follow each other on the stream, less urgent messages queued 
+//behind it are held back, and so are messages added once it has started
+//being written; they are queued by priority once it is done. Only one 
+//generated message is written at a time. Returns -1 if the layout is 
+//malformed.
+#define SME_MSG_WRITER_GEN_N_BUFS 2
+
+typedef struct
+{
+	void (*produce)
+		(size_t block, size_t offset, void *buf, size_t len, void *data);
+	void (*done)(void *data);
+	void *data;
+} SmeMsgProducer;
+
+int sme_msg_writer_add_generated
+	(SmeMsgWriter *writer, const uint32_t *layout, size_t layout_size, 
+	 int prio, SmeMsgProducer producer, size_t chunk_size);
+
 
 //Message reader
 typedef struct _SmeMsgReader SmeMsgReader;
@@ -46,3 +167,76 @@ mdsl_rc_declare(SmeMsgReader, sme_msg_reader);
 
 SmeMsgReader *sme_msg_reader_new
 	(SmeChannel *channel, SmeMsgReaderNotify notify);
+
+void sme_msg_reader_set_latency(SmeMsgReader *reader, SmeLatency *latency);
+
+//Expect CRC32C trailer as written by sme_msg_writer_set_crc().
+//Reader fails on mismatch.
+void sme_msg_reader_set_crc(SmeMsgReader *reader, int enabled);
+
+//Streaming: instead of allocating whole messages, blocks are passed to
+//callbacks in chunks of at most chunk_size bytes as they arrive, read 
+//into a buffer owned by the reader that is reused for every chunk.
+//Only the layout is kept in memory, so messages may be larger than 
+//what the process can allocate.
+//block_begin() and block_end() are called for every block in order, 
+//with chunk() calls in between. msg_begin() and 
+//msg_end() are optional. With CRC enabled, mismatch is detected only
+//after all chunks have been passed, msg_end() is not called then.
+//Must be set before the first layout arrives; notify is not used after.
+typedef struct
+{
+	void (*msg_begin)(size_t n_blocks, void *data);
+	void (*block_begin)(size_t index, size_t len, void *data);
+	void (*chunk)(const void *mem, size_t len, void *data);
+	void (*block_end)(size_t index, void *data);
+	void (*msg_end)(void *data);
+	void *data;
+} SmeMsgReaderStream;
+
+void sme_msg_reader_set_stream
+	(SmeMsgReader *reader, SmeMsgReaderStream stream, size_t chunk_size);
+
+//Borrowed views: messages whose layout and blocks fit in buf_size 
+//bytes are read into a buffer owned by the reader, and passed to 
+//view.call() as blocks pointing into it instead of as MmcMsg. The view 
+//is valid only until call() returns; sme_msg_view_copy() makes a 
+//message out of it. Block lengths are found once per distinct layout, 
+//so a run of messages with the same layout is received without 
+//allocating. Larger messages are still passed to notify.
+//Must be set before the first layout arrives, cannot be combined
+//with streaming.
+typedef struct
+{
+	const uint32_t *layout;
+	size_t layout_size;
+	const SscMBlock *blocks;
+	size_t n_blocks;
+} SmeMsgView;
+
+typedef struct
+{
+	void (*call)(SmeMsgView *view, void *data);
+	void *data;
+} SmeMsgReaderView;
+
+void sme_msg_reader_set_view
+	(SmeMsgReader *reader, SmeMsgReaderView view, size_t buf_size);
+
+//Returns NULL if allocation fails.
+MmcMsg *sme_msg_view_copy(SmeMsgView *view);
+
+//Kernel receive timestamp of the header of the message being 
+//delivered, for use from notify.call(), view.call() and stream 
+//callbacks. CLOCK_REALTIME in nanoseconds, 0 if the channel does not
+//provide timestamps, see sme_fd_channel_set_timestamping().
+uint64_t sme_msg_reader_get_rx_timestamp(SmeMsgReader *reader);
+
+//Returns 1 if malformed data or a CRC mismatch was encountered; 
+//failed reader does not read anything more.
+int sme_msg_reader_is_failed(SmeMsgReader *reader);
+
+//Parses a message serialized as by SmeMsgWriter that occupies whole of
+//given buffer. Returns NULL if the data is malformed.
+MmcMsg *sme_msg_parse(const void *data, size_t len);
+
@@ -0,0 +1,505 @@
+/* mux.c
+ * Multiplexing of several message streams over one channel
+ *
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ *
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "incl.h"
+
+
+//Multiplexing message writer
+
+//Message being cut into chunks
+typedef struct
+{
+	SmePreparedMsg *prepared;
+	const SscMBlock *blocks;
+	size_t n_blocks;
+
+	//Position of next chunk
+	size_t blk;
+	size_t offset;
+} MuxMsg;
+
+mdsl_declare_queue(MuxMsg, MuxMsgQueue, mux_msg_queue);
+
+//Chunk queued on the channel
+typedef struct
+{
+	uint32_t header[2];
+
+	//Message to free when chunk is written, if this is the last chunk
+	int has_msg;
+	MuxMsg msg;
+} MuxChunk;
+
+struct _SmeMuxWriter
+{
+	MdslRC parent;
+
+	SmeChannel *channel;
+
+	int n_streams;
+	MuxMsgQueue *streams;
+	int next_stream;
+
+	int crc;
+
+	//Ring of chunks queued on the channel
+	MuxChunk chunks[SME_MUX_WINDOW];
+	int chunk_head;
+	int n_chunks;
+};
+
+static void mux_msg_free(MuxMsg *mmsg)
+{
+	sme_prepared_msg_unref(mmsg->prepared);
+}
+
+//Queues one chunk from given stream
+static void sme_mux_writer_queue_chunk(SmeMuxWriter *writer, int stream)
+{
+	MuxMsg *mmsg = mux_msg_queue_head(writer->streams + stream);
+	MuxChunk *chunk;
+	SscMBlock *iov;
+	size_t n_iov, len, seg;
+
+	chunk = writer->chunks
+		+ ((writer->chunk_head + writer->n_chunks) % SME_MUX_WINDOW);
+	writer->n_chunks++;
+
+	iov = (SscMBlock *) mdsl_alloc
+		(sizeof(SscMBlock) * (mmsg->n_blocks - mmsg->blk + 1));
+	iov[0].mem = chunk->header;
+	iov[0].len = sizeof(chunk->header);
+	n_iov = 1;
+
+	//Take bytes from message blocks
+	len = 0;
+	while (mmsg->blk < mmsg->n_blocks && len < SME_MUX_CHUNK_SIZE)
+	{
+		const SscMBlock *blk = mmsg->blocks + mmsg->blk;
+
+		seg = blk->len - mmsg->offset;
+		if (seg > SME_MUX_CHUNK_SIZE - len)
+			seg = SME_MUX_CHUNK_SIZE - len;
+
+		if (seg > 0)
+		{
+			iov[n_iov].mem = MDSL_PTR_ADD(blk->mem, mmsg->offset);
+			iov[n_iov].len = seg;
+			n_iov++;
+			len += seg;
+		}
+
+		mmsg->offset += seg;
+		if (mmsg->offset == blk->len)
+		{
+			mmsg->blk++;
+			mmsg->offset = 0;
+		}
+	}
+
+	//Skip trailing empty blocks so that no chunk is empty
+	while (mmsg->blk < mmsg->n_blocks 
+			&& mmsg->blocks[mmsg->blk].len == 0)
+		mmsg->blk++;
+
+	//Fill header
+	chunk->header[0] = ssc_uint32_to_le((uint32_t) stream);
+	if (mmsg->blk == mmsg->n_blocks)
+	{
+		chunk->header[1] = ssc_uint32_to_le
+			(((uint32_t) len) | SME_MUX_LAST_CHUNK);
+		chunk->has_msg = 1;
+		chunk->msg = mux_msg_queue_pop(writer->streams + stream);
+	}
+	else
+	{
+		chunk->header[1] = ssc_uint32_to_le((uint32_t) len);
+		chunk->has_msg = 0;
+	}
+
+	sme_channel_add_write_job(writer->channel, iov, n_iov);
+
+	free(iov);
+}
+
+//Fills the window with chunks from streams in round robin order
+static void sme_mux_writer_schedule(SmeMuxWriter *writer)
+{
+	int i, stream = 0;
+
+	while (writer->n_chunks < SME_MUX_WINDOW)
+	{
+		for (i = 0; i < writer->n_streams; i++)
+		{
+			stream = (writer->next_stream + i) % writer->n_streams;
+			if (mux_msg_queue_size(writer->streams + stream) > 0)
+				break;
+		}
+		if (i == writer->n_streams)
+			break;
+
+		sme_mux_writer_queue_chunk(writer, stream);
+		writer->next_stream = (stream + 1) % writer->n_streams;
+	}
+}
+
+static void sme_mux_writer_notify_fn(void *source_ptr, int n_jobs)
+{
+	SmeMuxWriter *writer = source_ptr;
+
+	while (n_jobs--)
+	{
+		MuxChunk *chunk = writer->chunks + writer->chunk_head;
+
+		if (chunk->has_msg)
+			mux_msg_free(&(chunk->msg));
+		chunk->has_msg = 0;
+
+		writer->chunk_head = (writer->chunk_head + 1) % SME_MUX_WINDOW;
+		writer->n_chunks--;
+	}
+
+	sme_mux_writer_schedule(writer);
+}
+
+//
+mdsl_rc_define(SmeMuxWriter, sme_mux_writer);
+
+static void sme_mux_writer_destroy(SmeMuxWriter *writer)
+{
+	int i, j, len;
+	MuxMsg *mmsgs;
+
+	//Unref channel
+	sme_channel_unset_write_source(writer->channel);
+	sme_channel_unref(writer->channel);
+	writer->channel = NULL;
+
+	//Destroy queued chunks
+	for (i = 0; i < writer->n_chunks; i++)
+	{
+		MuxChunk *chunk = writer->chunks
+			+ ((writer->chunk_head + i) % SME_MUX_WINDOW);
+		if (chunk->has_msg)
+			mux_msg_free(&(chunk->msg));
+	}
+
+	//Destroy streams
+	for (i = 0; i < writer->n_streams; i++)
+	{
+		len = mux_msg_queue_size(writer->streams + i);
+		mmsgs = mux_msg_queue_head(writer->streams + i);
+		for (j = 0; j < len; j++)
+			mux_msg_free(mmsgs + j);
+		mux_msg_queue_destroy(writer->streams + i);
+	}
+	free(writer->streams);
+
+	free(writer);
+}
+
+SmeMuxWriter *sme_mux_writer_new(SmeChannel *channel, int n_streams)
+{
+	SmeMuxWriter *writer;
+	SmeJobSource js;
+	int i;
+
+	sme_assert(n_streams > 0, "Invalid number of streams %d", n_streams);
+
+	writer = (SmeMuxWriter *) mdsl_alloc(sizeof(SmeMuxWriter));
+
+	mdsl_rc_init(writer);
+
+	writer->n_streams = n_streams;
+	writer->streams = (MuxMsgQueue *) mdsl_alloc
+		(sizeof(MuxMsgQueue) * n_streams);
+	for (i = 0; i < n_streams; i++)
+		mux_msg_queue_init(writer->streams + i);
+	writer->next_stream = 0;
+	writer->crc = 0;
+	writer->chunk_head = 0;
+	writer->n_chunks = 0;
+
+	sme_channel_ref(channel);
+	writer->channel = channel;
+	js.source_ptr = writer;
+	js.notify = sme_mux_writer_notify_fn;
+	js.progress = NULL;
+	sme_channel_set_write_source(channel, js);
+
+	return writer;
+}
+
+void sme_mux_writer_add_msg(SmeMuxWriter *writer, int stream, MmcMsg *msg)
+{
+	SmePreparedMsg *prepared = sme_prepared_msg_new(msg);
+
+	sme_mux_writer_add_prepared(writer, stream, prepared);
+
+	sme_prepared_msg_unref(prepared);
+}
+
+void sme_mux_writer_add_prepared
+	(SmeMuxWriter *writer, int stream, SmePreparedMsg *prepared)
+{
+	MuxMsg mmsg;
+
+	sme_assert(stream >= 0 && stream < writer->n_streams,
+			"Invalid stream %d", stream);
+
+	//Bytes on the stream are the same as from SmeMsgWriter
+	mmsg.prepared = prepared;
+	sme_prepared_msg_ref(prepared);
+	mmsg.blocks = sme_prepared_msg_get_iov
+		(prepared, writer->crc, &(mmsg.n_blocks));
+	mmsg.blk = 0;
+	mmsg.offset = 0;
+
+	mux_msg_queue_push(writer->streams + stream, mmsg);
+
+	sme_mux_writer_schedule(writer);
+}
+
+void sme_mux_writer_set_crc(SmeMuxWriter *writer, int enabled)
+{
+	writer->crc = enabled;
+}
+
+int sme_mux_writer_get_queue_len(SmeMuxWriter *writer, int stream)
+{
+	sme_assert(stream >= 0 && stream < writer->n_streams,
+			"Invalid stream %d", stream);
+
+	return mux_msg_queue_size(writer->streams + stream);
+}
+
+//Multiplexing message reader
+
+typedef enum
+{
+	MUX_READER_READ_HEADER,
+	MUX_READER_READ_CHUNK,
+	MUX_READER_ERROR
+} MuxReaderState;
+
+//Reassembly buffer of a stream
+typedef struct
+{
+	char *data;
+	size_t len, alloc;
+} MuxBuffer;
+
+struct _SmeMuxReader
+{
+	MdslRC parent;
+
+	MuxReaderState state;
+	SmeChannel *channel;
+	int crc;
+
+	SmeMsgReaderNotify notify;
+	MmcMsg *msg_buf;
+
+	int n_streams;
+	MuxBuffer *streams;
+
+	uint32_t header[2];
+	int cur_stream;
+	uint32_t cur_len;
+	int cur_last;
+};
+
+static void sme_mux_reader_goto_read_header(SmeMuxReader *reader)
+{
+	SscMBlock iov = {reader->header, sizeof(reader->header)};
+	reader->state = MUX_READER_READ_HEADER;
+	sme_channel_add_read_job(reader->channel, &iov, 1);
+}
+
+static void sme_mux_reader_advance(SmeMuxReader *reader)
+{
+	if (reader->state == MUX_READER_READ_HEADER)
+	{
+		uint32_t stream, len;
+		MuxBuffer *buf;
+		SscMBlock iov;
+
+		//Fetch data
+		stream = ssc_uint32_from_le(reader->header[0]);
+		len = ssc_uint32_from_le(reader->header[1]);
+
+		//Checks
+		if (stream >= reader->n_streams)
+			goto fail;
+		reader->cur_stream = stream;
+		reader->cur_last = (len & SME_MUX_LAST_CHUNK) ? 1 : 0;
+		reader->cur_len = len & (~ SME_MUX_LAST_CHUNK);
+		if (reader->cur_len == 0)
+			goto fail;
+
+		//Make room in reassembly buffer
+		buf = reader->streams + stream;
+		if (buf->len + reader->cur_len > buf->alloc)
+		{
+			size_t alloc = buf->alloc ? buf->alloc : SME_MUX_CHUNK_SIZE;
+			char *data;
+			while (alloc < buf->len + reader->cur_len)
+				alloc *= 2;
+			data = (char *) realloc(buf->data, alloc);
+			if (! data)
+				goto fail;
+			buf->data = data;
+			buf->alloc = alloc;
+		}
+
+		//State change
+		reader->state = MUX_READER_READ_CHUNK;
+
+		//Add job
+		iov.mem = buf->data + buf->len;
+		iov.len = reader->cur_len;
+		sme_channel_add_read_job(reader->channel, &iov, 1);
+	}
+	else if (reader->state == MUX_READER_READ_CHUNK)
+	{
+		MuxBuffer *buf = reader->streams + reader->cur_stream;
+
+		buf->len += reader->cur_len;
+
+		if (reader->cur_last)
+		{
+			MmcMsg *msg;
+			size_t len = buf->len;
+
+			if (reader->crc)
+			{
+				uint32_t crc_le;
+
+				if (len < sizeof(uint32_t))
+					goto fail;
+				len -= sizeof(uint32_t);
+				memcpy(&crc_le, buf->data + len, sizeof(uint32_t));
+				if (ssc_uint32_from_le(crc_le) 
+					!= sme_crc32c(buf->data, len))
+					goto fail;
+			}
+
+			msg = sme_msg_parse(buf->data, len);
+			if (! msg)
+				goto fail;
+			buf->len = 0;
+
+			//Add finished message to queue
+			sme_assert(! reader->msg_buf, "Message buffer overflow");
+			reader->msg_buf = msg;
+		}
+
+		sme_mux_reader_goto_read_header(reader);
+	}
+
+	return;
+fail:
+	reader->state = MUX_READER_ERROR;
+}
+
+static void sme_mux_reader_notify_fn(void *source_ptr, int n_jobs)
+{
+	SmeMuxReader *reader = source_ptr;
+
+	sme_assert(n_jobs == 1, "Unexpected completion of %d jobs", n_jobs);
+
+	sme_mux_reader_advance(reader);
+
+	if (reader->msg_buf)
+	{
+		MmcMsg *msg_tmp = reader->msg_buf;
+		reader->msg_buf = NULL;
+
+		(* reader->notify.call)(msg_tmp, reader->notify.data);
+	}
+}
+
+//
+mdsl_rc_define(SmeMuxReader, sme_mux_reader);
+
+static void sme_mux_reader_destroy(SmeMuxReader *reader)
+{
+	int i;
+
+	//Unref the channel
+	sme_channel_unset_read_source(reader->channel);
+	sme_channel_unref(reader->channel);
+	reader->channel = NULL;
+
+	//Destroy message in the buffer pointer
+	if (reader->msg_buf)
+		mmc_msg_unref(reader->msg_buf);
+	reader->msg_buf = NULL;
+
+	//Destroy reassembly buffers
+	for (i = 0; i < reader->n_streams; i++)
+		free(reader->streams[i].data);
+	free(reader->streams);
+
+	free(reader);
+}
+
+SmeMuxReader *sme_mux_reader_new
+	(SmeChannel *channel, int n_streams, SmeMsgReaderNotify notify)
+{
+	SmeJobSource js;
+	SmeMuxReader *reader;
+	int i;
+
+	sme_assert(n_streams > 0, "Invalid number of streams %d", n_streams);
+
+	reader = (SmeMuxReader *) mdsl_alloc(sizeof(SmeMuxReader));
+
+	mdsl_rc_init(reader);
+
+	reader->msg_buf = NULL;
+	reader->notify = notify;
+	reader->crc = 0;
+	reader->n_streams = n_streams;
+	reader->streams = (MuxBuffer *) mdsl_alloc(sizeof(MuxBuffer) * n_streams);
+	for (i = 0; i < n_streams; i++)
+	{
+		reader->streams[i].data = NULL;
+		reader->streams[i].len = 0;
+		reader->streams[i].alloc = 0;
+	}
+
+	sme_channel_ref(channel);
+	reader->channel = channel;
+
+	js.source_ptr = reader;
+	js.notify = sme_mux_reader_notify_fn;
+	js.progress = NULL;
+	sme_channel_set_read_source(reader->channel, js);
+
+	sme_mux_reader_goto_read_header(reader);
+
+	return reader;
+}
+
+void sme_mux_reader_set_crc(SmeMuxReader *reader, int enabled)
+{
+	reader->crc = enabled;
+}
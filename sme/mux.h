@@ -0,0 +1,72 @@
+/* mux.h
+ * Multiplexing of several message streams over one channel
+ *
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ *
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Protocol:
+ * Each message is serialized exactly as by SmeMsgWriter (size, layout,
+ * blocks, CRC trailer if enabled) from a prepared message, and the 
+ * resulting bytes are cut into chunks of at most
+ * SME_MUX_CHUNK_SIZE bytes. Every chunk is preceded by a header of two
+ * little endian 32-bit integers: stream ID, and chunk length with
+ * SME_MUX_LAST_CHUNK bit set on the last chunk of a message.
+ *
+ * Writer sends one chunk at a time from each stream that has messages,
+ * in round robin order, and keeps at most SME_MUX_WINDOW chunks queued
+ * on the channel, so that a large message delays messages on other
+ * streams by at most that many chunks.
+ *
+ * Streams take the place of priority classes of SmeMsgWriter: messages 
+ * on a stream are sent in order, and priorities and deadlines are not
+ * supported.
+ */
+
+#define SME_MUX_CHUNK_SIZE 65536
+#define SME_MUX_WINDOW 2
+#define SME_MUX_LAST_CHUNK 0x80000000
+
+//Multiplexing message writer
+typedef struct _SmeMuxWriter SmeMuxWriter;
+
+mdsl_rc_declare(SmeMuxWriter, sme_mux_writer);
+
+SmeMuxWriter *sme_mux_writer_new(SmeChannel *channel, int n_streams);
+
+void sme_mux_writer_add_msg(SmeMuxWriter *writer, int stream, MmcMsg *msg);
+
+//Fan-out: queues a prepared message without encoding it again
+void sme_mux_writer_add_prepared
+	(SmeMuxWriter *writer, int stream, SmePreparedMsg *prepared);
+
+//CRC32C trailer as by sme_msg_writer_set_crc(), applies to messages 
+//added afterwards; the reader must agree.
+void sme_mux_writer_set_crc(SmeMuxWriter *writer, int enabled);
+
+int sme_mux_writer_get_queue_len(SmeMuxWriter *writer, int stream);
+
+//Multiplexing message reader
+typedef struct _SmeMuxReader SmeMuxReader;
+
+mdsl_rc_declare(SmeMuxReader, sme_mux_reader);
+
+SmeMuxReader *sme_mux_reader_new
+	(SmeChannel *channel, int n_streams, SmeMsgReaderNotify notify);
+
+//Expect CRC32C trailer as written by sme_mux_writer_set_crc().
+//Reader fails on mismatch.
+void sme_mux_reader_set_crc(SmeMuxReader *reader, int enabled);
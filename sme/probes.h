@@ -0,0 +1,68 @@
+/* probes.h
+ * USDT static tracepoints
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//Internal header, not installed.
+//Probes are in provider 'sme', enabled by configuring with --enable-sdt.
+//When disabled they compile to nothing.
+
+#ifdef SME_ENABLE_SDT
+
+#include <sys/sdt.h>
+
+#define sme_probe2(name, a1, a2) \
+	DTRACE_PROBE2(sme, name, a1, a2)
+#define sme_probe3(name, a1, a2, a3) \
+	DTRACE_PROBE3(sme, name, a1, a2, a3)
+#define sme_probe4(name, a1, a2, a3, a4) \
+	DTRACE_PROBE4(sme, name, a1, a2, a3, a4)
+
+#else
+
+//Arguments are only evaluated to avoid unused variable warnings
+#define sme_probe2(name, a1, a2) \
+	do { (void) (a1); (void) (a2); } while (0)
+#define sme_probe3(name, a1, a2, a3) \
+	do { (void) (a1); (void) (a2); (void) (a3); } while (0)
+#define sme_probe4(name, a1, a2, a3, a4) \
+	do { (void) (a1); (void) (a2); (void) (a3); (void) (a4); } while (0)
+
+#endif
+
+/* Probe list:
+ * 
+ * writer_add_msg(writer, msg, n_blocks, n_bytes)
+ *     A message was queued on a writer.
+ * writer_job_done(writer, msg, n_bytes)
+ *     All bytes of a queued message were written.
+ * writer_job_expired(writer, msg, n_bytes)
+ *     A queued message was dropped because its deadline passed.
+ * reader_state(reader, old_state, new_state)
+ *     Reader moved between states (see ReaderState in msg.c).
+ * reader_deliver(reader, msg)
+ *     A fully read message is about to be handed to the reader callback.
+ * lane_io_entry(lane, fd, n_iov, n_bytes_queued)
+ *     A channel lane is about to call readv/writev.
+ * lane_io_return(lane, fd, res)
+ *     The readv/writev call returned.
+ * link_send(link, msg)
+ *     A message was sent over a channel link.
+ * link_receive(link, msg)
+ *     A message was received from a channel link.
+ */
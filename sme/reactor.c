@@ -0,0 +1,492 @@
+/* reactor.c
+ * Minimal edge-triggered epoll event loop for fd channels
+ *
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ *
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "incl.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+typedef struct _ReactorEntry ReactorEntry;
+
+struct _ReactorEntry
+{
+	//All registered channels
+	ReactorEntry *next, *prev;
+	//Ready list, NULL when not on it
+	ReactorEntry *rnext, *rprev;
+
+	SmeFdChannel *channel;
+	int fd, write_fd;
+	SmeChannelCB cb;
+
+	int readable, writable;
+	//Being run, removal is left to the runner
+	int running, removed;
+};
+
+struct _SmeReactor
+{
+	MdslRC parent;
+
+	int epfd;
+	//Timerfd is one-shot, set for the next time the wheel has work
+	int timerfd;
+	uint64_t timer_armed;
+	SmeTimerWheel *wheel;
+
+	ReactorEntry entries;
+	ReactorEntry ready;
+	int n_channels;
+
+	//Some ready channel only has held write completions
+	int held;
+
+	int stopped;
+};
+
+//Lists
+
+static void reactor_list_init(ReactorEntry *head)
+{
+	head->next = head->prev = head;
+}
+
+static void reactor_list_append(ReactorEntry *head, ReactorEntry *entry)
+{
+	entry->prev = head->prev;
+	entry->next = head;
+	head->prev->next = entry;
+	head->prev = entry;
+}
+
+static void reactor_list_unlink(ReactorEntry *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+	entry->next = entry->prev = NULL;
+}
+
+static void reactor_ready_init(ReactorEntry *head)
+{
+	head->rnext = head->rprev = head;
+}
+
+static void reactor_ready_append(ReactorEntry *head, ReactorEntry *entry)
+{
+	entry->rprev = head->rprev;
+	entry->rnext = head;
+	head->rprev->rnext = entry;
+	head->rprev = entry;
+}
+
+static void reactor_ready_unlink(ReactorEntry *entry)
+{
+	if (! entry->rnext)
+		return;
+
+	entry->rprev->rnext = entry->rnext;
+	entry->rnext->rprev = entry->rprev;
+	entry->rnext = entry->rprev = NULL;
+}
+
+//Moves all entries from one ready list to another, empty one
+static void reactor_ready_move(ReactorEntry *from, ReactorEntry *to)
+{
+	if (from->rnext == from)
+	{
+		reactor_ready_init(to);
+		return;
+	}
+
+	to->rnext = from->rnext;
+	to->rprev = from->rprev;
+	to->rnext->rprev = to;
+	to->rprev->rnext = to;
+	reactor_ready_init(from);
+}
+
+//Entries
+
+static void reactor_entry_free(SmeReactor *reactor, ReactorEntry *entry)
+{
+	reactor_ready_unlink(entry);
+	sme_channel_unref((SmeChannel *) entry->channel);
+	free(entry);
+}
+
+//Deregisters the entry, freeing is deferred if it is being run
+static void reactor_entry_remove(SmeReactor *reactor, ReactorEntry *entry)
+{
+	epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, entry->fd, NULL);
+	if (entry->write_fd != entry->fd)
+		epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, entry->write_fd, NULL);
+	reactor_list_unlink(entry);
+	reactor->n_channels--;
+
+	if (entry->running)
+		entry->removed = 1;
+	else
+		reactor_entry_free(reactor, entry);
+}
+
+static ReactorEntry *reactor_entry_find
+	(SmeReactor *reactor, SmeFdChannel *channel)
+{
+	ReactorEntry *iter;
+
+	for (iter = reactor->entries.next;
+		iter != &(reactor->entries);
+		iter = iter->next)
+	{
+		if (iter->channel == channel)
+			return iter;
+	}
+
+	return NULL;
+}
+
+static int reactor_entry_has_work(ReactorEntry *entry)
+{
+	return (entry->readable
+			&& sme_fd_channel_get_read_queue_len(entry->channel) > 0)
+		|| (entry->writable
+			&& sme_fd_channel_get_write_queue_len(entry->channel) > 0
+			&& ! sme_fd_channel_is_write_held(entry->channel));
+}
+
+//Runs IO in one direction until EAGAIN, empty lane or the limit.
+//Returns -1 on end of file or failure.
+static int reactor_entry_io(ReactorEntry *entry, int write)
+{
+	SmeChannel *base = (SmeChannel *) entry->channel;
+	int *flag = write ? &(entry->writable) : &(entry->readable);
+	ssize_t res;
+	int i;
+
+	for (i = 0; i < SME_REACTOR_IO_LIMIT && *flag && ! entry->removed; i++)
+	{
+		if (write)
+		{
+			if (sme_fd_channel_get_write_queue_len(entry->channel) == 0)
+				break;
+			res = sme_channel_write(base);
+		}
+		else
+		{
+			if (sme_fd_channel_get_read_queue_len(entry->channel) == 0)
+				break;
+			res = sme_channel_read(base);
+		}
+
+		//Held completions are polled once per pass
+		if (write && sme_fd_channel_is_write_held(entry->channel))
+			break;
+		if (res > 0)
+			continue;
+		if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			*flag = 0;
+		else if (res < 0 && errno == EINTR)
+			continue;
+		else if (res < 0 || ! write)
+			return -1;
+	}
+
+	return 0;
+}
+
+//Runs all channels on the ready list once.
+//Returns 1 if some channel still has jobs it can run, and notes whether
+//some channel has to be polled for held completions.
+static int sme_reactor_run_ready(SmeReactor *reactor)
+{
+	ReactorEntry list[1];
+	ReactorEntry *entry;
+	SmeChannel *channel;
+	SmeChannelCB cb;
+	int res, busy = 0;
+
+	//Channels that become ready while running are run in the next pass
+	reactor_ready_move(&(reactor->ready), list);
+	reactor->held = 0;
+
+	while (list->rnext != list)
+	{
+		entry = list->rnext;
+		reactor_ready_unlink(entry);
+
+		entry->running = 1;
+		res = reactor_entry_io(entry, 0);
+		if (res == 0)
+			res = reactor_entry_io(entry, 1);
+		entry->running = 0;
+
+		if (entry->removed)
+		{
+			reactor_entry_free(reactor, entry);
+		}
+		else if (res < 0)
+		{
+			channel = (SmeChannel *) entry->channel;
+			cb = entry->cb;
+
+			sme_channel_ref(channel);
+			reactor_entry_remove(reactor, entry);
+			if (cb.failed)
+				(* cb.failed)(channel, cb.ptr);
+			sme_channel_unref(channel);
+		}
+		else if (entry->readable || entry->writable)
+		{
+			reactor_ready_append(&(reactor->ready), entry);
+			busy |= reactor_entry_has_work(entry);
+			reactor->held |= sme_fd_channel_is_write_held(entry->channel);
+		}
+	}
+
+	return busy;
+}
+
+//Timers
+
+static void sme_reactor_arm_timer(SmeReactor *reactor)
+{
+	struct itimerspec spec;
+	uint64_t next = sme_timer_wheel_get_next_time(reactor->wheel);
+
+	if (next == reactor->timer_armed)
+		return;
+
+	//Same clock as sme_latency_now(), 0 disarms
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = next / 1000000000;
+	spec.it_value.tv_nsec = next % 1000000000;
+	timerfd_settime(reactor->timerfd, TFD_TIMER_ABSTIME, &spec, NULL);
+	reactor->timer_armed = next;
+}
+
+//Reactor
+
+mdsl_rc_define(SmeReactor, sme_reactor);
+
+static void sme_reactor_destroy(SmeReactor *reactor)
+{
+	while (reactor->entries.next != &(reactor->entries))
+		reactor_entry_remove(reactor, reactor->entries.next);
+
+	sme_timer_wheel_unref(reactor->wheel);
+	close(reactor->timerfd);
+	close(reactor->epfd);
+
+	free(reactor);
+}
+
+SmeReactor *sme_reactor_new(uint64_t tick_ns)
+{
+	SmeReactor *reactor;
+	struct epoll_event event;
+	int epfd, timerfd;
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0)
+		return NULL;
+
+	timerfd = timerfd_create
+		(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timerfd < 0)
+		goto fail;
+
+	//Timer events carry NULL
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, timerfd, &event) < 0)
+		goto fail;
+
+	reactor = (SmeReactor *) mdsl_alloc(sizeof(SmeReactor));
+
+	mdsl_rc_init(reactor);
+
+	reactor->epfd = epfd;
+	reactor->timerfd = timerfd;
+	reactor->timer_armed = 0;
+	reactor->wheel = sme_timer_wheel_new(NULL, tick_ns);
+	reactor_list_init(&(reactor->entries));
+	reactor_ready_init(&(reactor->ready));
+	reactor->n_channels = 0;
+	reactor->held = 0;
+	reactor->stopped = 0;
+
+	return reactor;
+
+fail:
+	{
+		int saved_errno = errno;
+		if (timerfd >= 0)
+			close(timerfd);
+		close(epfd);
+		errno = saved_errno;
+	}
+	return NULL;
+}
+
+int sme_reactor_add_channel
+	(SmeReactor *reactor, SmeFdChannel *channel, SmeChannelCB cb)
+{
+	ReactorEntry *entry;
+	struct epoll_event event;
+
+	sme_assert(! reactor_entry_find(reactor, channel),
+			"Channel is already added");
+
+	entry = (ReactorEntry *) mdsl_alloc(sizeof(ReactorEntry));
+
+	entry->rnext = entry->rprev = NULL;
+	entry->channel = channel;
+	entry->fd = sme_fd_channel_get_fd(channel);
+	entry->write_fd = sme_fd_channel_get_write_fd(channel);
+	entry->cb = cb;
+	entry->readable = entry->writable = 0;
+	entry->running = entry->removed = 0;
+
+	//Channels over a pair of fds are registered once per direction
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	if (entry->write_fd != entry->fd)
+		event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+	event.data.ptr = entry;
+	if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, entry->fd, &event) < 0)
+	{
+		free(entry);
+		return -1;
+	}
+	if (entry->write_fd != entry->fd)
+	{
+		event.events = EPOLLOUT | EPOLLET;
+		if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, entry->write_fd, &event)
+				< 0)
+		{
+			epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, entry->fd, NULL);
+			free(entry);
+			return -1;
+		}
+	}
+
+	sme_channel_ref((SmeChannel *) channel);
+	reactor_list_append(&(reactor->entries), entry);
+	reactor->n_channels++;
+
+	return 0;
+}
+
+void sme_reactor_remove_channel(SmeReactor *reactor, SmeFdChannel *channel)
+{
+	ReactorEntry *entry = reactor_entry_find(reactor, channel);
+
+	if (entry)
+		reactor_entry_remove(reactor, entry);
+}
+
+int sme_reactor_get_n_channels(SmeReactor *reactor)
+{
+	return reactor->n_channels;
+}
+
+SmeTimerWheel *sme_reactor_get_timer_wheel(SmeReactor *reactor)
+{
+	return reactor->wheel;
+}
+
+int sme_reactor_run_once(SmeReactor *reactor, int timeout_ms)
+{
+	struct epoll_event events[SME_REACTOR_BATCH];
+	ReactorEntry *entry;
+	uint64_t expirations;
+	int i, n;
+
+	sme_reactor_ref(reactor);
+
+	//Jobs added since the last pass
+	if (sme_reactor_run_ready(reactor))
+		timeout_ms = 0;
+	else if (reactor->held && (timeout_ms < 0 
+			|| timeout_ms > SME_FD_CHANNEL_HELD_POLL_MS))
+		timeout_ms = SME_FD_CHANNEL_HELD_POLL_MS;
+
+	sme_reactor_arm_timer(reactor);
+
+	n = epoll_wait(reactor->epfd, events, SME_REACTOR_BATCH, timeout_ms);
+	if (n < 0)
+	{
+		if (errno != EINTR)
+			goto end;
+		n = 0;
+	}
+
+	//Only mark channels here, callbacks may remove entries
+	for (i = 0; i < n; i++)
+	{
+		entry = events[i].data.ptr;
+		if (! entry)
+		{
+			while (read(reactor->timerfd, &expirations,
+						sizeof(expirations)) > 0)
+				;
+			continue;
+		}
+
+		if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP))
+			entry->readable = 1;
+		if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+			entry->writable = 1;
+		if (! entry->rnext)
+			reactor_ready_append(&(reactor->ready), entry);
+	}
+
+	sme_timer_wheel_advance(reactor->wheel, sme_latency_now());
+
+	sme_reactor_run_ready(reactor);
+
+end:
+	sme_reactor_unref(reactor);
+	return n;
+}
+
+int sme_reactor_run(SmeReactor *reactor)
+{
+	int res = 0;
+
+	reactor->stopped = 0;
+	while (! reactor->stopped)
+	{
+		res = sme_reactor_run_once(reactor, -1);
+		if (res < 0)
+			break;
+	}
+
+	return res < 0 ? -1 : 0;
+}
+
+void sme_reactor_stop(SmeReactor *reactor)
+{
+	reactor->stopped = 1;
+}
+
@@ -0,0 +1,73 @@
+/* reactor.h
+ * Minimal edge-triggered epoll event loop for fd channels
+ *
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ *
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Every channel is registered once with EPOLLIN | EPOLLOUT | EPOLLET and
+ * stays registered until it is removed, so the epoll set is never
+ * modified when lanes empty and refill. Events only mark a channel
+ * readable or writable and put it on the ready list. Channels on the
+ * ready list get up to SME_REACTOR_IO_LIMIT reads and writes per pass;
+ * a direction leaves the list when IO returns EAGAIN, and stays on it
+ * while its lane is empty, so that jobs added later are run on the next
+ * pass without waiting for another edge.
+ *
+ * epoll_wait() returns up to SME_REACTOR_BATCH events at a time. It does
+ * not block while a ready channel has jobs. Write completions held back
+ * for gifted pages are not jobs it can run: they are polled once per
+ * pass, waiting at most SME_FD_CHANNEL_HELD_POLL_MS in between.
+ *
+ * Timers are run by a timer wheel that is driven by a timerfd,
+ * set for the next tick the wheel has timers to handle.
+ *
+ * Reactor is single threaded: channels must only be given jobs from
+ * the thread running the reactor.
+ */
+
+#define SME_REACTOR_BATCH 64
+#define SME_REACTOR_IO_LIMIT 16
+
+typedef struct _SmeReactor SmeReactor;
+
+mdsl_rc_declare(SmeReactor, sme_reactor);
+
+//Returns NULL and sets errno if epoll or timerfd cannot be created.
+SmeReactor *sme_reactor_new(uint64_t tick_ns);
+
+//Registers the channel until it is removed or fails, reactor holds a
+//reference meanwhile. cb.failed() is called after the channel is
+//removed on end of file or an IO error. Returns -1 if epoll_ctl() fails.
+int sme_reactor_add_channel
+	(SmeReactor *reactor, SmeFdChannel *channel, SmeChannelCB cb);
+
+void sme_reactor_remove_channel(SmeReactor *reactor, SmeFdChannel *channel);
+
+int sme_reactor_get_n_channels(SmeReactor *reactor);
+
+//Timer wheel ticking with this reactor
+SmeTimerWheel *sme_reactor_get_timer_wheel(SmeReactor *reactor);
+
+//Waits for at most timeout_ms milliseconds (-1 for no limit) and runs
+//ready channels and expired timers. Returns -1 if epoll_wait() fails.
+int sme_reactor_run_once(SmeReactor *reactor, int timeout_ms);
+
+//Runs until sme_reactor_stop() is called.
+int sme_reactor_run(SmeReactor *reactor);
+
+void sme_reactor_stop(SmeReactor *reactor);
+
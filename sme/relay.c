@@ -0,0 +1,332 @@
+/* relay.c
+ * Forwarding of messages between file descriptors without decoding
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "incl.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+//Amount of message data in flight between source and destination
+#define RELAY_BUF_SIZE 65536
+
+typedef enum
+{
+	RELAY_READ_SIZE,
+	RELAY_READ_LAYOUT,
+	RELAY_WRITE_HEADER,
+	RELAY_MOVE_BODY,
+	RELAY_CLOSED,
+	RELAY_ERROR
+} RelayState;
+
+struct _SmeRelay
+{
+	MdslRC parent;
+
+	RelayState state;
+	int src_fd, dst_fd;
+
+	//Size and layout, written out unchanged
+	uint32_t *header;
+	size_t header_alloc;
+	size_t header_len;
+	size_t header_done;
+
+	//Message data
+	uint64_t body_remaining;
+	size_t in_flight;
+#ifdef HAVE_SPLICE
+	int pipe_fds[2];
+#else
+	char *buf;
+	size_t buf_start;
+#endif
+
+	//CRC32C trailer follows message data
+	int crc;
+
+	//Longest size and layout accepted, in bytes
+	size_t max_header;
+
+	uint64_t n_msgs;
+	uint64_t n_bytes;
+};
+
+//Data movement, returns bytes moved or -1
+#ifdef HAVE_SPLICE
+
+static ssize_t relay_fill(SmeRelay *relay, size_t len)
+{
+	return splice(relay->src_fd, NULL, relay->pipe_fds[1], NULL, len,
+			SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+}
+
+static ssize_t relay_drain(SmeRelay *relay)
+{
+	return splice(relay->pipe_fds[0], NULL, relay->dst_fd, NULL, 
+			relay->in_flight, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+}
+
+#else
+
+static ssize_t relay_fill(SmeRelay *relay, size_t len)
+{
+	return read(relay->src_fd, relay->buf + relay->in_flight, len);
+}
+
+static ssize_t relay_drain(SmeRelay *relay)
+{
+	ssize_t res;
+
+	res = write(relay->dst_fd, relay->buf + relay->buf_start, 
+			relay->in_flight);
+	if (res > 0)
+	{
+		relay->buf_start += res;
+		if (res == relay->in_flight)
+			relay->buf_start = 0;
+	}
+	return res;
+}
+
+#endif
+
+#define relay_would_block() (errno == EAGAIN || errno == EWOULDBLOCK)
+
+SmeRelayStatus sme_relay_run(SmeRelay *relay)
+{
+	ssize_t res;
+
+	while (1)
+	{
+		if (relay->state == RELAY_READ_SIZE 
+				|| relay->state == RELAY_READ_LAYOUT)
+		{
+			res = read(relay->src_fd, 
+					MDSL_PTR_ADD(relay->header, relay->header_done),
+					relay->header_len - relay->header_done);
+			if (res < 0)
+			{
+				if (relay_would_block())
+					return SME_RELAY_WAIT_READ;
+				goto fail;
+			}
+			if (res == 0)
+			{
+				//End of stream is fine only between messages
+				if (relay->state == RELAY_READ_SIZE 
+						&& relay->header_done == 0)
+				{
+					relay->state = RELAY_CLOSED;
+					return SME_RELAY_CLOSED;
+				}
+				goto fail;
+			}
+			relay->header_done += res;
+			if (relay->header_done < relay->header_len)
+				continue;
+
+			if (relay->state == RELAY_READ_SIZE)
+			{
+				uint32_t size = ssc_uint32_from_le(relay->header[0]);
+				size_t header_len = (((size_t) size) + 1) * sizeof(uint32_t);
+
+				//Size comes from the peer, check before allocating
+				if (size == 0 
+					|| size > relay->max_header / sizeof(uint32_t) - 1)
+					goto fail;
+				if (header_len > relay->header_alloc)
+				{
+					uint32_t *header = realloc(relay->header, header_len);
+					if (! header)
+						goto fail;
+					relay->header = header;
+					relay->header_alloc = header_len;
+				}
+				relay->header_len = header_len;
+				relay->state = RELAY_READ_LAYOUT;
+			}
+			else
+			{
+				uint32_t size = ssc_uint32_from_le(relay->header[0]);
+				size_t n_blocks;
+
+				if (sme_layout_get_body_size(relay->header + 1, size, 
+							&n_blocks, &(relay->body_remaining)) < 0)
+					goto fail;
+				if (relay->crc)
+					relay->body_remaining += sizeof(uint32_t);
+				relay->header_done = 0;
+				relay->state = RELAY_WRITE_HEADER;
+			}
+		}
+		else if (relay->state == RELAY_WRITE_HEADER)
+		{
+			res = write(relay->dst_fd, 
+					MDSL_PTR_ADD(relay->header, relay->header_done),
+					relay->header_len - relay->header_done);
+			if (res < 0)
+			{
+				if (relay_would_block())
+					return SME_RELAY_WAIT_WRITE;
+				goto fail;
+			}
+			relay->header_done += res;
+			relay->n_bytes += res;
+			if (relay->header_done == relay->header_len)
+				relay->state = RELAY_MOVE_BODY;
+		}
+		else if (relay->state == RELAY_MOVE_BODY)
+		{
+			//Write out what has been read first, 
+			//so that a blocked destination stops reading.
+			if (relay->in_flight > 0)
+			{
+				res = relay_drain(relay);
+				if (res < 0)
+				{
+					if (relay_would_block())
+						return SME_RELAY_WAIT_WRITE;
+					goto fail;
+				}
+				relay->in_flight -= res;
+				relay->n_bytes += res;
+			}
+			else if (relay->body_remaining > 0)
+			{
+				size_t len = RELAY_BUF_SIZE;
+				if (len > relay->body_remaining)
+					len = relay->body_remaining;
+
+				res = relay_fill(relay, len);
+				if (res < 0)
+				{
+					if (relay_would_block())
+						return SME_RELAY_WAIT_READ;
+					goto fail;
+				}
+				if (res == 0)
+					goto fail;
+				relay->in_flight += res;
+				relay->body_remaining -= res;
+			}
+			else
+			{
+				//Message done
+				relay->n_msgs++;
+				relay->header_len = sizeof(uint32_t);
+				relay->header_done = 0;
+				relay->state = RELAY_READ_SIZE;
+			}
+		}
+		else if (relay->state == RELAY_CLOSED)
+		{
+			return SME_RELAY_CLOSED;
+		}
+		else
+		{
+			return SME_RELAY_ERROR;
+		}
+	}
+
+fail:
+	relay->state = RELAY_ERROR;
+	return SME_RELAY_ERROR;
+}
+
+void sme_relay_set_crc(SmeRelay *relay, int enabled)
+{
+	relay->crc = enabled;
+}
+
+void sme_relay_set_max_header(SmeRelay *relay, size_t max_size)
+{
+	relay->max_header = max_size;
+}
+
+uint64_t sme_relay_get_n_msgs(SmeRelay *relay)
+{
+	return relay->n_msgs;
+}
+
+uint64_t sme_relay_get_n_bytes(SmeRelay *relay)
+{
+	return relay->n_bytes;
+}
+
+//
+mdsl_rc_define(SmeRelay, sme_relay);
+
+static void sme_relay_destroy(SmeRelay *relay)
+{
+	free(relay->header);
+#ifdef HAVE_SPLICE
+	close(relay->pipe_fds[0]);
+	close(relay->pipe_fds[1]);
+#else
+	free(relay->buf);
+#endif
+
+	free(relay);
+}
+
+SmeRelay *sme_relay_new(int src_fd, int dst_fd)
+{
+	SmeRelay *relay;
+
+	relay = (SmeRelay *) mdsl_alloc(sizeof(SmeRelay));
+
+	mdsl_rc_init(relay);
+
+	relay->src_fd = src_fd;
+	relay->dst_fd = dst_fd;
+
+	relay->header_alloc = 64 * sizeof(uint32_t);
+	relay->header = (uint32_t *) mdsl_alloc(relay->header_alloc);
+	relay->header_len = sizeof(uint32_t);
+	relay->header_done = 0;
+
+	relay->body_remaining = 0;
+	relay->in_flight = 0;
+#ifdef HAVE_SPLICE
+	if (pipe2(relay->pipe_fds, O_NONBLOCK | O_CLOEXEC) < 0)
+	{
+		int saved_errno = errno;
+
+		free(relay->header);
+		free(relay);
+		errno = saved_errno;
+		return NULL;
+	}
+#else
+	relay->buf = (char *) mdsl_alloc(RELAY_BUF_SIZE);
+	relay->buf_start = 0;
+#endif
+
+	relay->crc = 0;
+	relay->max_header = SME_RELAY_DEFAULT_MAX_HEADER;
+	relay->n_msgs = 0;
+	relay->n_bytes = 0;
+	relay->state = RELAY_READ_SIZE;
+
+	return relay;
+}
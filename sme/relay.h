@@ -0,0 +1,65 @@
+/* relay.h
+ * Forwarding of messages between file descriptors without decoding
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Relay reads messages in the format written by SmeMsgWriter from source
+ * fd and writes them unchanged to destination fd. Only size and layout
+ * are read into memory to find where each message ends; message data is
+ * moved with splice() through a pipe where available. When destination
+ * cannot take more data, nothing more is read from source.
+ * 
+ * Both fds should be non-blocking and not used by anything else.
+ */
+
+typedef struct _SmeRelay SmeRelay;
+
+typedef enum
+{
+	SME_RELAY_WAIT_READ,
+	SME_RELAY_WAIT_WRITE,
+	SME_RELAY_CLOSED,
+	SME_RELAY_ERROR
+} SmeRelayStatus;
+
+mdsl_rc_declare(SmeRelay, sme_relay);
+
+//Returns NULL with errno set if the pipe for splice() cannot be created,
+//e.g. when out of file descriptors.
+SmeRelay *sme_relay_new(int src_fd, int dst_fd);
+
+//Moves data until source or destination would block.
+//Returns what the relay is waiting for.
+SmeRelayStatus sme_relay_run(SmeRelay *relay);
+
+//Messages carry CRC32C trailers, see sme_msg_writer_set_crc().
+//Trailers are forwarded unchecked. Must agree with the writer, 
+//otherwise the relay loses track of message boundaries.
+void sme_relay_set_crc(SmeRelay *relay, int enabled);
+
+//Size and layout of a message are held in memory while it is forwarded.
+//A message whose size and layout take more than max_size bytes fails 
+//the relay before anything is allocated for it.
+#define SME_RELAY_DEFAULT_MAX_HEADER (1 << 20)
+
+void sme_relay_set_max_header(SmeRelay *relay, size_t max_size);
+
+uint64_t sme_relay_get_n_msgs(SmeRelay *relay);
+
+uint64_t sme_relay_get_n_bytes(SmeRelay *relay);
+
@@ -0,0 +1,352 @@
+/* timer_wheel.c
+ * Hierarchical timer wheel
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "incl.h"
+
+#define SLOT_MASK (SME_TIMER_WHEEL_SLOTS - 1)
+
+//Number of ticks spanned by all levels
+#define WHEEL_RANGE \
+	((uint64_t) 1 << (SME_TIMER_WHEEL_BITS * SME_TIMER_WHEEL_LEVELS))
+
+struct _SmeTimerWheel
+{
+	MdslRC parent;
+
+	uint64_t tick_ns;
+	uint64_t now_tick;
+	int n_timers;
+
+	//Slots are circular lists with these as heads
+	SmeTimer slots[SME_TIMER_WHEEL_LEVELS][SME_TIMER_WHEEL_SLOTS];
+
+	//Watcher is one-shot, set for the next tick with work, 0 if stopped
+	struct ev_loop *loop;
+	ev_timer watcher;
+	uint64_t armed_tick;
+};
+
+//Timers
+
+void sme_timer_init
+	(SmeTimer *timer, void (*cb)(SmeTimer *timer, void *data), void *data)
+{
+	timer->next = timer->prev = NULL;
+	timer->tick = 0;
+	timer->cb = cb;
+	timer->data = data;
+}
+
+static void sme_timer_list_init(SmeTimer *head)
+{
+	head->next = head->prev = head;
+}
+
+static void sme_timer_list_append(SmeTimer *head, SmeTimer *timer)
+{
+	timer->prev = head->prev;
+	timer->next = head;
+	head->prev->next = timer;
+	head->prev = timer;
+}
+
+static void sme_timer_list_unlink(SmeTimer *timer)
+{
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = timer->prev = NULL;
+}
+
+//Moves all timers from one list to another, empty one
+static void sme_timer_list_move(SmeTimer *from, SmeTimer *to)
+{
+	if (from->next == from)
+	{
+		sme_timer_list_init(to);
+		return;
+	}
+
+	to->next = from->next;
+	to->prev = from->prev;
+	to->next->prev = to;
+	to->prev->next = to;
+	sme_timer_list_init(from);
+}
+
+//Wheel
+
+mdsl_rc_define(SmeTimerWheel, sme_timer_wheel);
+
+static void sme_timer_wheel_destroy(SmeTimerWheel *wheel)
+{
+	int i, j;
+	SmeTimer *head;
+
+	if (wheel->loop)
+		ev_timer_stop(wheel->loop, &(wheel->watcher));
+
+	//Leave remaining timers inactive
+	for (i = 0; i < SME_TIMER_WHEEL_LEVELS; i++)
+	{
+		for (j = 0; j < SME_TIMER_WHEEL_SLOTS; j++)
+		{
+			head = &(wheel->slots[i][j]);
+			while (head->next != head)
+				sme_timer_list_unlink(head->next);
+		}
+	}
+
+	free(wheel);
+}
+
+static void sme_timer_wheel_cb(EV_P_ ev_timer *w, int revents)
+{
+	SmeTimerWheel *wheel = w->data;
+
+	sme_timer_wheel_advance(wheel, sme_latency_now());
+}
+
+SmeTimerWheel *sme_timer_wheel_new(struct ev_loop *loop, uint64_t tick_ns)
+{
+	SmeTimerWheel *wheel;
+	int i, j;
+
+	sme_assert(tick_ns > 0, "Tick must be positive");
+
+	wheel = (SmeTimerWheel *) mdsl_alloc(sizeof(SmeTimerWheel));
+
+	mdsl_rc_init(wheel);
+
+	wheel->tick_ns = tick_ns;
+	wheel->now_tick = sme_latency_now() / tick_ns;
+	wheel->n_timers = 0;
+	for (i = 0; i < SME_TIMER_WHEEL_LEVELS; i++)
+		for (j = 0; j < SME_TIMER_WHEEL_SLOTS; j++)
+			sme_timer_list_init(&(wheel->slots[i][j]));
+
+	wheel->loop = loop;
+	ev_timer_init(&(wheel->watcher), sme_timer_wheel_cb, 0.0, 0.0);
+	wheel->watcher.data = wheel;
+	wheel->armed_tick = 0;
+
+	return wheel;
+}
+
+//Files timer into a slot according to its distance from now.
+//Timers due before min_tick are filed at min_tick.
+static void sme_timer_wheel_file
+	(SmeTimerWheel *wheel, SmeTimer *timer, uint64_t min_tick)
+{
+	uint64_t tick = timer->tick;
+	uint64_t delta;
+	int level;
+
+	if (tick < min_tick)
+		tick = min_tick;
+
+	//Too far away, park at the furthest slot and refile when reached
+	delta = tick - wheel->now_tick;
+	if (delta >= WHEEL_RANGE)
+	{
+		tick = wheel->now_tick + WHEEL_RANGE - 1;
+		delta = WHEEL_RANGE - 1;
+	}
+
+	for (level = 0; level < SME_TIMER_WHEEL_LEVELS - 1; level++)
+	{
+		if (delta < ((uint64_t) 1 << (SME_TIMER_WHEEL_BITS * (level + 1))))
+			break;
+	}
+
+	sme_timer_list_append
+		(&(wheel->slots[level]
+		   [(tick >> (SME_TIMER_WHEEL_BITS * level)) & SLOT_MASK]), 
+		 timer);
+}
+
+//Earliest tick after now that has timers to run in level 0, or a slot
+//of a higher level with timers to move down. Wheel must have timers.
+static uint64_t sme_timer_wheel_next_tick(SmeTimerWheel *wheel)
+{
+	uint64_t next = UINT64_MAX, base, tick;
+	SmeTimer *head;
+	int level, shift, k;
+
+	for (level = 0; level < SME_TIMER_WHEEL_LEVELS; level++)
+	{
+		//Slot k steps ahead is reached when the level below wraps
+		shift = SME_TIMER_WHEEL_BITS * level;
+		base = wheel->now_tick >> shift;
+		for (k = 1; k <= SME_TIMER_WHEEL_SLOTS; k++)
+		{
+			head = &(wheel->slots[level][(base + k) & SLOT_MASK]);
+			if (head->next != head)
+				break;
+		}
+		if (k > SME_TIMER_WHEEL_SLOTS)
+			continue;
+
+		tick = (base + k) << shift;
+		if (tick < next)
+			next = tick;
+	}
+
+	return next;
+}
+
+//Sets the loop watcher to fire at the start of given tick
+static void sme_timer_wheel_arm(SmeTimerWheel *wheel, uint64_t tick)
+{
+	uint64_t at = tick * wheel->tick_ns;
+	uint64_t now = sme_latency_now();
+
+	ev_timer_stop(wheel->loop, &(wheel->watcher));
+	ev_timer_set(&(wheel->watcher), 
+			at > now ? (ev_tstamp) (at - now) / 1e9 : 0.0, 0.0);
+	ev_timer_start(wheel->loop, &(wheel->watcher));
+	wheel->armed_tick = tick;
+}
+
+void sme_timer_wheel_add(SmeTimerWheel *wheel, SmeTimer *timer, uint64_t expiry)
+{
+	uint64_t tick;
+
+	sme_assert(! sme_timer_is_active(timer), "Timer is already added");
+
+	//Time has passed while the wheel was idle
+	if (wheel->loop && wheel->n_timers == 0)
+		wheel->now_tick = sme_latency_now() / wheel->tick_ns;
+
+	//Round up to a tick
+	timer->tick = (expiry + wheel->tick_ns - 1) / wheel->tick_ns;
+
+	//Expired timers run on the next tick
+	sme_timer_wheel_file(wheel, timer, wheel->now_tick + 1);
+
+	wheel->n_timers++;
+
+	//Advancing at the timer's tick also moves it down if needed
+	tick = timer->tick > wheel->now_tick ? timer->tick : wheel->now_tick + 1;
+	if (wheel->loop && (! wheel->armed_tick || tick < wheel->armed_tick))
+		sme_timer_wheel_arm(wheel, tick);
+}
+
+void sme_timer_wheel_remove(SmeTimerWheel *wheel, SmeTimer *timer)
+{
+	if (! sme_timer_is_active(timer))
+		return;
+
+	sme_timer_list_unlink(timer);
+	wheel->n_timers--;
+}
+
+//Moves timers of the current slot of given level to lower levels.
+//Timers due now go to the level 0 slot that is about to run.
+static void sme_timer_wheel_cascade(SmeTimerWheel *wheel, int level)
+{
+	int idx;
+	SmeTimer list[1];
+
+	idx = (wheel->now_tick >> (SME_TIMER_WHEEL_BITS * level)) & SLOT_MASK;
+	if (idx == 0 && level + 1 < SME_TIMER_WHEEL_LEVELS)
+		sme_timer_wheel_cascade(wheel, level + 1);
+
+	sme_timer_list_move(&(wheel->slots[level][idx]), list);
+	while (list->next != list)
+	{
+		SmeTimer *timer = list->next;
+		sme_timer_list_unlink(timer);
+		sme_timer_wheel_file(wheel, timer, wheel->now_tick);
+	}
+}
+
+void sme_timer_wheel_advance(SmeTimerWheel *wheel, uint64_t now)
+{
+	uint64_t target = now / wheel->tick_ns;
+	uint64_t next;
+	SmeTimer list[1];
+
+	sme_timer_wheel_ref(wheel);
+
+	while (wheel->now_tick < target)
+	{
+		//Nothing to run, skip ahead
+		if (wheel->n_timers == 0)
+		{
+			wheel->now_tick = target;
+			break;
+		}
+
+		//Ticks skipped have empty slots on every level. A single tick
+		//is just taken, as when the wheel is advanced every tick.
+		next = wheel->now_tick + 1;
+		if (next < target)
+			next = sme_timer_wheel_next_tick(wheel);
+		if (next > target)
+		{
+			wheel->now_tick = target;
+			break;
+		}
+
+		wheel->now_tick = next;
+		if ((wheel->now_tick & SLOT_MASK) == 0)
+			sme_timer_wheel_cascade(wheel, 1);
+
+		//Run expired timers, callbacks may add or remove timers
+		sme_timer_list_move
+			(&(wheel->slots[0][wheel->now_tick & SLOT_MASK]), list);
+		while (list->next != list)
+		{
+			SmeTimer *timer = list->next;
+			sme_timer_list_unlink(timer);
+			wheel->n_timers--;
+			(* timer->cb)(timer, timer->data);
+		}
+	}
+
+	if (wheel->loop)
+	{
+		if (wheel->n_timers == 0)
+		{
+			ev_timer_stop(wheel->loop, &(wheel->watcher));
+			wheel->armed_tick = 0;
+		}
+		else
+		{
+			sme_timer_wheel_arm(wheel, sme_timer_wheel_next_tick(wheel));
+		}
+	}
+
+	sme_timer_wheel_unref(wheel);
+}
+
+int sme_timer_wheel_get_n_timers(SmeTimerWheel *wheel)
+{
+	return wheel->n_timers;
+}
+
+uint64_t sme_timer_wheel_get_next_time(SmeTimerWheel *wheel)
+{
+	if (wheel->n_timers == 0)
+		return 0;
+
+	return sme_timer_wheel_next_tick(wheel) * wheel->tick_ns;
+}
+
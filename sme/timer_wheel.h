@@ -0,0 +1,79 @@
+/* timer_wheel.h
+ * Hierarchical timer wheel
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Timers are kept in SME_TIMER_WHEEL_LEVELS levels of 
+ * SME_TIMER_WHEEL_SLOTS slots each. Level n slots span 
+ * SME_TIMER_WHEEL_SLOTS^n ticks; timers move down a level when the 
+ * level above wraps. Adding and removing timers is O(1). Timers further 
+ * away than the wheel spans are parked in the last level and re-filed 
+ * when reached.
+ * 
+ * Times are in nanoseconds of sme_latency_now() clock. Timers fire on 
+ * the first tick at or after their expiry. Advancing jumps straight to 
+ * the next tick that has timers to run or move down, so a long stall 
+ * costs no more than the timers it crosses, and the loop watcher is set
+ * for that tick instead of firing every tick.
+ */
+
+#define SME_TIMER_WHEEL_BITS 6
+#define SME_TIMER_WHEEL_SLOTS (1 << SME_TIMER_WHEEL_BITS)
+#define SME_TIMER_WHEEL_LEVELS 4
+
+typedef struct _SmeTimer SmeTimer;
+
+//Timer, to be embedded in user's structure. 
+//Must not be moved while it is added.
+struct _SmeTimer
+{
+	SmeTimer *next, *prev;
+	uint64_t tick;
+
+	void (*cb)(SmeTimer *timer, void *data);
+	void *data;
+};
+
+void sme_timer_init
+	(SmeTimer *timer, void (*cb)(SmeTimer *timer, void *data), void *data);
+
+static inline int sme_timer_is_active(SmeTimer *timer)
+{
+	return timer->next ? 1 : 0;
+}
+
+typedef struct _SmeTimerWheel SmeTimerWheel;
+
+mdsl_rc_declare(SmeTimerWheel, sme_timer_wheel);
+
+//Loop may be NULL, then the wheel has to be advanced manually.
+SmeTimerWheel *sme_timer_wheel_new(struct ev_loop *loop, uint64_t tick_ns);
+
+void sme_timer_wheel_add(SmeTimerWheel *wheel, SmeTimer *timer, uint64_t expiry);
+
+void sme_timer_wheel_remove(SmeTimerWheel *wheel, SmeTimer *timer);
+
+//Runs all timers that expire at or before given time
+void sme_timer_wheel_advance(SmeTimerWheel *wheel, uint64_t now);
+
+int sme_timer_wheel_get_n_timers(SmeTimerWheel *wheel);
+
+//Start of the next tick the wheel has to be advanced at, for driving it
+//from another event loop. Returns 0 if there are no timers.
+uint64_t sme_timer_wheel_get_next_time(SmeTimerWheel *wheel);
+
@@ -0,0 +1,94 @@
+/* bench_crc32c.c
+ * Microbenchmark for CRC32C implementations
+ *
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ *
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sme/incl.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define bench_cycles() ((uint64_t) __rdtsc())
+#define BENCH_HAVE_CYCLES 1
+#else
+#define bench_cycles() ((uint64_t) 0)
+#define BENCH_HAVE_CYCLES 0
+#endif
+
+//Minimum number of bytes to checksum per measurement
+#define MIN_BYTES (256 * 1024 * 1024)
+
+typedef uint32_t (*CrcFn)(uint32_t crc, const void *data, size_t len);
+
+static uint64_t bench_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void bench_crc(const char *name, CrcFn fn, char *buf, size_t len)
+{
+	uint64_t ns, cycles;
+	uint32_t crc = 0;
+	long reps, r;
+
+	reps = MIN_BYTES / len;
+	if (reps < 1)
+		reps = 1;
+
+	ns = bench_ns();
+	cycles = bench_cycles();
+	for (r = 0; r < reps; r++)
+		crc = (*fn)(crc, buf, len);
+	cycles = bench_cycles() - cycles;
+	ns = bench_ns() - ns;
+
+	printf("%-4s len=%-8zu %8.3f ns/byte %8.2f GB/s", name, len,
+			(double) ns / (reps * len), (double) (reps * len) / ns);
+	if (BENCH_HAVE_CYCLES)
+		printf(" %8.3f cycles/byte", (double) cycles / (reps * len));
+	else
+		printf("      n/a cycles/byte");
+	printf(" (crc %08" PRIx32 ")\n", crc);
+}
+
+int main()
+{
+	static const size_t lens[] = {16, 64, 256, 4096, 65536, 1048576};
+	char *buf;
+	int i;
+
+	buf = mdsl_alloc(lens[sizeof(lens) / sizeof(lens[0]) - 1]);
+	for (i = 0; i < lens[sizeof(lens) / sizeof(lens[0]) - 1]; i++)
+		buf[i] = (char) i;
+
+	printf("Hardware CRC32C: %s\n", sme_crc32c_is_hw() ? "yes" : "no");
+
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++)
+	{
+		bench_crc("best", sme_crc32c_update, buf, lens[i]);
+		bench_crc("sw", sme_crc32c_update_sw, buf, lens[i]);
+	}
+
+	free(buf);
+
+	return 0;
+}
@@ -0,0 +1,138 @@
+/* bench_inline.c
+ * Benchmark for copying small blocks into the message preamble
+ *
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ *
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sme/incl.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/*
+ * Messages of a ROOT_SIZE byte root block with a number of SUB_SIZE byte
+ * submessages are written through a SmeFdChannel on a socket pair, whose
+ * other end is drained with plain read(). Batches of BATCH messages are
+ * queued before writing, so that writev() sees many messages at once.
+ */
+
+#define ROOT_SIZE 64
+#define SUB_SIZE 16
+#define BATCH 64
+
+//Minimum number of messages per measurement
+#define MIN_MSGS 200000
+
+static char drain_buf[1 << 16];
+
+static uint64_t bench_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static MmcMsg *create_msg(int n_subs)
+{
+	MmcMsg *msg = mmc_msg_newa(ROOT_SIZE, n_subs);
+	int i;
+
+	memset(msg->mem, 'r', ROOT_SIZE);
+	for (i = 0; i < n_subs; i++)
+	{
+		msg->submsgs[i] = mmc_msg_newa(SUB_SIZE, 0);
+		memset(msg->submsgs[i]->mem, 'a' + i % 26, SUB_SIZE);
+	}
+
+	return msg;
+}
+
+static void bench_inline(int n_subs, size_t threshold)
+{
+	int fds[2];
+	SmeFdChannel *channel;
+	SmeMsgWriter *writer;
+	SmeChannelStats stats;
+	MmcMsg *msg;
+	uint64_t ns;
+	long n_msgs, i;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		sme_error("socketpair() failed");
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	channel = sme_fd_channel_new(fds[0]);
+	writer = sme_msg_writer_new((SmeChannel *) channel);
+	msg = create_msg(n_subs);
+
+	ns = bench_ns();
+	for (n_msgs = 0; n_msgs < MIN_MSGS; n_msgs += BATCH)
+	{
+		//Encoding is part of what is measured
+		for (i = 0; i < BATCH; i++)
+		{
+			SmePreparedMsg *prepared = sme_prepared_msg_new_inline
+				(msg, threshold);
+			sme_msg_writer_add_prepared(writer, prepared);
+			sme_prepared_msg_unref(prepared);
+		}
+
+		while (sme_fd_channel_get_write_queue_len(channel) > 0)
+		{
+			sme_channel_write((SmeChannel *) channel);
+			while (read(fds[1], drain_buf, sizeof(drain_buf)) > 0)
+				;
+		}
+	}
+	ns = bench_ns() - ns;
+
+	sme_channel_get_stats((SmeChannel *) channel, &stats);
+	printf("subs=%-3d threshold=%-4zu %8.2f iovecs/msg %8.2f iovecs/syscall"
+			" %8.3f syscalls/msg %8.1f ns/msg\n",
+			n_subs, threshold, 
+			(double) stats.write.n_iovecs / n_msgs,
+			(double) stats.write.n_iovecs / stats.write.n_syscalls,
+			(double) stats.write.n_syscalls / n_msgs,
+			(double) ns / n_msgs);
+
+	mmc_msg_unref(msg);
+	sme_msg_writer_unref(writer);
+	sme_channel_unref((SmeChannel *) channel);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int main()
+{
+	static const int subs[] = {0, 1, 4, 16, 64};
+	int i;
+
+	printf("Root block: %d bytes, submessage blocks: %d bytes, "
+			"batch: %d messages\n", ROOT_SIZE, SUB_SIZE, BATCH);
+
+	for (i = 0; i < sizeof(subs) / sizeof(subs[0]); i++)
+	{
+		bench_inline(subs[i], 0);
+		bench_inline(subs[i], SME_MSG_INLINE_THRESHOLD);
+	}
+
+	return 0;
+}
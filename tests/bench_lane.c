@@ -0,0 +1,250 @@
+/* bench_lane.c
+ * Microbenchmark for channel lane queue operations
+ *
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ *
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sme/incl.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define bench_cycles() ((uint64_t) __rdtsc())
+#define BENCH_HAVE_CYCLES 1
+#else
+#define bench_cycles() ((uint64_t) 0)
+#define BENCH_HAVE_CYCLES 0
+#endif
+
+#define assert_equals_int(_a, _b) \
+	do {\
+		int64_t a = (_a); \
+		int64_t b = (_b); \
+		if (a != b) \
+		{ \
+			sme_error("Assertion failed a == b (a = %" PRId64 ", " \
+					"b = %" PRId64 ")", \
+					a, b); \
+		} \
+	} while (0)
+
+/*
+ * Every job pushed into the lane has BLOCKS_PER_JOB blocks of BLOCK_SIZE
+ * bytes. Mock IO functions never touch the memory, so what gets measured
+ * is the cost of the lane bookkeeping alone.
+ */
+
+#define BLOCK_SIZE 64
+#define BLOCKS_PER_JOB 2
+
+//Minimum number of jobs to run through a lane per measurement
+#define MIN_OPS 200000
+
+static char block_mem[BLOCK_SIZE];
+
+//Partial IO patterns
+typedef enum
+{
+	PATTERN_FULL,
+	PATTERN_HALF,
+	PATTERN_SPLIT,
+	PATTERN_COUNT
+} Pattern;
+
+static const char *pattern_names[PATTERN_COUNT] =
+{
+	"full",
+	"half",
+	"split"
+};
+
+static Pattern mock_pattern;
+
+//Mock vector IO function: accepts a number of bytes depending on pattern
+static ssize_t mock_io_vec(int fd, struct iovec *iov, size_t iov_len)
+{
+	size_t i;
+	size_t offered = 0;
+	size_t limit = SIZE_MAX;
+
+	//One and a half blocks for split pattern, so that every other call
+	//leaves a block partially done
+	if (mock_pattern == PATTERN_SPLIT)
+		limit = BLOCK_SIZE + BLOCK_SIZE / 2;
+
+	//Stop counting at limit so that mock cost does not depend on depth
+	for (i = 0; i < iov_len && offered < limit; i++)
+		offered += iov[i].iov_len;
+	if (offered > limit)
+		offered = limit;
+
+	//Half of what is offered, rounded up
+	if (mock_pattern == PATTERN_HALF)
+		offered = (offered + 1) / 2;
+
+	return offered;
+}
+
+//Mock job source
+static long completed_jobs;
+
+static void bench_notify(void *source_ptr, int n_jobs)
+{
+	completed_jobs += n_jobs;
+}
+
+//Timing
+static uint64_t bench_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+typedef struct
+{
+	uint64_t ns;
+	uint64_t cycles;
+	long ops;
+	long calls;
+} BenchResult;
+
+static void bench_result_add
+	(BenchResult *res, uint64_t ns, uint64_t cycles, long ops)
+{
+	res->ns += ns;
+	res->cycles += cycles;
+	res->ops += ops;
+}
+
+static void bench_result_print
+	(const char *dir, const char *phase, int depth, Pattern pattern,
+	 BenchResult *res)
+{
+	double ns_per_op = (double) res->ns / res->ops;
+
+	printf("%-5s %-5s depth=%-6d pattern=%-5s %10.2f ns/op",
+			dir, phase, depth, pattern_names[pattern], ns_per_op);
+	if (BENCH_HAVE_CYCLES)
+		printf(" %10.2f cycles/op", (double) res->cycles / res->ops);
+	else
+		printf("        n/a cycles/op");
+	if (res->calls)
+		printf(" %8.2f jobs/call", (double) res->ops / res->calls);
+	printf("\n");
+}
+
+//Runs one configuration on either write or read lane
+static void bench_lane(int write, int depth, Pattern pattern)
+{
+	BenchResult add_res = {0, 0, 0, 0}, io_res = {0, 0, 0, 0};
+	SscMBlock blocks[BLOCKS_PER_JOB];
+	SmeJobSource js;
+	SmeFdChannel *channel;
+	int reps, r, i;
+
+	for (i = 0; i < BLOCKS_PER_JOB; i++)
+	{
+		blocks[i].mem = block_mem;
+		blocks[i].len = BLOCK_SIZE;
+	}
+
+	channel = sme_fd_channel_new(-1);
+	js.source_ptr = NULL;
+	js.notify = bench_notify;
+	js.progress = NULL;
+	if (write)
+		sme_channel_set_write_source((SmeChannel *) channel, js);
+	else
+		sme_channel_set_read_source((SmeChannel *) channel, js);
+
+	mock_pattern = pattern;
+	reps = MIN_OPS / depth;
+	if (reps < 1)
+		reps = 1;
+
+	for (r = 0; r < reps; r++)
+	{
+		uint64_t ns, cycles;
+
+		completed_jobs = 0;
+
+		//Fill the lane to given depth
+		ns = bench_ns();
+		cycles = bench_cycles();
+		for (i = 0; i < depth; i++)
+		{
+			if (write)
+				sme_channel_add_write_job
+					((SmeChannel *) channel, blocks, BLOCKS_PER_JOB);
+			else
+				sme_channel_add_read_job
+					((SmeChannel *) channel, blocks, BLOCKS_PER_JOB);
+		}
+		cycles = bench_cycles() - cycles;
+		ns = bench_ns() - ns;
+		bench_result_add(&add_res, ns, cycles, depth);
+
+		//Drain the lane
+		ns = bench_ns();
+		cycles = bench_cycles();
+		while (completed_jobs < depth)
+		{
+			if (write)
+				sme_fd_channel_test_write(channel, mock_io_vec);
+			else
+				sme_fd_channel_test_read(channel, mock_io_vec);
+			io_res.calls++;
+		}
+		cycles = bench_cycles() - cycles;
+		ns = bench_ns() - ns;
+		bench_result_add(&io_res, ns, cycles, depth);
+
+		assert_equals_int(completed_jobs, depth);
+		if (write)
+			assert_equals_int
+				(sme_fd_channel_get_write_queue_len(channel), 0);
+		else
+			assert_equals_int
+				(sme_fd_channel_get_read_queue_len(channel), 0);
+	}
+
+	bench_result_print(write ? "write" : "read", "add", depth, pattern,
+			&add_res);
+	bench_result_print(write ? "write" : "read", "io", depth, pattern,
+			&io_res);
+
+	sme_channel_unref((SmeChannel *) channel);
+}
+
+int main()
+{
+	static const int depths[] = {1, 10, 100, 1000, 10000, 100000};
+	int d, p, write;
+
+	printf("Block size: %d bytes, blocks per job: %d\n",
+			BLOCK_SIZE, BLOCKS_PER_JOB);
+
+	for (write = 1; write >= 0; write--)
+		for (d = 0; d < sizeof(depths) / sizeof(depths[0]); d++)
+			for (p = 0; p < PATTERN_COUNT; p++)
+				bench_lane(write, depths[d], p);
+
+	return 0;
+}
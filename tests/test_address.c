@@ -0,0 +1,190 @@
+/* test_address.c
+ * Unit test for address.c
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sme/sme.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#define assert_equals_int(a, b) \
+	do {\
+		int64_t _a = (a); \
+		int64_t _b = (b); \
+		if (_a != _b) \
+		{ \
+			sme_error("Assertion failed a == b (a = %" PRId64 ", " \
+					"b = %" PRId64 ")", \
+					_a, _b); \
+		} \
+	} while (0)
+
+#define N_LINKS 8
+#define N_ROUTES 1000
+
+//Mock link that remembers last sent message
+typedef struct
+{
+	SmeLink parent;
+	MmcMsg *sent;
+	int n_sent;
+} MockLink;
+
+void mock_link_send(SmeLink *base_type, MmcMsg *msg)
+{
+	MockLink *link = (MockLink *) base_type;
+
+	link->sent = msg;
+	link->n_sent++;
+}
+
+void mock_link_destroy(SmeLink *base_type)
+{
+	sme_link_cleanup(base_type);
+}
+
+void mock_link_init(MockLink *link)
+{
+	sme_link_init((SmeLink *) link);
+	link->parent.destroy = mock_link_destroy;
+	link->parent.send = mock_link_send;
+	link->sent = NULL;
+	link->n_sent = 0;
+}
+
+int main()
+{
+	MockLink links[N_LINKS];
+	SmeRouter *router, *other;
+	uint32_t addr[SME_ADDRESS_MAX_LEN];
+	MmcMsg *msg;
+	int i;
+
+	router = sme_router_new();
+	for (i = 0; i < N_LINKS; i++)
+	{
+		mock_link_init(links + i);
+		sme_link_set_router((SmeLink *) (links + i), router);
+	}
+
+	//Address encoding
+	addr[0] = 1; addr[1] = 2; addr[2] = 0xdeadbeef;
+	msg = sme_address_msg_new(addr, 3, 0);
+	memset(addr, 0, sizeof(addr));
+	assert_equals_int(sme_address_from_msg(msg, addr), 3);
+	assert_equals_int(addr[2], 0xdeadbeef);
+	mmc_msg_unref(msg);
+
+	//Longest prefix match
+	addr[0] = 1;
+	sme_router_add_route(router, addr, 1, (SmeLink *) (links + 0));
+	addr[1] = 2;
+	sme_router_add_route(router, addr, 2, (SmeLink *) (links + 1));
+	addr[2] = 3;
+	assert_equals_int((intptr_t) sme_router_lookup(router, addr, 3),
+			(intptr_t) (links + 1));
+	addr[1] = 5;
+	assert_equals_int((intptr_t) sme_router_lookup(router, addr, 3),
+			(intptr_t) (links + 0));
+	addr[0] = 7;
+	assert_equals_int((intptr_t) sme_router_lookup(router, addr, 3), 0);
+
+	//Many routes, enough to resize the table
+	for (i = 0; i < N_ROUTES; i++)
+	{
+		addr[0] = 100;
+		addr[1] = i;
+		sme_router_add_route(router, addr, 2, 
+				(SmeLink *) (links + 2 + (i % 3)));
+	}
+	for (i = 0; i < N_ROUTES; i++)
+	{
+		addr[0] = 100;
+		addr[1] = i;
+		addr[2] = 42;
+		assert_equals_int((intptr_t) sme_router_lookup(router, addr, 3),
+				(intptr_t) (links + 2 + (i % 3)));
+	}
+
+	//Removing one link keeps others intact
+	sme_router_remove_link(router, (SmeLink *) (links + 3));
+	for (i = 0; i < N_ROUTES; i++)
+	{
+		SmeLink *expected = (SmeLink *) (links + 2 + (i % 3));
+		if (i % 3 == 1)
+			expected = NULL;
+		addr[0] = 100;
+		addr[1] = i;
+		assert_equals_int((intptr_t) sme_router_lookup(router, addr, 2),
+				(intptr_t) expected);
+	}
+
+	//Removing a single route
+	addr[0] = 1;
+	addr[1] = 2;
+	assert_equals_int(sme_router_remove_route(router, addr, 2), 1);
+	assert_equals_int(sme_router_remove_route(router, addr, 2), 0);
+	assert_equals_int((intptr_t) sme_router_lookup(router, addr, 2),
+			(intptr_t) (links + 0));
+
+	//Forwarding received messages by reference
+	addr[0] = 100;
+	addr[1] = 5;
+	msg = sme_address_msg_new(addr, 2, 1);
+	msg->submsgs[0] = mmc_msg_newa(3, 0);
+	mmc_msg_ref(msg);
+	sme_link_receive((SmeLink *) (links + 7), msg);
+	assert_equals_int(links[4].n_sent, 1);
+	assert_equals_int((intptr_t) links[4].sent, (intptr_t) msg);
+	mmc_msg_unref(msg);
+
+	//Unroutable message is dropped
+	addr[0] = 99;
+	msg = sme_address_msg_new(addr, 1, 0);
+	sme_link_receive((SmeLink *) (links + 7), msg);
+	assert_equals_int(sme_router_get_n_dropped(router), 1);
+
+	//Routes in other routers are removed when link is destroyed
+	other = sme_router_new();
+	addr[0] = 200;
+	sme_router_add_route(other, addr, 1, (SmeLink *) (links + 5));
+	addr[1] = 1;
+	sme_router_add_route(other, addr, 2, (SmeLink *) (links + 5));
+	sme_router_add_route(other, addr, 2, (SmeLink *) (links + 6));
+	sme_router_add_route(router, addr, 2, (SmeLink *) (links + 5));
+	//Replacing a route with the same link keeps a single entry
+	for (i = 0; i < N_ROUTES; i++)
+		sme_router_add_route(other, addr, 2, (SmeLink *) (links + 6));
+	assert_equals_int(links[5].parent.n_dest_routers, 2);
+	assert_equals_int(links[6].parent.n_dest_routers, 1);
+	sme_link_cleanup((SmeLink *) (links + 5));
+	assert_equals_int((intptr_t) sme_router_lookup(other, addr, 1), 0);
+	assert_equals_int((intptr_t) sme_router_lookup(other, addr, 2),
+			(intptr_t) (links + 6));
+	assert_equals_int((intptr_t) sme_router_lookup(router, addr, 2), 0);
+
+	//Router destroyed before the link
+	sme_router_unref(other);
+	assert_equals_int(links[6].parent.n_dest_routers, 0);
+
+	for (i = 0; i < N_LINKS; i++)
+		sme_link_cleanup((SmeLink *) (links + i));
+	sme_router_unref(router);
+
+	return 0;
+}
@@ -0,0 +1,230 @@
+/* test_busy_poll.c
+ * Unit test for busy polling in fd_channel.c
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sme/sme.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+
+#define assert_equals_int(a, b) \
+	do {\
+		int64_t _a = (a); \
+		int64_t _b = (b); \
+		if (_a != _b) \
+		{ \
+			sme_error("Assertion failed a == b (a = %" PRId64 ", " \
+					"b = %" PRId64 ")", \
+					_a, _b); \
+		} \
+	} while (0)
+
+#define BUDGET 200000
+#define N_MSGS 8
+#define FLOOD_BATCH 1000
+
+MmcMsg *recvd[N_MSGS];
+int n_recvd;
+
+void test_notify_call(MmcMsg *msg, void *data)
+{
+	sme_assert(n_recvd < N_MSGS, "Capacity exceeded");
+	recvd[n_recvd++] = msg;
+}
+
+//Peer that keeps sending messages until stopped
+typedef struct
+{
+	int fd;
+	void *data;
+	size_t len;
+	atomic_int stop;
+} Flood;
+
+void *flood_thread(void *data)
+{
+	Flood *flood = data;
+
+	while (! atomic_load(&(flood->stop)))
+	{
+		if (send(flood->fd, flood->data, flood->len, MSG_NOSIGNAL) < 0)
+			break;
+	}
+
+	return NULL;
+}
+
+int n_flood_recvd;
+
+void flood_notify_call(MmcMsg *msg, void *data)
+{
+	n_flood_recvd++;
+	mmc_msg_unref(msg);
+}
+
+//Read returns after the budget even though data never runs out
+void testcase_flood()
+{
+	int fds[2];
+	SmeFdChannel *rch;
+	SmeMsgReader *reader;
+	SmeMsgReaderNotify notify = {flood_notify_call, NULL};
+	MmcMsg *msg;
+	SmePreparedMsg *prepared;
+	const SscMBlock *iov;
+	size_t n_iov, i, offset;
+	Flood flood;
+	pthread_t thread;
+	uint64_t start, elapsed;
+	ssize_t res;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		sme_error("socketpair() failed");
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	rch = sme_fd_channel_new(fds[1]);
+	assert_equals_int(sme_fd_channel_set_busy_poll(rch, BUDGET, 0), 0);
+	reader = sme_msg_reader_new((SmeChannel *) rch, notify);
+
+	//Batch of serialized messages, sent whole each time, so that the 
+	//peer sends faster than we read
+	msg = mmc_msg_newa(100, 0);
+	memset(msg->mem, 'f', 100);
+	prepared = sme_prepared_msg_new(msg);
+	flood.fd = fds[0];
+	flood.len = sme_prepared_msg_get_size(prepared) * FLOOD_BATCH;
+	flood.data = mdsl_alloc(flood.len);
+	iov = sme_prepared_msg_get_iov(prepared, 0, &n_iov);
+	for (offset = 0; offset < flood.len; )
+	{
+		for (i = 0; i < n_iov; i++)
+		{
+			memcpy((char *) flood.data + offset, iov[i].mem, iov[i].len);
+			offset += iov[i].len;
+		}
+	}
+	sme_prepared_msg_unref(prepared);
+	mmc_msg_unref(msg);
+	atomic_store(&(flood.stop), 0);
+
+	if (pthread_create(&thread, NULL, flood_thread, &flood) != 0)
+		sme_error("pthread_create() failed");
+
+	//Wait for the first data, then spin while the peer keeps sending
+	do
+	{
+		start = sme_latency_now();
+		res = sme_channel_read((SmeChannel *) rch);
+	} while (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+	elapsed = sme_latency_now() - start;
+	sme_assert(res > 0, "Read failed");
+	sme_assert(elapsed < 100 * BUDGET, 
+			"Busy polling took %d us", (int) (elapsed / 1000));
+	sme_assert(n_flood_recvd > 0, "Nothing received");
+
+	//Peer stops when the socket is closed
+	atomic_store(&(flood.stop), 1);
+	sme_msg_reader_unref(reader);
+	sme_channel_unref((SmeChannel *) rch);
+	close(fds[1]);
+	pthread_join(thread, NULL);
+	close(fds[0]);
+	free(flood.data);
+}
+
+int main()
+{
+	int fds[2];
+	SmeFdChannel *wch, *rch;
+	SmeMsgWriter *writer;
+	SmeMsgReader *reader;
+	SmeMsgReaderNotify notify = {test_notify_call, NULL};
+	MmcMsg *sent[N_MSGS];
+	uint64_t budget = BUDGET;
+	ssize_t res;
+	int i;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		sme_error("socketpair() failed");
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	wch = sme_fd_channel_new(fds[0]);
+	rch = sme_fd_channel_new(fds[1]);
+	assert_equals_int(sme_fd_channel_set_busy_poll(rch, BUDGET, 0), 0);
+	assert_equals_int(sme_fd_channel_get_busy_poll_budget(rch), BUDGET);
+
+	writer = sme_msg_writer_new((SmeChannel *) wch);
+	reader = sme_msg_reader_new((SmeChannel *) rch, notify);
+
+	for (i = 0; i < N_MSGS; i++)
+	{
+		sent[i] = mmc_msg_newa(100 + i, 0);
+		memset(sent[i]->mem, 'a' + i, 100 + i);
+		sme_msg_writer_add_msg(writer, sent[i]);
+		while (sme_fd_channel_get_write_queue_len(wch) > 0)
+			sme_channel_write((SmeChannel *) wch);
+
+		//One read gets the message, spinning afterwards finds nothing
+		res = sme_channel_read((SmeChannel *) rch);
+		sme_assert(res > 100, "Short read: %d", (int) res);
+		assert_equals_int(n_recvd, i + 1);
+
+		budget /= 2;
+		if (budget < BUDGET / SME_FD_CHANNEL_BUSY_POLL_RANGE)
+			budget = BUDGET / SME_FD_CHANNEL_BUSY_POLL_RANGE;
+		assert_equals_int(sme_fd_channel_get_busy_poll_budget(rch), budget);
+
+		//No data at all, no spinning
+		res = sme_channel_read((SmeChannel *) rch);
+		assert_equals_int(res, -1);
+		sme_assert(errno == EAGAIN || errno == EWOULDBLOCK, 
+				"Unexpected error %d", errno);
+		assert_equals_int(sme_fd_channel_get_busy_poll_budget(rch), budget);
+	}
+
+	for (i = 0; i < N_MSGS; i++)
+	{
+		assert_equals_int(sent[i]->mem_len, recvd[i]->mem_len);
+		if (memcmp(sent[i]->mem, recvd[i]->mem, sent[i]->mem_len) != 0)
+			sme_error("Unequal memory blocks");
+		mmc_msg_unref(sent[i]);
+		mmc_msg_unref(recvd[i]);
+	}
+
+	//Disabling
+	assert_equals_int(sme_fd_channel_set_busy_poll(rch, 0, 0), 0);
+	assert_equals_int(sme_fd_channel_get_busy_poll_budget(rch), 0);
+
+	sme_msg_reader_unref(reader);
+	sme_msg_writer_unref(writer);
+	sme_channel_unref((SmeChannel *) wch);
+	sme_channel_unref((SmeChannel *) rch);
+	close(fds[0]);
+	close(fds[1]);
+
+	testcase_flood();
+
+	return 0;
+}
@@ -21,6 +21,7 @@
 #include <sme/incl.h>
 #include <stdio.h>
 #include <inttypes.h>
+#include <errno.h>
 
 #define assert_equals_int(_a, _b) \
 	do {\
@@ -189,6 +190,7 @@ static void mock_job_source_init
 
 	jobsource->iface.source_ptr = jobsource;
 	jobsource->iface.notify = mock_job_source_notify;
+	jobsource->iface.progress = NULL;
 	if (write)
 		sme_channel_set_write_source(channel, jobsource->iface);
 	else
@@ -365,6 +367,14 @@ static void end_test_case(int io_size)
 #endif
 
 	int i;
+	SmeChannelStats stats;
+
+	//Statistics
+	sme_channel_get_stats((SmeChannel*) channel, &stats);
+	assert_equals_int(stats.write.n_bytes, io_size);
+	assert_equals_int(stats.read.n_bytes, io_size);
+	assert_equals_int(stats.write.n_jobs, write_source->completed_jobs);
+	assert_equals_int(stats.read.n_jobs, read_source->completed_jobs);
 
 	for (i = 0; i < io_size; i++)
 	{
@@ -379,6 +389,48 @@ static void end_test_case(int io_size)
 	sme_channel_unref((SmeChannel*) channel);
 }
 
+ssize_t mock_io_eagain(int fd, struct iovec *iov, size_t iov_len)
+{
+	errno = EAGAIN;
+	return -1;
+}
+
+//Statistics not covered by generated programs
+static void testcase_stats()
+{
+	SmeChannelStats stats;
+
+	start_test_case();
+
+	//Queue watermarks
+	op_add_seg(1);
+	op_add_seg(2);
+	op_commit_job();
+	op_add_seg(3);
+	op_commit_job();
+
+	//Partial, nothing, EAGAIN, then the rest
+	op_io(1);
+	op_io(0);
+	sme_fd_channel_test_write(channel, mock_io_eagain);
+	sme_fd_channel_test_read(channel, mock_io_eagain);
+	op_io(5);
+
+	sme_channel_get_stats((SmeChannel*) channel, &stats);
+	assert_equals_int(stats.write.n_syscalls, 4);
+	assert_equals_int(stats.write.n_partial, 1);
+	assert_equals_int(stats.write.n_eagain, 1);
+	assert_equals_int(stats.write.max_queue_len, 2);
+	assert_equals_int(stats.write.max_queue_bytes, 6);
+	assert_equals_int(stats.read.n_syscalls, 4);
+	assert_equals_int(stats.read.n_partial, 1);
+	assert_equals_int(stats.read.n_eagain, 1);
+	assert_equals_int(stats.read.max_queue_len, 2);
+	assert_equals_int(stats.read.max_queue_bytes, 6);
+
+	end_test_case(6);
+}
+
 int main()
 {
 	instruction_array_init(instruction_array);
@@ -448,5 +500,7 @@ int main()
 	free(program_array->data);
 	free(instruction_array->data);
 
+	testcase_stats();
+
 	return 0;
 }
@@ -0,0 +1,183 @@
+/* test_crc32c.c
+ * Unit test for crc32c.c and CRC trailers in msg.c
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sme/incl.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define assert_equals_int(a, b) \
+	do {\
+		int64_t _a = (a); \
+		int64_t _b = (b); \
+		if (_a != _b) \
+		{ \
+			sme_error("Assertion failed a == b (a = %" PRId64 ", " \
+					"b = %" PRId64 ")", \
+					_a, _b); \
+		} \
+	} while (0)
+
+#define BUF_SIZE 1000
+
+//Implementations against known values and each other
+void test_crc32c()
+{
+	unsigned char buf[BUF_SIZE];
+	uint32_t crc_hw, crc_sw;
+	int i, offset, len, split;
+
+	printf("Hardware CRC32C: %s\n", sme_crc32c_is_hw() ? "yes" : "no");
+
+	assert_equals_int(sme_crc32c("123456789", 9), 0xE3069283);
+	assert_equals_int(sme_crc32c_update_sw(0, "123456789", 9), 0xE3069283);
+	assert_equals_int(sme_crc32c("", 0), 0);
+
+	memset(buf, 0, 32);
+	assert_equals_int(sme_crc32c(buf, 32), 0x8A9136AA);
+
+	for (i = 0; i < BUF_SIZE; i++)
+		buf[i] = (unsigned char) (i * 31 + 7);
+
+	//All alignments and lengths, and incremental updates
+	for (offset = 0; offset < 8; offset++)
+	{
+		for (len = 0; len < 100; len++)
+		{
+			crc_hw = sme_crc32c(buf + offset, len);
+			crc_sw = sme_crc32c_update_sw(0, buf + offset, len);
+			assert_equals_int(crc_hw, crc_sw);
+
+			for (split = 0; split <= len; split += 7)
+			{
+				crc_sw = sme_crc32c_update(0, buf + offset, split);
+				crc_sw = sme_crc32c_update
+					(crc_sw, buf + offset + split, len - split);
+				assert_equals_int(crc_hw, crc_sw);
+			}
+		}
+	}
+	assert_equals_int(sme_crc32c(buf, BUF_SIZE), 
+			sme_crc32c_update_sw(0, buf, BUF_SIZE));
+}
+
+//CRC trailers
+MmcMsg *recvd;
+int n_recvd;
+
+void test_notify_call(MmcMsg *msg, void *data)
+{
+	if (recvd)
+		mmc_msg_unref(recvd);
+	recvd = msg;
+	n_recvd++;
+}
+
+//Sends msg through writer to reader, optionally flipping one byte
+void test_trailer(MmcMsg *msg, int corrupt_at)
+{
+	int in_fds[2], out_fds[2];
+	SmeFdChannel *wch, *rch;
+	SmeMsgWriter *writer;
+	SmeMsgReader *reader;
+	SmeMsgReaderNotify notify = {test_notify_call, NULL};
+	char buf[BUF_SIZE];
+	ssize_t len;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, in_fds) < 0
+		|| socketpair(AF_UNIX, SOCK_STREAM, 0, out_fds) < 0)
+		sme_error("socketpair() failed");
+	fcntl(out_fds[1], F_SETFL, O_NONBLOCK);
+
+	wch = sme_fd_channel_new(in_fds[0]);
+	rch = sme_fd_channel_new(out_fds[1]);
+	writer = sme_msg_writer_new((SmeChannel *) wch);
+	reader = sme_msg_reader_new((SmeChannel *) rch, notify);
+	sme_msg_writer_set_crc(writer, 1);
+	sme_msg_reader_set_crc(reader, 1);
+
+	//Same message twice, the checksum is computed once
+	sme_msg_writer_add_msg(writer, msg);
+	sme_msg_writer_add_msg(writer, msg);
+	while (sme_msg_writer_get_queue_len(writer) > 0)
+		sme_channel_write((SmeChannel *) wch);
+
+	len = read(in_fds[1], buf, BUF_SIZE);
+	sme_assert(len > 0 && len < BUF_SIZE, "Unexpected read size");
+	if (corrupt_at >= 0)
+		buf[corrupt_at] ^= 0x10;
+	assert_equals_int(write(out_fds[0], buf, len), len);
+
+	n_recvd = 0;
+	while (sme_channel_read((SmeChannel *) rch) > 0)
+		;
+
+	if (corrupt_at >= 0)
+	{
+		assert_equals_int(n_recvd, 1);
+		assert_equals_int(sme_msg_reader_is_failed(reader), 1);
+	}
+	else
+	{
+		assert_equals_int(n_recvd, 2);
+		assert_equals_int(sme_msg_reader_is_failed(reader), 0);
+		assert_equals_int(recvd->mem_len, msg->mem_len);
+		if (memcmp(recvd->mem, msg->mem, msg->mem_len) != 0)
+			sme_error("Unequal memory blocks");
+	}
+	mmc_msg_unref(recvd);
+	recvd = NULL;
+
+	sme_msg_reader_unref(reader);
+	sme_msg_writer_unref(writer);
+	sme_channel_unref((SmeChannel *) wch);
+	sme_channel_unref((SmeChannel *) rch);
+	close(in_fds[0]);
+	close(in_fds[1]);
+	close(out_fds[0]);
+	close(out_fds[1]);
+}
+
+int main()
+{
+	MmcMsg *msg;
+	size_t msg_size;
+
+	test_crc32c();
+
+	//Size of a serialized message with the trailer
+	msg = mmc_msg_newa(100, 1);
+	memset(msg->mem, 'x', 100);
+	msg->submsgs[0] = mmc_msg_newa(0, 0);
+	msg_size = (ssc_msg_count(msg) + 1) * sizeof(uint32_t) + 100 + 4;
+
+	test_trailer(msg, -1);
+
+	//Corrupt the second message in data and trailer
+	test_trailer(msg, msg_size + msg_size - 104);
+	test_trailer(msg, msg_size + msg_size - 50);
+	test_trailer(msg, msg_size + msg_size - 1);
+
+	mmc_msg_unref(msg);
+
+	return 0;
+}
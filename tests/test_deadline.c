@@ -0,0 +1,233 @@
+/* test_deadline.c
+ * Unit test for timer_wheel.c and message deadlines
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sme/sme.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define assert_equals_int(a, b) \
+	do {\
+		int64_t _a = (a); \
+		int64_t _b = (b); \
+		if (_a != _b) \
+		{ \
+			sme_error("Assertion failed a == b (a = %" PRId64 ", " \
+					"b = %" PRId64 ")", \
+					_a, _b); \
+		} \
+	} while (0)
+
+#define TICK 1000
+
+//Timer wheel
+#define N_TIMERS 12
+
+static const uint64_t timer_ticks[N_TIMERS] = 
+	{0, 1, 5, 63, 64, 65, 200, 4095, 4096, 5000, 300000, 20000000};
+
+typedef struct 
+{
+	SmeTimer timer;
+	uint64_t expected;
+	int fired;
+} TestTimer;
+
+uint64_t cur_tick;
+
+void test_timer_cb(SmeTimer *timer, void *data)
+{
+	TestTimer *t = data;
+
+	assert_equals_int(cur_tick, t->expected);
+	t->fired++;
+}
+
+void test_timer_wheel()
+{
+	SmeTimerWheel *wheel;
+	TestTimer timers[N_TIMERS], removed;
+	uint64_t base, next;
+	int i;
+
+	wheel = sme_timer_wheel_new(NULL, TICK);
+
+	//Start at a boundary of all levels but the last, timers due exactly 
+	//at a boundary are the ones cascaded on the tick they fire
+	base = sme_latency_now() / TICK;
+	base = (base / (1 << 18) + 1) << 18;
+	sme_timer_wheel_advance(wheel, (base - 1) * TICK);
+
+	for (i = 0; i < N_TIMERS; i++)
+	{
+		sme_timer_init(&(timers[i].timer), test_timer_cb, timers + i);
+		timers[i].fired = 0;
+		timers[i].expected = base + timer_ticks[i];
+		sme_timer_wheel_add
+			(wheel, &(timers[i].timer), (base + timer_ticks[i]) * TICK);
+	}
+	sme_timer_init(&(removed.timer), test_timer_cb, &removed);
+	removed.fired = 0;
+	sme_timer_wheel_add(wheel, &(removed.timer), (base + 100) * TICK);
+	assert_equals_int(sme_timer_wheel_get_n_timers(wheel), N_TIMERS + 1);
+	sme_timer_wheel_remove(wheel, &(removed.timer));
+	assert_equals_int(sme_timer_wheel_get_n_timers(wheel), N_TIMERS);
+
+	//Advance one tick at a time, timers check they fire on time
+	for (cur_tick = base; sme_timer_wheel_get_n_timers(wheel) > 0; cur_tick++)
+		sme_timer_wheel_advance(wheel, cur_tick * TICK + TICK / 2);
+
+	for (i = 0; i < N_TIMERS; i++)
+		assert_equals_int(timers[i].fired, 1);
+	assert_equals_int(removed.fired, 0);
+
+	//Jump over a long time in one call
+	cur_tick = base + 30000000;
+	timers[0].expected = cur_tick;
+	sme_timer_wheel_add(wheel, &(timers[0].timer), (cur_tick - 10) * TICK);
+	sme_timer_wheel_advance(wheel, cur_tick * TICK);
+	assert_equals_int(timers[0].fired, 2);
+
+	//Next time to advance at is where the timer or its level wraps,
+	//nothing runs before it
+	cur_tick += 100000;
+	timers[0].expected = cur_tick;
+	sme_timer_wheel_add(wheel, &(timers[0].timer), cur_tick * TICK);
+	next = sme_timer_wheel_get_next_time(wheel);
+	sme_assert(next > (cur_tick - 100000) * TICK && next <= cur_tick * TICK,
+			"Unexpected next time");
+	sme_timer_wheel_advance(wheel, next - 1);
+	assert_equals_int(timers[0].fired, 2);
+	while (timers[0].fired == 2)
+	{
+		next = sme_timer_wheel_get_next_time(wheel);
+		sme_assert(next <= cur_tick * TICK, "Timer skipped");
+		sme_timer_wheel_advance(wheel, next);
+	}
+	assert_equals_int(sme_timer_wheel_get_next_time(wheel), 0);
+
+	//Stall of 2^36 ticks with a timer pending is crossed in jumps
+	cur_tick += (uint64_t) 1 << 36;
+	timers[0].expected = cur_tick;
+	sme_timer_wheel_add(wheel, &(timers[0].timer), cur_tick * TICK);
+	sme_timer_wheel_advance(wheel, cur_tick * TICK);
+	assert_equals_int(timers[0].fired, 4);
+
+	sme_timer_wheel_unref(wheel);
+}
+
+//Message deadlines
+MmcMsg *recvd[4];
+int n_recvd;
+
+void test_notify_call(MmcMsg *msg, void *data)
+{
+	sme_assert(n_recvd < 4, "Capacity exceeded");
+	recvd[n_recvd++] = msg;
+}
+
+MmcMsg *create_msg(size_t size, char c)
+{
+	MmcMsg *msg = mmc_msg_newa(size, 0);
+	memset(msg->mem, c, size);
+	return msg;
+}
+
+void test_deadline()
+{
+	int fds[2], sndbuf = 65536;
+	SmeFdChannel *wch, *rch;
+	SmeMsgWriter *writer;
+	SmeMsgReader *reader;
+	SmeMsgReaderNotify notify = {test_notify_call, NULL};
+	SmeTimerWheel *wheel;
+	MmcMsg *bulk, *a, *b, *c;
+	uint64_t now;
+	int i;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		sme_error("socketpair() failed");
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+	wch = sme_fd_channel_new(fds[0]);
+	rch = sme_fd_channel_new(fds[1]);
+	writer = sme_msg_writer_new((SmeChannel *) wch);
+	reader = sme_msg_reader_new((SmeChannel *) rch, notify);
+	wheel = sme_timer_wheel_new(NULL, TICK);
+	sme_msg_writer_set_timer_wheel(writer, wheel);
+
+	bulk = create_msg(1000000, 'x');
+	a = create_msg(10, 'a');
+	b = create_msg(10, 'b');
+	c = create_msg(10, 'c');
+
+	//Peer stalls while the bulk message is being written
+	now = sme_latency_now();
+	sme_msg_writer_add_msg_deadline(writer, bulk, 2, now + 1000 * TICK);
+	sme_msg_writer_add_msg_deadline(writer, a, 2, now + 1000 * TICK);
+	sme_msg_writer_add_msg(writer, b);
+	sme_msg_writer_add_msg_deadline(writer, c, 2, now + 1000 * TICK);
+	sme_channel_write((SmeChannel *) wch);
+	assert_equals_int(sme_msg_writer_get_queue_len(writer), 4);
+
+	//Stale messages are dropped, started one is kept
+	sme_timer_wheel_advance(wheel, now + 2000 * TICK);
+	assert_equals_int(sme_msg_writer_get_n_expired(writer), 2);
+	assert_equals_int(sme_msg_writer_get_queue_len(writer), 2);
+	assert_equals_int(sme_fd_channel_get_write_queue_len(wch), 2);
+	assert_equals_int(sme_timer_wheel_get_n_timers(wheel), 0);
+
+	//Peer recovers
+	for (i = 0; i < 10000 && n_recvd < 2; i++)
+	{
+		sme_channel_write((SmeChannel *) wch);
+		sme_channel_read((SmeChannel *) rch);
+	}
+	assert_equals_int(n_recvd, 2);
+	assert_equals_int(recvd[0]->mem_len, 1000000);
+	assert_equals_int(((char *) recvd[1]->mem)[0], 'b');
+
+	for (i = 0; i < n_recvd; i++)
+		mmc_msg_unref(recvd[i]);
+	mmc_msg_unref(bulk);
+	mmc_msg_unref(a);
+	mmc_msg_unref(b);
+	mmc_msg_unref(c);
+
+	sme_msg_reader_unref(reader);
+	sme_msg_writer_unref(writer);
+	sme_timer_wheel_unref(wheel);
+	sme_channel_unref((SmeChannel *) wch);
+	sme_channel_unref((SmeChannel *) rch);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int main()
+{
+	test_timer_wheel();
+	test_deadline();
+
+	return 0;
+}
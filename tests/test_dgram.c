@@ -0,0 +1,170 @@
+/* test_dgram.c
+ * Unit test for dgram.c
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sme/sme.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define assert_equals_int(a, b) \
+	do {\
+		int64_t _a = (a); \
+		int64_t _b = (b); \
+		if (_a != _b) \
+		{ \
+			sme_error("Assertion failed a == b (a = %" PRId64 ", " \
+					"b = %" PRId64 ")", \
+					_a, _b); \
+		} \
+	} while (0)
+
+#define N_MSGS 100
+#define MAX_SIZE 1024
+
+MmcMsg *recvd[N_MSGS];
+int n_recvd;
+
+void test_notify_call(MmcMsg *msg, void *data)
+{
+	sme_assert(n_recvd < N_MSGS, "Capacity exceeded");
+	recvd[n_recvd++] = msg;
+}
+
+MmcMsg *create_msg(int idx)
+{
+	MmcMsg *msg = mmc_msg_newa(idx % 7, 1);
+
+	memset(msg->mem, 'A' + idx % 26, idx % 7);
+	msg->submsgs[0] = mmc_msg_newa(idx, 0);
+	memset(msg->submsgs[0]->mem, 'a' + idx % 26, idx);
+
+	return msg;
+}
+
+void assert_equals_msg(MmcMsg* a, MmcMsg* b)
+{
+	int i;
+
+	assert_equals_int(a->mem_len, b->mem_len);
+	if (a->mem_len > 0)
+	{
+		if (memcmp(a->mem, b->mem, a->mem_len) != 0)
+			sme_error("Unequal memory blocks");
+	}
+
+	assert_equals_int(a->submsgs_len, b->submsgs_len);
+	for (i = 0; i < a->submsgs_len; i++)
+		assert_equals_msg(a->submsgs[i], b->submsgs[i]);
+}
+
+//Parsing from unaligned memory, and lengths that do not add up
+void testcase_parse()
+{
+	uint32_t header[3] = {2, 3, 0};
+	char buf[1 + sizeof(header) + 3];
+	MmcMsg *msg;
+
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf + 1, header, sizeof(header));
+	memcpy(buf + 1 + sizeof(header), "abc", 3);
+	msg = sme_msg_parse(buf + 1, sizeof(header) + 3);
+	sme_assert(msg, "Parsing failed");
+	assert_equals_int(msg->mem_len, 3);
+	assert_equals_int(memcmp(msg->mem, "abc", 3), 0);
+	mmc_msg_unref(msg);
+
+	//Too short, too long, and a huge block that is not there
+	assert_equals_int((intptr_t) sme_msg_parse(buf + 1, sizeof(header) + 2), 0);
+	assert_equals_int((intptr_t) sme_msg_parse(buf, sizeof(header) + 4), 0);
+	header[1] = 0x7fffffff;
+	memcpy(buf + 1, header, sizeof(header));
+	assert_equals_int((intptr_t) sme_msg_parse(buf + 1, sizeof(header) + 3), 0);
+}
+
+int main()
+{
+	int fds[2];
+	SmeDgramChannel *channel;
+	SmeMsgWriter *writer;
+	SmeDgramReader *reader;
+	SmeMsgReaderNotify notify = {test_notify_call, NULL};
+	MmcMsg *sent[N_MSGS], *big;
+	SmeChannelStats stats;
+	int i;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) < 0)
+		sme_error("socketpair() failed");
+
+	channel = sme_dgram_channel_new(fds[0]);
+	writer = sme_msg_writer_new((SmeChannel *) channel);
+	reader = sme_dgram_reader_new(fds[1], MAX_SIZE, notify);
+
+	//Nothing to read
+	assert_equals_int(sme_dgram_reader_read(reader), -1);
+
+	for (i = 0; i < N_MSGS; i++)
+	{
+		sent[i] = create_msg(i);
+		sme_msg_writer_add_msg(writer, sent[i]);
+	}
+
+	//Datagrams are sent in batches
+	while (sme_msg_writer_get_queue_len(writer) > 0)
+		sme_channel_write((SmeChannel *) channel);
+	sme_channel_get_stats((SmeChannel *) channel, &stats);
+	assert_equals_int(stats.write.n_syscalls, 
+			(N_MSGS + SME_DGRAM_BATCH - 1) / SME_DGRAM_BATCH);
+	assert_equals_int(stats.write.n_jobs, N_MSGS);
+
+	//Received in batches as whole messages
+	for (i = 0; i < N_MSGS && n_recvd < N_MSGS; i++)
+		sme_dgram_reader_read(reader);
+	assert_equals_int(i, (N_MSGS + SME_DGRAM_BATCH - 1) / SME_DGRAM_BATCH);
+	assert_equals_int(n_recvd, N_MSGS);
+
+	for (i = 0; i < N_MSGS; i++)
+	{
+		assert_equals_msg(sent[i], recvd[i]);
+		mmc_msg_unref(sent[i]);
+		mmc_msg_unref(recvd[i]);
+	}
+
+	//Malformed and oversized datagrams are dropped
+	assert_equals_int(send(fds[0], "xy", 2, 0), 2);
+	big = mmc_msg_newa(MAX_SIZE * 2, 0);
+	memset(big->mem, 0, MAX_SIZE * 2);
+	sme_msg_writer_add_msg(writer, big);
+	sme_channel_write((SmeChannel *) channel);
+	mmc_msg_unref(big);
+	assert_equals_int(sme_dgram_reader_read(reader), 2);
+	assert_equals_int(sme_dgram_reader_get_n_dropped(reader), 2);
+	assert_equals_int(n_recvd, N_MSGS);
+
+	sme_dgram_reader_unref(reader);
+	sme_msg_writer_unref(writer);
+	sme_channel_unref((SmeChannel *) channel);
+	close(fds[0]);
+	close(fds[1]);
+
+	testcase_parse();
+
+	return 0;
+}
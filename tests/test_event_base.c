@@ -0,0 +1,141 @@
+/* test_event_base.c
+ * Unit test for running fd channels on libevent
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sme/sme.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <event2/event.h>
+
+#define assert_equals_int(a, b) \
+	do {\
+		int64_t _a = (a); \
+		int64_t _b = (b); \
+		if (_a != _b) \
+		{ \
+			sme_error("Assertion failed a == b (a = %" PRId64 ", " \
+					"b = %" PRId64 ")", \
+					_a, _b); \
+		} \
+	} while (0)
+
+#define N_MSGS 20
+#define LARGE_SIZE 1000000
+
+MmcMsg *recvd[N_MSGS];
+int n_recvd;
+
+void test_notify_call(MmcMsg *msg, void *data)
+{
+	sme_assert(n_recvd < N_MSGS, "Capacity exceeded");
+	recvd[n_recvd++] = msg;
+}
+
+int n_failed;
+
+void test_failed(SmeChannel *channel, void *ptr)
+{
+	n_failed++;
+}
+
+static int count_added(struct event_base *base)
+{
+	return event_base_get_num_events(base, EVENT_BASE_COUNT_ADDED);
+}
+
+int main()
+{
+	int fds[2];
+	struct event_base *base;
+	SmeFdChannel *wch, *rch;
+	SmeMsgWriter *writer;
+	SmeMsgReader *reader;
+	SmeMsgReaderNotify notify = {test_notify_call, NULL};
+	SmeChannelCB cb = {NULL, test_failed};
+	MmcMsg *sent[N_MSGS];
+	size_t size;
+	int i;
+
+	base = event_base_new();
+	if (! base)
+		sme_error("event_base_new() failed");
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		sme_error("socketpair() failed");
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	wch = sme_fd_channel_new(fds[0]);
+	rch = sme_fd_channel_new(fds[1]);
+	writer = sme_msg_writer_new((SmeChannel *) wch);
+	reader = sme_msg_reader_new((SmeChannel *) rch, notify);
+
+	assert_equals_int(sme_fd_channel_attach_event_base(wch, base, cb), 0);
+	assert_equals_int(sme_fd_channel_attach_event_base(rch, base, cb), 0);
+
+	//Only the reader has jobs
+	assert_equals_int(count_added(base), 1);
+
+	//Large messages do not fit in the socket buffer
+	for (i = 0; i < N_MSGS; i++)
+	{
+		size = i % 4 == 0 ? LARGE_SIZE : 100 + i;
+		sent[i] = mmc_msg_newa(size, 0);
+		memset(sent[i]->mem, 'a' + i, size);
+		sme_msg_writer_add_msg(writer, sent[i]);
+	}
+	assert_equals_int(count_added(base), 2);
+
+	for (i = 0; i < 10000 && n_recvd < N_MSGS; i++)
+		event_base_loop(base, EVLOOP_ONCE);
+	assert_equals_int(n_recvd, N_MSGS);
+
+	//Write event is removed once the lane is empty
+	assert_equals_int(sme_fd_channel_get_write_queue_len(wch), 0);
+	assert_equals_int(count_added(base), 1);
+
+	for (i = 0; i < N_MSGS; i++)
+	{
+		assert_equals_int(sent[i]->mem_len, recvd[i]->mem_len);
+		if (memcmp(sent[i]->mem, recvd[i]->mem, sent[i]->mem_len) != 0)
+			sme_error("Unequal memory blocks");
+		mmc_msg_unref(sent[i]);
+		mmc_msg_unref(recvd[i]);
+	}
+
+	//Peer closing detaches the channel and is reported once
+	sme_fd_channel_detach_event_base(wch);
+	close(fds[0]);
+	for (i = 0; i < 100 && n_failed == 0; i++)
+		event_base_loop(base, EVLOOP_ONCE);
+	assert_equals_int(n_failed, 1);
+	assert_equals_int(count_added(base), 0);
+
+	sme_msg_reader_unref(reader);
+	sme_msg_writer_unref(writer);
+	sme_channel_unref((SmeChannel *) wch);
+	sme_channel_unref((SmeChannel *) rch);
+	event_base_free(base);
+	close(fds[1]);
+
+	return 0;
+}
@@ -0,0 +1,250 @@
+/* test_generated.c
+ * Unit test for generated messages in msg.c
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sme/sme.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define assert_equals_int(a, b) \
+	do {\
+		int64_t _a = (a); \
+		int64_t _b = (b); \
+		if (_a != _b) \
+		{ \
+			sme_error("Assertion failed a == b (a = %" PRId64 ", " \
+					"b = %" PRId64 ")", \
+					_a, _b); \
+		} \
+	} while (0)
+
+#define CHUNK_SIZE 4096
+#define N_SUBS 3
+
+static const size_t block_sizes[N_SUBS + 1] = {10, 1000000, 3, 3 * CHUNK_SIZE};
+
+static char block_byte(size_t block, size_t offset)
+{
+	return (char) (offset * 11 + block);
+}
+
+//Layout of the generated message
+#define LAYOUT_SIZE (2 * (N_SUBS + 1))
+
+void create_layout(uint32_t *layout)
+{
+	size_t i;
+
+	layout[0] = ssc_uint32_to_le(block_sizes[0]);
+	layout[1] = ssc_uint32_to_le(N_SUBS);
+	for (i = 1; i <= N_SUBS; i++)
+	{
+		layout[2 * i] = ssc_uint32_to_le(block_sizes[i]);
+		layout[2 * i + 1] = 0;
+	}
+}
+
+//The message it stands for
+MmcMsg *create_msg()
+{
+	MmcMsg *msg = mmc_msg_newa(block_sizes[0], N_SUBS);
+	size_t i, j;
+
+	for (i = 1; i <= N_SUBS; i++)
+		msg->submsgs[i - 1] = mmc_msg_newa(block_sizes[i], 0);
+
+	for (j = 0; j < block_sizes[0]; j++)
+		((char *) msg->mem)[j] = block_byte(0, j);
+	for (i = 1; i <= N_SUBS; i++)
+		for (j = 0; j < block_sizes[i]; j++)
+			((char *) msg->submsgs[i - 1]->mem)[j] = block_byte(i, j);
+
+	return msg;
+}
+
+void assert_equals_msg(MmcMsg* a, MmcMsg* b)
+{
+	int i;
+
+	assert_equals_int(a->mem_len, b->mem_len);
+	if (a->mem_len > 0)
+	{
+		if (memcmp(a->mem, b->mem, a->mem_len) != 0)
+			sme_error("Unequal memory blocks");
+	}
+
+	assert_equals_int(a->submsgs_len, b->submsgs_len);
+	for (i = 0; i < a->submsgs_len; i++)
+		assert_equals_msg(a->submsgs[i], b->submsgs[i]);
+}
+
+//Producer
+int n_produced;
+int n_done;
+
+void test_produce
+	(size_t block, size_t offset, void *buf, size_t len, void *data)
+{
+	size_t i;
+
+	sme_assert(block <= N_SUBS, "Invalid block %d", (int) block);
+	sme_assert(offset + len <= block_sizes[block], "Chunk crosses block");
+	sme_assert(len <= CHUNK_SIZE, "Chunk too large");
+	for (i = 0; i < len; i++)
+		((char *) buf)[i] = block_byte(block, offset + i);
+	n_produced++;
+}
+
+void test_done(void *data)
+{
+	n_done++;
+}
+
+//Reader
+#define N_MSGS 5
+
+MmcMsg *recvd[N_MSGS];
+int n_recvd;
+
+void test_notify_call(MmcMsg *msg, void *data)
+{
+	sme_assert(n_recvd < N_MSGS, "Capacity exceeded");
+	recvd[n_recvd++] = msg;
+}
+
+void testcase(int crc)
+{
+	int fds[2];
+	SmeFdChannel *wch, *rch;
+	SmeMsgWriter *writer;
+	SmeMsgReader *reader;
+	SmeMsgReaderNotify notify = {test_notify_call, NULL};
+	SmeMsgProducer producer = {test_produce, test_done, NULL};
+	uint32_t layout[LAYOUT_SIZE];
+	MmcMsg *expected, *small[3];
+	int i;
+
+	n_produced = n_done = n_recvd = 0;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		sme_error("socketpair() failed");
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	wch = sme_fd_channel_new(fds[0]);
+	rch = sme_fd_channel_new(fds[1]);
+	writer = sme_msg_writer_new((SmeChannel *) wch);
+	reader = sme_msg_reader_new((SmeChannel *) rch, notify);
+	sme_msg_writer_set_crc(writer, crc);
+	sme_msg_reader_set_crc(reader, crc);
+
+	create_layout(layout);
+	expected = create_msg();
+	for (i = 0; i < 3; i++)
+	{
+		small[i] = mmc_msg_newa(20, 0);
+		memset(small[i]->mem, 'x' + i, 20);
+	}
+
+	//Urgent message goes ahead of a generated one that has not started
+	assert_equals_int(sme_msg_writer_add_generated
+		(writer, layout, LAYOUT_SIZE, SME_MSG_WRITER_DEFAULT_PRIO, 
+		 producer, CHUNK_SIZE), 0);
+	sme_msg_writer_add_msg_prio(writer, small[0], 0);
+
+	//Only as many chunks as there are buffers are produced up front
+	assert_equals_int(n_produced, SME_MSG_WRITER_GEN_N_BUFS);
+
+	//Once started, messages are held back until it is done, 
+	//and then queued by priority
+	sme_channel_write((SmeChannel *) wch);
+	assert_equals_int(sme_msg_writer_add_generated
+		(writer, layout, LAYOUT_SIZE, SME_MSG_WRITER_DEFAULT_PRIO, 
+		 producer, CHUNK_SIZE), 0);
+	sme_msg_writer_add_msg_prio(writer, small[1], 0);
+	sme_msg_writer_add_msg_prio(writer, small[2], 0);
+
+	for (i = 0; i < 100000 && n_recvd < N_MSGS; i++)
+	{
+		sme_channel_write((SmeChannel *) wch);
+		sme_channel_read((SmeChannel *) rch);
+	}
+	assert_equals_int(n_recvd, N_MSGS);
+	assert_equals_int(n_done, 2);
+	assert_equals_int(sme_msg_writer_get_queue_len(writer), 0);
+	assert_equals_int(sme_msg_reader_is_failed(reader), 0);
+
+	assert_equals_msg(small[0], recvd[0]);
+	assert_equals_msg(expected, recvd[1]);
+	assert_equals_msg(small[1], recvd[2]);
+	assert_equals_msg(small[2], recvd[3]);
+	assert_equals_msg(expected, recvd[4]);
+	for (i = 0; i < N_MSGS; i++)
+		mmc_msg_unref(recvd[i]);
+	mmc_msg_unref(expected);
+	for (i = 0; i < 3; i++)
+		mmc_msg_unref(small[i]);
+
+	sme_msg_reader_unref(reader);
+	sme_msg_writer_unref(writer);
+	sme_channel_unref((SmeChannel *) wch);
+	sme_channel_unref((SmeChannel *) rch);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+//Layouts that do not add up are refused
+void testcase_malformed()
+{
+	SmeMsgWriter *writer;
+	SmeMsgProducer producer = {test_produce, test_done, NULL};
+	uint32_t layout[LAYOUT_SIZE];
+	int fds[2];
+	SmeFdChannel *wch;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		sme_error("socketpair() failed");
+	wch = sme_fd_channel_new(fds[0]);
+	writer = sme_msg_writer_new((SmeChannel *) wch);
+
+	create_layout(layout);
+	layout[1] = ssc_uint32_to_le(N_SUBS + 1);
+	assert_equals_int(sme_msg_writer_add_generated
+		(writer, layout, LAYOUT_SIZE, 0, producer, CHUNK_SIZE), -1);
+	assert_equals_int(sme_msg_writer_add_generated
+		(writer, layout, 0, 0, producer, CHUNK_SIZE), -1);
+	assert_equals_int(sme_msg_writer_get_queue_len(writer), 0);
+
+	sme_msg_writer_unref(writer);
+	sme_channel_unref((SmeChannel *) wch);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int main()
+{
+	testcase_malformed();
+	testcase(0);
+	testcase(1);
+
+	return 0;
+}
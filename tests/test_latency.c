@@ -0,0 +1,168 @@
+/* test_latency.c
+ * Unit test for latency histograms
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sme/sme.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define assert_equals_int(a, b) \
+	do {\
+		int64_t _a = (a); \
+		int64_t _b = (b); \
+		if (_a != _b) \
+		{ \
+			sme_error("Assertion failed a == b (a = %" PRId64 ", " \
+					"b = %" PRId64 ")", \
+					_a, _b); \
+		} \
+	} while (0)
+
+//Checks that reported value is not below the actual value 
+//and within relative error of the histogram
+static void assert_close(uint64_t reported, uint64_t actual)
+{
+	uint64_t max_err = actual >> SME_HISTOGRAM_SUB_BITS;
+
+	if (reported < actual || reported - actual > max_err)
+	{
+		sme_error("Assertion failed: reported = %" PRIu64 
+				", actual = %" PRIu64, reported, actual);
+	}
+}
+
+#define N_MSGS 5
+
+//Histograms recorded by writer, reader and link over a socketpair
+static void testcase_link()
+{
+	int fds[2];
+	SmeChannel *wch, *rch;
+	SmeChannelLink *wlink, *rlink;
+	SmeLatency wlat, rlat;
+	MmcMsg *msg;
+	int i;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		sme_error("socketpair() failed");
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	wch = (SmeChannel *) sme_fd_channel_new(fds[0]);
+	rch = (SmeChannel *) sme_fd_channel_new(fds[1]);
+	wlink = sme_channel_link_new(wch);
+	rlink = sme_channel_link_new(rch);
+
+	//Disabled by default
+	assert_equals_int(sme_channel_link_get_latency(wlink, &wlat), 0);
+
+	sme_channel_link_enable_latency(wlink);
+	sme_channel_link_enable_latency(rlink);
+
+	msg = mmc_msg_newa(100000, 0);
+	memset(msg->mem, 'x', 100000);
+	for (i = 0; i < N_MSGS; i++)
+		sme_link_send((SmeLink *) wlink, msg);
+	mmc_msg_unref(msg);
+
+	//Messages are dropped by the receiving link, it has no router
+	for (i = 0; i < 100000; i++)
+	{
+		sme_channel_write(wch);
+		sme_channel_read(rch);
+		sme_channel_link_get_latency(rlink, &rlat);
+		if (rlat.receive.count == N_MSGS)
+			break;
+	}
+
+	assert_equals_int(sme_channel_link_get_latency(wlink, &wlat), 1);
+	assert_equals_int(sme_channel_link_get_latency(rlink, &rlat), 1);
+	assert_equals_int(wlat.queue.count, N_MSGS);
+	assert_equals_int(wlat.write.count, N_MSGS);
+	assert_equals_int(wlat.send.count, N_MSGS);
+	assert_equals_int(wlat.receive.count, 0);
+	assert_equals_int(rlat.receive.count, N_MSGS);
+	assert_equals_int(rlat.send.count, 0);
+
+	//Later messages waited behind earlier ones
+	sme_assert(wlat.queue.max > 0, "Queue latency not recorded");
+	sme_assert(wlat.send.max >= wlat.write.max, "Send shorter than write");
+
+	//Reset
+	sme_channel_link_reset_latency(wlink);
+	sme_channel_link_get_latency(wlink, &wlat);
+	assert_equals_int(wlat.send.count, 0);
+
+	sme_channel_link_disable_latency(wlink);
+	assert_equals_int(sme_channel_link_get_latency(wlink, &wlat), 0);
+
+	sme_link_unref((SmeLink *) wlink);
+	sme_link_unref((SmeLink *) rlink);
+	sme_channel_unref(wch);
+	sme_channel_unref(rch);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int main()
+{
+	SmeHistogram hist[1];
+	uint64_t i;
+
+	//Empty histogram
+	sme_histogram_reset(hist);
+	assert_equals_int(sme_histogram_quantile(hist, 0.5), 0);
+
+	//Small values are exact
+	for (i = 0; i < 10; i++)
+		sme_histogram_record(hist, i);
+	assert_equals_int(hist->count, 10);
+	assert_equals_int(hist->min, 0);
+	assert_equals_int(hist->max, 9);
+	assert_equals_int(sme_histogram_quantile(hist, 0.5), 5);
+	assert_equals_int(sme_histogram_quantile(hist, 1.0), 9);
+
+	//Uniform distribution over a wide range
+	sme_histogram_reset(hist);
+	for (i = 1; i <= 100000; i++)
+		sme_histogram_record(hist, i * 1000);
+	assert_close(sme_histogram_quantile(hist, 0.5), 50001000);
+	assert_close(sme_histogram_quantile(hist, 0.99), 99001000);
+	assert_close(sme_histogram_quantile(hist, 0.999), 99901000);
+	assert_equals_int(sme_histogram_quantile(hist, 1.0), 100000000);
+
+	//Single large outlier
+	sme_histogram_reset(hist);
+	for (i = 0; i < 999; i++)
+		sme_histogram_record(hist, 100);
+	sme_histogram_record(hist, 1000000);
+	assert_close(sme_histogram_quantile(hist, 0.99), 100);
+	assert_equals_int(sme_histogram_quantile(hist, 0.9995), 1000000);
+
+	//Values above range get clamped
+	sme_histogram_record(hist, UINT64_MAX);
+	assert_equals_int(hist->count, 1001);
+
+	testcase_link();
+
+	return 0;
+}
@@ -0,0 +1,179 @@
+/* test_listener.c
+ * Unit test for listener.c
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sme/sme.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define assert_equals_int(a, b) \
+	do {\
+		int64_t _a = (a); \
+		int64_t _b = (b); \
+		if (_a != _b) \
+		{ \
+			sme_error("Assertion failed a == b (a = %" PRId64 ", " \
+					"b = %" PRId64 ")", \
+					_a, _b); \
+		} \
+	} while (0)
+
+#define N_CLIENTS 20
+
+SmeChannelLink *links[N_CLIENTS];
+int link_fds[N_CLIENTS];
+int n_links;
+SmeListener *unref_listener;
+
+void test_accepted
+	(SmeChannelLink *link, SmeFdChannel *channel, int fd, void *data)
+{
+	sme_assert(n_links < N_CLIENTS, "Capacity exceeded");
+	assert_equals_int(sme_fd_channel_get_fd(channel), fd);
+	links[n_links] = link;
+	link_fds[n_links] = fd;
+	n_links++;
+
+	//Dropping the last reference from the callback
+	if (unref_listener)
+	{
+		sme_listener_unref(unref_listener);
+		unref_listener = NULL;
+	}
+}
+
+int get_port(int fd)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+
+	if (getsockname(fd, (struct sockaddr *) &addr, &len) < 0)
+		sme_error("getsockname() failed");
+
+	return ntohs(addr.sin_port);
+}
+
+int connect_client(int port)
+{
+	struct sockaddr_in addr;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		sme_error("connect() failed");
+
+	return fd;
+}
+
+int main()
+{
+	SmeListenerNotify notify = {test_accepted, NULL};
+	SmeListener *listener;
+	int lfd, lfd2, port, i;
+	int clients[N_CLIENTS];
+	struct ev_loop *loop;
+	struct rlimit limit, saved_limit;
+
+	lfd = sme_listener_bind_tcp("127.0.0.1", 0, 64, 1);
+	sme_assert(lfd >= 0, "sme_listener_bind_tcp() failed");
+	port = get_port(lfd);
+
+	//A second socket on the same port, as another loop thread would do
+	lfd2 = sme_listener_bind_tcp("127.0.0.1", port, 64, 1);
+	sme_assert(lfd2 >= 0, "Binding with SO_REUSEPORT failed");
+	close(lfd2);
+
+	//Without SO_REUSEPORT binding fails
+	lfd2 = sme_listener_bind_tcp("127.0.0.1", port, 64, 0);
+	assert_equals_int(lfd2, -1);
+
+	listener = sme_listener_new(lfd, notify);
+
+	//Nothing pending
+	assert_equals_int(sme_listener_accept(listener), 0);
+
+	//Connection storm is accepted in one call
+	for (i = 0; i < N_CLIENTS; i++)
+		clients[i] = connect_client(port);
+	assert_equals_int(sme_listener_accept(listener), N_CLIENTS);
+	assert_equals_int(n_links, N_CLIENTS);
+	assert_equals_int(sme_listener_get_n_accepted(listener), N_CLIENTS);
+	assert_equals_int(sme_listener_accept(listener), 0);
+
+	for (i = 0; i < N_CLIENTS; i++)
+	{
+		//Accepted sockets are non-blocking
+		char c;
+		assert_equals_int(read(link_fds[i], &c, 1), -1);
+		assert_equals_int(errno == EAGAIN || errno == EWOULDBLOCK, 1);
+
+		sme_link_unref((SmeLink *) links[i]);
+		close(link_fds[i]);
+		close(clients[i]);
+	}
+
+	//Out of descriptors: accepting backs off
+	loop = ev_loop_new(EVFLAG_AUTO);
+	sme_listener_start(listener, loop);
+	clients[0] = connect_client(port);
+	getrlimit(RLIMIT_NOFILE, &saved_limit);
+	limit = saved_limit;
+	limit.rlim_cur = dup(0);
+	close(limit.rlim_cur);
+	setrlimit(RLIMIT_NOFILE, &limit);
+	assert_equals_int(sme_listener_accept(listener), 0);
+	setrlimit(RLIMIT_NOFILE, &saved_limit);
+	assert_equals_int(sme_listener_get_n_backoffs(listener), 1);
+
+	//Connection is still there once descriptors are available
+	n_links = 0;
+	assert_equals_int(sme_listener_accept(listener), 1);
+	sme_link_unref((SmeLink *) links[0]);
+	close(link_fds[0]);
+	close(clients[0]);
+	sme_listener_stop(listener);
+	ev_loop_destroy(loop);
+
+	sme_listener_unref(listener);
+
+	//Listener stays alive while accepting
+	n_links = 0;
+	listener = sme_listener_new(lfd, notify);
+	unref_listener = listener;
+	clients[0] = connect_client(port);
+	assert_equals_int(sme_listener_accept(listener), 1);
+	sme_link_unref((SmeLink *) links[0]);
+	close(link_fds[0]);
+	close(clients[0]);
+
+	close(lfd);
+
+	return 0;
+}
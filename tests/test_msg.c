@@ -21,6 +21,9 @@
 #include <sme/sme.h>
 #include <stdio.h>
 #include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
 #define MAX_DATA 26
 #define MAX_IO 100
@@ -72,6 +75,7 @@ typedef struct
 	char data[MAX_IO];
 
 	int rcomp, wcomp;
+	size_t last_n_blocks;
 
 	ReadSeg read_segs[MAX_SEG];
 	int n_read_segs;
@@ -103,6 +107,7 @@ void loop_channel_add_write_job
 	}
 
 	ch->wcomp++;
+	ch->last_n_blocks = n_blocks;
 }
 
 ssize_t loop_channel_do_write(SmeChannel *ptr)
@@ -209,6 +214,7 @@ void loop_channel_init(LoopChannel *ch)
 
 	ch->rmark = ch->wmark = 0;
 	ch->rcomp = ch->wcomp = 0;
+	ch->last_n_blocks = 0;
 
 	ch->n_read_segs = 0;
 
@@ -283,6 +289,50 @@ void testcase(MmcMsg *msg)
 	sme_msg_writer_unref(writer);
 }
 
+//Fan-out of a prepared message to several writers
+#define N_FANOUT 3
+
+void testcase_prepared(MmcMsg *msg)
+{
+	TestReaderNotify recvd[N_FANOUT];
+	LoopChannel channel[N_FANOUT];
+	SmeMsgWriter *writer[N_FANOUT];
+	SmeMsgReader *reader[N_FANOUT];
+	SmePreparedMsg *prepared;
+	int i, j;
+
+	prepared = sme_prepared_msg_new(msg);
+	for (i = 0; i < N_FANOUT; i++)
+	{
+		test_reader_notify_init(recvd + i);
+		loop_channel_init(channel + i);
+		writer[i] = sme_msg_writer_new((SmeChannel*) (channel + i));
+		reader[i] = sme_msg_reader_new
+			((SmeChannel*) (channel + i), recvd[i].parent);
+
+		sme_msg_writer_add_prepared(writer[i], prepared);
+	}
+	sme_prepared_msg_unref(prepared);
+
+	for (i = 0; i < N_FANOUT; i++)
+	{
+		sme_channel_write((SmeChannel*) (channel + i));
+		assert_equals_int(sme_msg_writer_get_queue_len(writer[i]), 0);
+
+		for (j = 0; j < 15 && ! recvd[i].buf; j++)
+			sme_channel_read((SmeChannel*) (channel + i));
+		if (! recvd[i].buf)
+			sme_error("Cannot finish reading message");
+
+		assert_equals_msg(msg, recvd[i].buf);
+
+		mmc_msg_unref(recvd[i].buf);
+		sme_msg_reader_unref(reader[i]);
+		sme_msg_writer_unref(writer[i]);
+		sme_channel_unref((SmeChannel*) (channel + i));
+	}
+}
+
 //Message generator
 
 typedef struct 
@@ -373,6 +423,146 @@ MmcMsg* create_msg(int offset)
 	return create_msg_rec(offset, &byte_offset);
 }
 
+//Small blocks are copied after the preamble
+void testcase_inline_one(MmcMsg *msg, size_t threshold, int n_blocks)
+{
+	TestReaderNotify recvd[1];
+	LoopChannel channel[1];
+	SmeMsgWriter *writer;
+	SmeMsgReader *reader;
+	SmePreparedMsg *prepared;
+	int i;
+
+	test_reader_notify_init(recvd);
+	loop_channel_init(channel);
+	writer = sme_msg_writer_new((SmeChannel*) channel);
+	reader = sme_msg_reader_new((SmeChannel*) channel, recvd->parent);
+
+	prepared = sme_prepared_msg_new_inline(msg, threshold);
+	sme_msg_writer_add_prepared(writer, prepared);
+	sme_prepared_msg_unref(prepared);
+	assert_equals_int(channel->last_n_blocks, n_blocks);
+
+	sme_channel_write((SmeChannel*) channel);
+	for (i = 0; i < 15 && ! recvd->buf; i++)
+		sme_channel_read((SmeChannel*) channel);
+	if (! recvd->buf)
+		sme_error("Cannot finish reading message");
+
+	assert_equals_msg(msg, recvd->buf);
+
+	mmc_msg_unref(recvd->buf);
+	sme_msg_reader_unref(reader);
+	sme_msg_writer_unref(writer);
+	sme_channel_unref((SmeChannel*) channel);
+}
+
+void testcase_inline()
+{
+	static const int sizes[] = {2, 10, 0, 3};
+	MmcMsg *msg;
+	int i, offset = 0;
+
+	//Root block of 3 bytes with 4 submessages
+	msg = mmc_msg_newa(3, 4);
+	memcpy(msg->mem, data, 3);
+	offset = 3;
+	for (i = 0; i < 4; i++)
+	{
+		msg->submsgs[i] = mmc_msg_newa(sizes[i], 0);
+		memcpy(msg->submsgs[i]->mem, data + offset, sizes[i]);
+		offset += sizes[i];
+	}
+
+	//Preamble, 4 non-empty blocks
+	testcase_inline_one(msg, 0, 5);
+	//Everything in one
+	testcase_inline_one(msg, SME_MSG_INLINE_THRESHOLD, 1);
+	//Preamble with root and 2 bytes, 10 bytes, copy of 3 bytes
+	testcase_inline_one(msg, 5, 3);
+	//Preamble, root, copy of 2 bytes, 10 bytes, 3 bytes
+	testcase_inline_one(msg, 3, 5);
+
+	mmc_msg_unref(msg);
+}
+
+//Round trip over a socketpair, for messages too large for LoopChannel
+void testcase_socket(MmcMsg *msg, size_t threshold)
+{
+	TestReaderNotify recvd[1];
+	int fds[2];
+	SmeChannel *wch, *rch;
+	SmeMsgWriter *writer;
+	SmeMsgReader *reader;
+	SmePreparedMsg *prepared;
+	int i;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		sme_error("socketpair() failed");
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	test_reader_notify_init(recvd);
+	wch = (SmeChannel *) sme_fd_channel_new(fds[0]);
+	rch = (SmeChannel *) sme_fd_channel_new(fds[1]);
+	writer = sme_msg_writer_new(wch);
+	reader = sme_msg_reader_new(rch, recvd->parent);
+
+	prepared = sme_prepared_msg_new_inline(msg, threshold);
+	sme_msg_writer_add_prepared(writer, prepared);
+	sme_prepared_msg_unref(prepared);
+
+	for (i = 0; i < 1000 && ! recvd->buf; i++)
+	{
+		sme_channel_write(wch);
+		sme_channel_read(rch);
+	}
+	if (! recvd->buf)
+		sme_error("Cannot finish reading message");
+
+	assert_equals_msg(msg, recvd->buf);
+
+	mmc_msg_unref(recvd->buf);
+	sme_msg_reader_unref(reader);
+	sme_msg_writer_unref(writer);
+	sme_channel_unref(wch);
+	sme_channel_unref(rch);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+//Messages larger than the encoder's initial arrays
+void testcase_large()
+{
+	MmcMsg *msg, *node;
+	int i;
+
+	//Wide: 150 submessages of a byte, each with an empty one
+	msg = mmc_msg_newa(0, 150);
+	for (i = 0; i < 150; i++)
+	{
+		msg->submsgs[i] = mmc_msg_newa(1, 1);
+		((char *) msg->submsgs[i]->mem)[0] = data[i % 26];
+		msg->submsgs[i]->submsgs[0] = mmc_msg_newa(0, 0);
+	}
+	testcase_socket(msg, 0);
+	testcase_socket(msg, SME_MSG_INLINE_THRESHOLD);
+	mmc_msg_unref(msg);
+
+	//Deep: chain of 100 messages
+	msg = node = mmc_msg_newa(2, 1);
+	memcpy(msg->mem, data, 2);
+	for (i = 1; i < 100; i++)
+	{
+		node->submsgs[0] = mmc_msg_newa(2, i < 99 ? 1 : 0);
+		node = node->submsgs[0];
+		memcpy(node->mem, data + (i % 20), 2);
+	}
+	testcase_socket(msg, 0);
+	testcase_socket(msg, SME_MSG_INLINE_THRESHOLD);
+	mmc_msg_unref(msg);
+}
+
 int main()
 {
 	msg_spec_array_init(msg_spec_array);
@@ -391,11 +581,15 @@ int main()
 		MmcMsg *msg = create_msg(i);
 
 		testcase(msg);
+		testcase_prepared(msg);
 
 		mmc_msg_unref(msg);
 	}
 
 	free(msg_spec_array->data);
 
+	testcase_inline();
+	testcase_large();
+
 	return 0;
 }
@@ -0,0 +1,198 @@
+/* test_mt_send.c
+ * Unit test for thread-safe sending in channel_link.c
+ *
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ *
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sme/sme.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+
+#define assert_equals_int(a, b) \
+	do {\
+		int64_t _a = (a); \
+		int64_t _b = (b); \
+		if (_a != _b) \
+		{ \
+			sme_error("Assertion failed a == b (a = %" PRId64 ", " \
+					"b = %" PRId64 ")", \
+					_a, _b); \
+		} \
+	} while (0)
+
+#define N_THREADS 4
+#define N_MSGS_PER_THREAD 2000
+#define N_MSGS (N_THREADS * N_MSGS_PER_THREAD)
+
+typedef struct
+{
+	uint32_t thread;
+	uint32_t seq;
+} Payload;
+
+SmeChannelLink *mt_link;
+atomic_int n_finished;
+
+//Next sequence number expected from each thread
+uint32_t expected[N_THREADS];
+int n_recvd;
+
+void test_notify_call(MmcMsg *msg, void *data)
+{
+	Payload payload;
+
+	assert_equals_int(msg->mem_len, sizeof(Payload));
+	memcpy(&payload, msg->mem, sizeof(Payload));
+	sme_assert(payload.thread < N_THREADS, "Invalid thread");
+
+	//Messages of one thread arrive in order
+	assert_equals_int(payload.seq, expected[payload.thread]);
+	expected[payload.thread]++;
+	n_recvd++;
+
+	mmc_msg_unref(msg);
+}
+
+void *producer(void *data)
+{
+	Payload payload;
+	MmcMsg *msg;
+	uint32_t i;
+
+	payload.thread = (uintptr_t) data;
+	for (i = 0; i < N_MSGS_PER_THREAD; i++)
+	{
+		payload.seq = i;
+		msg = mmc_msg_newa(sizeof(Payload), 0);
+		memcpy(msg->mem, &payload, sizeof(Payload));
+		sme_channel_link_send_mt(mt_link, msg);
+	}
+
+	atomic_fetch_add(&n_finished, 1);
+	return NULL;
+}
+
+static void start_producers(pthread_t *threads)
+{
+	uintptr_t i;
+
+	atomic_store(&n_finished, 0);
+	memset(expected, 0, sizeof(expected));
+	n_recvd = 0;
+
+	for (i = 0; i < N_THREADS; i++)
+	{
+		if (pthread_create(threads + i, NULL, producer, (void *) i) != 0)
+			sme_error("pthread_create() failed");
+	}
+}
+
+static void join_producers(pthread_t *threads)
+{
+	int i;
+
+	for (i = 0; i < N_THREADS; i++)
+		pthread_join(threads[i], NULL);
+}
+
+static void pump(struct ev_loop *loop, SmeChannel *wch, SmeChannel *rch)
+{
+	int i;
+
+	for (i = 0; i < 1000000 && n_recvd < N_MSGS; i++)
+	{
+		ev_run(loop, EVRUN_NOWAIT);
+		sme_channel_write(wch);
+		sme_channel_read(rch);
+	}
+}
+
+int main()
+{
+	int fds[2];
+	struct ev_loop *loop;
+	SmeChannel *wch, *rch;
+	SmeMsgReader *reader;
+	SmeMsgReaderNotify notify = {test_notify_call, NULL};
+	pthread_t threads[N_THREADS];
+	size_t n_wakeups;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		sme_error("socketpair() failed");
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	loop = ev_loop_new(EVFLAG_AUTO);
+	wch = (SmeChannel *) sme_fd_channel_new(fds[0]);
+	rch = (SmeChannel *) sme_fd_channel_new(fds[1]);
+	mt_link = sme_channel_link_new(wch);
+	reader = sme_msg_reader_new(rch, notify);
+
+	sme_channel_link_start_mt_send(mt_link, loop);
+
+	//Everything sent while the loop thread is busy is one batch
+	start_producers(threads);
+	join_producers(threads);
+	pump(loop, wch, rch);
+	assert_equals_int(n_recvd, N_MSGS);
+	assert_equals_int(sme_channel_link_get_n_mt_wakeups(mt_link), 1);
+
+	//Loop thread running concurrently with producers
+	start_producers(threads);
+	while (atomic_load(&n_finished) < N_THREADS)
+	{
+		ev_run(loop, EVRUN_NOWAIT);
+		sme_channel_write(wch);
+		sme_channel_read(rch);
+	}
+	join_producers(threads);
+	pump(loop, wch, rch);
+	assert_equals_int(n_recvd, N_MSGS);
+	n_wakeups = sme_channel_link_get_n_mt_wakeups(mt_link) - 1;
+	sme_assert(n_wakeups >= 1 && n_wakeups <= N_MSGS,
+			"Unexpected number of wakeups");
+
+	//Messages still queued when stopping are sent
+	start_producers(threads);
+	join_producers(threads);
+	sme_channel_link_stop_mt_send(mt_link);
+	pump(loop, wch, rch);
+	assert_equals_int(n_recvd, N_MSGS);
+	assert_equals_int(sme_channel_link_get_n_mt_wakeups(mt_link), n_wakeups + 1);
+
+	//Can be started again
+	sme_channel_link_start_mt_send(mt_link, loop);
+	start_producers(threads);
+	join_producers(threads);
+
+	//Destroying the mt_link releases queued messages
+	sme_link_unref((SmeLink *) mt_link);
+
+	sme_msg_reader_unref(reader);
+	sme_channel_unref(wch);
+	sme_channel_unref(rch);
+	ev_loop_destroy(loop);
+	close(fds[0]);
+	close(fds[1]);
+
+	return 0;
+}
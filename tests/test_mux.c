@@ -0,0 +1,197 @@
+/* test_mux.c
+ * Unit test for mux.c
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sme/sme.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define assert_equals_int(a, b) \
+	do {\
+		int64_t _a = (a); \
+		int64_t _b = (b); \
+		if (_a != _b) \
+		{ \
+			sme_error("Assertion failed a == b (a = %" PRId64 ", " \
+					"b = %" PRId64 ")", \
+					_a, _b); \
+		} \
+	} while (0)
+
+#define N_STREAMS 3
+#define BULK_SIZE (SME_MUX_CHUNK_SIZE * 10 + 123)
+#define N_SMALL 5
+
+//Messages received in order
+#define MAX_RECVD 16
+MmcMsg *recvd[MAX_RECVD];
+int n_recvd;
+
+void test_notify_call(MmcMsg *msg, void *data)
+{
+	sme_assert(n_recvd < MAX_RECVD, "Capacity exceeded");
+	recvd[n_recvd++] = msg;
+}
+
+MmcMsg *create_msg(size_t size, char fill, int n_submsg)
+{
+	MmcMsg *msg = mmc_msg_newa(size, n_submsg);
+	int i;
+
+	memset(msg->mem, fill, size);
+	for (i = 0; i < n_submsg; i++)
+		msg->submsgs[i] = create_msg(i + 1, fill + i + 1, 0);
+
+	return msg;
+}
+
+void assert_msg_filled(MmcMsg *msg, size_t size, char fill)
+{
+	size_t i;
+
+	assert_equals_int(msg->mem_len, size);
+	for (i = 0; i < size; i++)
+		assert_equals_int(((char *) msg->mem)[i], fill);
+}
+
+void testcase(int crc)
+{
+	int fds[2];
+	SmeChannel *wch, *rch;
+	SmeMuxWriter *writer;
+	SmeMuxReader *reader;
+	SmeMsgReaderNotify notify = {test_notify_call, NULL};
+	MmcMsg *bulk, *small;
+	SmePreparedMsg *prepared;
+	int i;
+
+	n_recvd = 0;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		sme_error("socketpair() failed");
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	wch = (SmeChannel *) sme_fd_channel_new(fds[0]);
+	rch = (SmeChannel *) sme_fd_channel_new(fds[1]);
+	writer = sme_mux_writer_new(wch, N_STREAMS);
+	reader = sme_mux_reader_new(rch, N_STREAMS, notify);
+	sme_mux_writer_set_crc(writer, crc);
+	sme_mux_reader_set_crc(reader, crc);
+
+	//Large message first, small messages on another stream after it
+	bulk = create_msg(BULK_SIZE, 'B', 2);
+	sme_mux_writer_add_msg(writer, 2, bulk);
+	mmc_msg_unref(bulk);
+	for (i = 0; i < N_SMALL; i++)
+	{
+		small = create_msg(10, 'a' + i, 1);
+		prepared = sme_prepared_msg_new(small);
+		sme_mux_writer_add_prepared(writer, 0, prepared);
+		sme_prepared_msg_unref(prepared);
+		mmc_msg_unref(small);
+	}
+	assert_equals_int(sme_mux_writer_get_queue_len(writer, 1), 0);
+
+	//Pump
+	for (i = 0; i < 10000 && n_recvd < N_SMALL + 1; i++)
+	{
+		sme_channel_write(wch);
+		sme_channel_read(rch);
+	}
+	assert_equals_int(n_recvd, N_SMALL + 1);
+	assert_equals_int(sme_mux_writer_get_queue_len(writer, 0), 0);
+	assert_equals_int(sme_mux_writer_get_queue_len(writer, 2), 0);
+
+	//Small messages must not wait for the whole bulk message
+	for (i = 0; i < N_SMALL; i++)
+	{
+		assert_msg_filled(recvd[i], 10, 'a' + i);
+		assert_equals_int(recvd[i]->submsgs_len, 1);
+		assert_msg_filled(recvd[i]->submsgs[0], 1, 'a' + i + 1);
+	}
+	assert_msg_filled(recvd[N_SMALL], BULK_SIZE, 'B');
+	assert_equals_int(recvd[N_SMALL]->submsgs_len, 2);
+	assert_msg_filled(recvd[N_SMALL]->submsgs[1], 2, 'B' + 2);
+
+	for (i = 0; i < n_recvd; i++)
+		mmc_msg_unref(recvd[i]);
+
+	sme_mux_writer_unref(writer);
+	sme_mux_reader_unref(reader);
+	sme_channel_unref(wch);
+	sme_channel_unref(rch);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+//Reader expecting a trailer that is not there delivers nothing
+void testcase_crc_mismatch()
+{
+	int fds[2];
+	SmeChannel *wch, *rch;
+	SmeMuxWriter *writer;
+	SmeMuxReader *reader;
+	SmeMsgReaderNotify notify = {test_notify_call, NULL};
+	MmcMsg *msg;
+	int i;
+
+	n_recvd = 0;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		sme_error("socketpair() failed");
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	wch = (SmeChannel *) sme_fd_channel_new(fds[0]);
+	rch = (SmeChannel *) sme_fd_channel_new(fds[1]);
+	writer = sme_mux_writer_new(wch, N_STREAMS);
+	reader = sme_mux_reader_new(rch, N_STREAMS, notify);
+	sme_mux_reader_set_crc(reader, 1);
+
+	msg = create_msg(100, 'x', 1);
+	sme_mux_writer_add_msg(writer, 1, msg);
+	mmc_msg_unref(msg);
+
+	for (i = 0; i < 100; i++)
+	{
+		sme_channel_write(wch);
+		sme_channel_read(rch);
+	}
+	assert_equals_int(n_recvd, 0);
+
+	sme_mux_writer_unref(writer);
+	sme_mux_reader_unref(reader);
+	sme_channel_unref(wch);
+	sme_channel_unref(rch);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int main()
+{
+	testcase(0);
+	testcase(1);
+	testcase_crc_mismatch();
+
+	return 0;
+}
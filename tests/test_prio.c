@@ -0,0 +1,172 @@
+/* test_prio.c
+ * Unit test for priority classes in message writer
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sme/sme.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#define assert_equals_int(a, b) \
+	do {\
+		int64_t _a = (a); \
+		int64_t _b = (b); \
+		if (_a != _b) \
+		{ \
+			sme_error("Assertion failed a == b (a = %" PRId64 ", " \
+					"b = %" PRId64 ")", \
+					_a, _b); \
+		} \
+	} while (0)
+
+#define BULK_SIZE 1000000
+#define N_BULK 3
+
+//First byte of each received message
+#define MAX_RECVD 16
+char recvd[MAX_RECVD];
+int n_recvd;
+
+void test_notify_call(MmcMsg *msg, void *data)
+{
+	sme_assert(n_recvd < MAX_RECVD, "Capacity exceeded");
+	recvd[n_recvd++] = ((char *) msg->mem)[0];
+	mmc_msg_unref(msg);
+}
+
+void send_msg(SmeMsgWriter *writer, size_t size, char fill, int prio)
+{
+	MmcMsg *msg = mmc_msg_newa(size, 0);
+
+	memset(msg->mem, fill, size);
+	sme_msg_writer_add_msg_prio(writer, msg, prio);
+	mmc_msg_unref(msg);
+}
+
+void produce(size_t block, size_t offset, void *buf, size_t len, void *data)
+{
+	memset(buf, 'g', len);
+}
+
+void pump(SmeChannel *wch, SmeChannel *rch, int n)
+{
+	int i;
+
+	for (i = 0; i < 100000 && n_recvd < n; i++)
+	{
+		sme_channel_write(wch);
+		sme_channel_read(rch);
+	}
+	assert_equals_int(n_recvd, n);
+}
+
+void testcase(SmeChannel *wch, SmeChannel *rch, SmeMsgWriter *writer)
+{
+	int i;
+
+	n_recvd = 0;
+
+	//Queue bulk messages and start writing the first one
+	for (i = 0; i < N_BULK; i++)
+		send_msg(writer, BULK_SIZE, 'A' + i, SME_MSG_WRITER_DEFAULT_PRIO);
+	sme_channel_write(wch);
+	assert_equals_int(sme_msg_writer_get_queue_len(writer), N_BULK);
+
+	//Urgent messages go after the started message
+	send_msg(writer, 10, 'x', 0);
+	send_msg(writer, 10, 'y', 1);
+	send_msg(writer, 10, 'z', 0);
+	assert_equals_int(sme_msg_writer_get_prio_queue_len(writer, 0), 2);
+	assert_equals_int(sme_msg_writer_get_prio_queue_len(writer, 1), 1);
+	assert_equals_int(sme_msg_writer_get_prio_queue_len
+			(writer, SME_MSG_WRITER_DEFAULT_PRIO), N_BULK);
+
+	pump(wch, rch, N_BULK + 3);
+	assert_equals_int(sme_msg_writer_get_queue_len(writer), 0);
+	assert_equals_int(sme_msg_writer_get_prio_queue_len(writer, 0), 0);
+
+	if (memcmp(recvd, "AxzyBC", N_BULK + 3) != 0)
+		sme_error("Unexpected order %.*s", N_BULK + 3, recvd);
+}
+
+void testcase_generated(SmeChannel *wch, SmeChannel *rch, SmeMsgWriter *writer)
+{
+	uint32_t layout[2];
+	SmeMsgProducer producer = {produce, NULL, NULL};
+	int i;
+
+	n_recvd = 0;
+
+	for (i = 0; i < N_BULK; i++)
+		send_msg(writer, BULK_SIZE, 'A' + i, SME_MSG_WRITER_DEFAULT_PRIO);
+	sme_channel_write(wch);
+
+	//Urgent generated message goes after the started message, 
+	//less urgent messages behind it are held back
+	layout[0] = ssc_uint32_to_le(BULK_SIZE);
+	layout[1] = 0;
+	assert_equals_int(sme_msg_writer_add_generated
+			(writer, layout, 2, 0, producer, 4096), 0);
+	assert_equals_int(sme_msg_writer_get_prio_queue_len(writer, 0), 1);
+	assert_equals_int(sme_msg_writer_get_prio_queue_len
+			(writer, SME_MSG_WRITER_DEFAULT_PRIO), 1);
+
+	//Messages added meanwhile are queued by priority once it is done
+	send_msg(writer, 10, 'y', 1);
+	send_msg(writer, 10, 'x', 0);
+
+	pump(wch, rch, N_BULK + 3);
+	assert_equals_int(sme_msg_writer_get_queue_len(writer), 0);
+	assert_equals_int(sme_msg_writer_get_prio_queue_len(writer, 0), 0);
+
+	if (memcmp(recvd, "AgxyBC", N_BULK + 3) != 0)
+		sme_error("Unexpected order %.*s", N_BULK + 3, recvd);
+}
+
+int main()
+{
+	int fds[2];
+	SmeChannel *wch, *rch;
+	SmeMsgWriter *writer;
+	SmeMsgReader *reader;
+	SmeMsgReaderNotify notify = {test_notify_call, NULL};
+	int sndbuf = 65536;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		sme_error("socketpair() failed");
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+	wch = (SmeChannel *) sme_fd_channel_new(fds[0]);
+	rch = (SmeChannel *) sme_fd_channel_new(fds[1]);
+	writer = sme_msg_writer_new(wch);
+	reader = sme_msg_reader_new(rch, notify);
+
+	testcase(wch, rch, writer);
+	testcase_generated(wch, rch, writer);
+
+	sme_msg_writer_unref(writer);
+	sme_msg_reader_unref(reader);
+	sme_channel_unref(wch);
+	sme_channel_unref(rch);
+
+	return 0;
+}
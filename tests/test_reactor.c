@@ -0,0 +1,162 @@
+/* test_reactor.c
+ * Unit test for reactor.c
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sme/sme.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define assert_equals_int(a, b) \
+	do {\
+		int64_t _a = (a); \
+		int64_t _b = (b); \
+		if (_a != _b) \
+		{ \
+			sme_error("Assertion failed a == b (a = %" PRId64 ", " \
+					"b = %" PRId64 ")", \
+					_a, _b); \
+		} \
+	} while (0)
+
+#define TICK 1000000
+#define N_MSGS 20
+#define LARGE_SIZE 1000000
+
+MmcMsg *recvd[N_MSGS];
+int n_recvd;
+
+void test_notify_call(MmcMsg *msg, void *data)
+{
+	SmeReactor *reactor = data;
+
+	sme_assert(n_recvd < N_MSGS, "Capacity exceeded");
+	recvd[n_recvd++] = msg;
+	if (n_recvd == N_MSGS)
+		sme_reactor_stop(reactor);
+}
+
+int n_failed;
+
+void test_failed(SmeChannel *channel, void *ptr)
+{
+	n_failed++;
+}
+
+int n_fired;
+
+void test_timer_cb(SmeTimer *timer, void *data)
+{
+	SmeReactor *reactor = data;
+
+	n_fired++;
+	sme_reactor_stop(reactor);
+}
+
+int main()
+{
+	int fds[2];
+	SmeReactor *reactor;
+	SmeFdChannel *wch, *rch;
+	SmeMsgWriter *writer;
+	SmeMsgReader *reader;
+	SmeMsgReaderNotify notify = {test_notify_call, NULL};
+	SmeChannelCB cb = {NULL, test_failed};
+	MmcMsg *sent[N_MSGS];
+	SmeTimer timer;
+	uint64_t start;
+	size_t size;
+	int i;
+
+	reactor = sme_reactor_new(TICK);
+	if (! reactor)
+		sme_error("sme_reactor_new() failed");
+	notify.data = reactor;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		sme_error("socketpair() failed");
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	wch = sme_fd_channel_new(fds[0]);
+	rch = sme_fd_channel_new(fds[1]);
+	writer = sme_msg_writer_new((SmeChannel *) wch);
+	reader = sme_msg_reader_new((SmeChannel *) rch, notify);
+
+	assert_equals_int(sme_reactor_add_channel(reactor, wch, cb), 0);
+	assert_equals_int(sme_reactor_add_channel(reactor, rch, cb), 0);
+	assert_equals_int(sme_reactor_get_n_channels(reactor), 2);
+
+	//Large messages do not fit in the socket buffer, so the writer
+	//has to wait for edges while the lane is not empty
+	for (i = 0; i < N_MSGS; i++)
+	{
+		size = i % 4 == 0 ? LARGE_SIZE : 100 + i;
+		sent[i] = mmc_msg_newa(size, 0);
+		memset(sent[i]->mem, 'a' + i, size);
+	}
+
+	//Jobs added before and while running
+	sme_msg_writer_add_msg(writer, sent[0]);
+	for (i = 0; i < 10000 && n_recvd < N_MSGS; i++)
+	{
+		if (i + 1 < N_MSGS)
+			sme_msg_writer_add_msg(writer, sent[i + 1]);
+		assert_equals_int(sme_reactor_run_once(reactor, 1000) >= 0, 1);
+	}
+	assert_equals_int(n_recvd, N_MSGS);
+
+	for (i = 0; i < N_MSGS; i++)
+	{
+		assert_equals_int(sent[i]->mem_len, recvd[i]->mem_len);
+		if (memcmp(sent[i]->mem, recvd[i]->mem, sent[i]->mem_len) != 0)
+			sme_error("Unequal memory blocks");
+		mmc_msg_unref(sent[i]);
+		mmc_msg_unref(recvd[i]);
+	}
+
+	//Timers
+	sme_timer_init(&timer, test_timer_cb, reactor);
+	start = sme_latency_now();
+	sme_timer_wheel_add
+		(sme_reactor_get_timer_wheel(reactor), &timer, start + 5 * TICK);
+	assert_equals_int(sme_reactor_run(reactor), 0);
+	assert_equals_int(n_fired, 1);
+	sme_assert(sme_latency_now() - start >= 5 * TICK, "Timer fired early");
+
+	//Peer closing is reported once, and the channel is removed
+	sme_reactor_remove_channel(reactor, wch);
+	assert_equals_int(sme_reactor_get_n_channels(reactor), 1);
+	close(fds[0]);
+	for (i = 0; i < 100 && n_failed == 0; i++)
+		sme_reactor_run_once(reactor, 10);
+	assert_equals_int(n_failed, 1);
+	assert_equals_int(sme_reactor_get_n_channels(reactor), 0);
+
+	sme_msg_reader_unref(reader);
+	sme_msg_writer_unref(writer);
+	sme_channel_unref((SmeChannel *) wch);
+	sme_channel_unref((SmeChannel *) rch);
+	sme_reactor_unref(reactor);
+	close(fds[1]);
+
+	return 0;
+}
@@ -0,0 +1,250 @@
+/* test_relay.c
+ * Unit test for relay.c
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sme/sme.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#define assert_equals_int(a, b) \
+	do {\
+		int64_t _a = (a); \
+		int64_t _b = (b); \
+		if (_a != _b) \
+		{ \
+			sme_error("Assertion failed a == b (a = %" PRId64 ", " \
+					"b = %" PRId64 ")", \
+					_a, _b); \
+		} \
+	} while (0)
+
+#define N_MSGS 8
+
+//Message sizes, including some larger than socket buffers
+static const size_t msg_sizes[N_MSGS] = 
+	{0, 1, 100, 65536, 3000000, 7, 200000, 12};
+
+MmcMsg *recvd[N_MSGS];
+int n_recvd;
+
+void test_notify_call(MmcMsg *msg, void *data)
+{
+	sme_assert(n_recvd < N_MSGS, "Capacity exceeded");
+	recvd[n_recvd++] = msg;
+}
+
+MmcMsg *create_msg(int idx)
+{
+	MmcMsg *msg = mmc_msg_newa(msg_sizes[idx], 1);
+	size_t i;
+
+	for (i = 0; i < msg_sizes[idx]; i++)
+		((char *) msg->mem)[i] = (char) (i * 7 + idx);
+	msg->submsgs[0] = mmc_msg_newa(idx, 0);
+	memset(msg->submsgs[0]->mem, 'a' + idx, idx);
+
+	return msg;
+}
+
+void assert_equals_msg(MmcMsg* a, MmcMsg* b)
+{
+	int i;
+
+	assert_equals_int(a->mem_len, b->mem_len);
+	if (a->mem_len > 0)
+	{
+		if (memcmp(a->mem, b->mem, a->mem_len) != 0)
+			sme_error("Unequal memory blocks");
+	}
+
+	assert_equals_int(a->submsgs_len, b->submsgs_len);
+	for (i = 0; i < a->submsgs_len; i++)
+		assert_equals_msg(a->submsgs[i], b->submsgs[i]);
+}
+
+static void make_pair(int *fds)
+{
+	int sndbuf = 32768;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		sme_error("socketpair() failed");
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+}
+
+void testcase(int crc)
+{
+	int in_fds[2], out_fds[2];
+	SmeChannel *wch, *rch;
+	SmeMsgWriter *writer;
+	SmeMsgReader *reader;
+	SmeRelay *relay;
+	SmeMsgReaderNotify notify = {test_notify_call, NULL};
+	MmcMsg *sent[N_MSGS];
+	SmeRelayStatus status;
+	int i;
+
+	make_pair(in_fds);
+	make_pair(out_fds);
+
+	wch = (SmeChannel *) sme_fd_channel_new(in_fds[0]);
+	rch = (SmeChannel *) sme_fd_channel_new(out_fds[1]);
+	writer = sme_msg_writer_new(wch);
+	reader = sme_msg_reader_new(rch, notify);
+	relay = sme_relay_new(in_fds[1], out_fds[0]);
+	sme_msg_writer_set_crc(writer, crc);
+	sme_msg_reader_set_crc(reader, crc);
+	sme_relay_set_crc(relay, crc);
+	n_recvd = 0;
+
+	for (i = 0; i < N_MSGS; i++)
+	{
+		sent[i] = create_msg(i);
+		sme_msg_writer_add_msg(writer, sent[i]);
+	}
+
+	//Pump
+	for (i = 0; i < 100000 && n_recvd < N_MSGS; i++)
+	{
+		sme_channel_write(wch);
+		status = sme_relay_run(relay);
+		assert_equals_int(status == SME_RELAY_ERROR, 0);
+		sme_channel_read(rch);
+	}
+	assert_equals_int(n_recvd, N_MSGS);
+	assert_equals_int(sme_relay_get_n_msgs(relay), N_MSGS);
+
+	for (i = 0; i < N_MSGS; i++)
+	{
+		assert_equals_msg(sent[i], recvd[i]);
+		mmc_msg_unref(sent[i]);
+		mmc_msg_unref(recvd[i]);
+	}
+
+	//End of stream
+	sme_msg_writer_unref(writer);
+	sme_channel_unref(wch);
+	close(in_fds[0]);
+	assert_equals_int(sme_relay_run(relay), SME_RELAY_CLOSED);
+
+	sme_relay_unref(relay);
+	sme_msg_reader_unref(reader);
+	sme_channel_unref(rch);
+	close(in_fds[1]);
+	close(out_fds[0]);
+	close(out_fds[1]);
+}
+
+//Layout that claims more submessages than it holds
+void testcase_malformed()
+{
+	int in_fds[2], out_fds[2];
+	uint32_t data[] = {4, 0, 2, 5, 0};
+	SmeRelay *relay;
+
+	make_pair(in_fds);
+	make_pair(out_fds);
+	relay = sme_relay_new(in_fds[1], out_fds[0]);
+
+	if (write(in_fds[0], data, sizeof(data)) != sizeof(data))
+		sme_error("write() failed");
+	assert_equals_int(sme_relay_run(relay), SME_RELAY_ERROR);
+	assert_equals_int(sme_relay_get_n_bytes(relay), 0);
+
+	sme_relay_unref(relay);
+	close(in_fds[0]);
+	close(in_fds[1]);
+	close(out_fds[0]);
+	close(out_fds[1]);
+}
+
+//Layouts longer than the limit are refused before allocating
+void testcase_too_large()
+{
+	int in_fds[2], out_fds[2];
+	uint32_t huge = ssc_uint32_to_le(0xffffffff);
+	SmeRelay *relay;
+
+	make_pair(in_fds);
+	make_pair(out_fds);
+	relay = sme_relay_new(in_fds[1], out_fds[0]);
+
+	if (write(in_fds[0], &huge, sizeof(huge)) != sizeof(huge))
+		sme_error("write() failed");
+	assert_equals_int(sme_relay_run(relay), SME_RELAY_ERROR);
+	assert_equals_int(sme_relay_get_n_bytes(relay), 0);
+
+	sme_relay_unref(relay);
+	close(in_fds[0]);
+	close(in_fds[1]);
+
+	//Configured limit: size and 20 layout entries do not fit in 80 bytes
+	make_pair(in_fds);
+	relay = sme_relay_new(in_fds[1], out_fds[0]);
+	sme_relay_set_max_header(relay, 20 * sizeof(uint32_t));
+
+	huge = ssc_uint32_to_le(20);
+	if (write(in_fds[0], &huge, sizeof(huge)) != sizeof(huge))
+		sme_error("write() failed");
+	assert_equals_int(sme_relay_run(relay), SME_RELAY_ERROR);
+
+	sme_relay_unref(relay);
+	close(in_fds[0]);
+	close(in_fds[1]);
+	close(out_fds[0]);
+	close(out_fds[1]);
+}
+
+//Out of descriptors: no relay, unless it does not need a pipe
+void testcase_no_fds()
+{
+	struct rlimit limit, saved_limit;
+	SmeRelay *relay;
+
+	getrlimit(RLIMIT_NOFILE, &saved_limit);
+	limit = saved_limit;
+	limit.rlim_cur = dup(0);
+	close(limit.rlim_cur);
+	setrlimit(RLIMIT_NOFILE, &limit);
+	errno = 0;
+	relay = sme_relay_new(0, 1);
+	setrlimit(RLIMIT_NOFILE, &saved_limit);
+
+	if (relay)
+		sme_relay_unref(relay);
+	else
+		assert_equals_int(errno, EMFILE);
+}
+
+int main()
+{
+	testcase(0);
+	testcase(1);
+	testcase_malformed();
+	testcase_too_large();
+	testcase_no_fds();
+
+	return 0;
+}
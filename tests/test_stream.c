@@ -0,0 +1,360 @@
+/* test_stream.c
+ * Unit test for streaming receive in msg.c
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sme/sme.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#define assert_equals_int(a, b) \
+	do {\
+		int64_t _a = (a); \
+		int64_t _b = (b); \
+		if (_a != _b) \
+		{ \
+			sme_error("Assertion failed a == b (a = %" PRId64 ", " \
+					"b = %" PRId64 ")", \
+					_a, _b); \
+		} \
+	} while (0)
+
+#define CHUNK_SIZE 4096
+#define N_SUBS 3
+
+//Root block and submessage blocks, one of them empty
+static const size_t block_sizes[N_SUBS + 1] = {5, 1000000, 0, 3 * CHUNK_SIZE};
+
+static char block_byte(size_t block, size_t offset)
+{
+	return (char) (offset * 7 + block);
+}
+
+MmcMsg *create_msg()
+{
+	MmcMsg *msg = mmc_msg_newa(block_sizes[0], N_SUBS);
+	size_t i, j;
+
+	for (j = 0; j < block_sizes[0]; j++)
+		((char *) msg->mem)[j] = block_byte(0, j);
+	for (i = 1; i <= N_SUBS; i++)
+	{
+		msg->submsgs[i - 1] = mmc_msg_newa(block_sizes[i], 0);
+		for (j = 0; j < block_sizes[i]; j++)
+			((char *) msg->submsgs[i - 1]->mem)[j] = block_byte(i, j);
+	}
+
+	return msg;
+}
+
+//Stream callbacks, checking data against non-empty blocks of create_msg()
+typedef struct
+{
+	int n_msgs;
+	size_t n_blocks;
+	int in_block;
+	size_t block;
+	size_t block_len;
+	size_t offset;
+	size_t n_chunks;
+} StreamState;
+
+static size_t nonempty_size(size_t index)
+{
+	size_t i;
+
+	for (i = 0; i <= N_SUBS; i++)
+	{
+		if (block_sizes[i] == 0)
+			continue;
+		if (index == 0)
+			return i;
+		index--;
+	}
+
+	sme_error("Invalid block index");
+	return 0;
+}
+
+void test_msg_begin(size_t n_blocks, void *data)
+{
+	StreamState *state = data;
+
+	state->n_blocks = n_blocks;
+	state->block = 0;
+}
+
+void test_block_begin(size_t index, size_t len, void *data)
+{
+	StreamState *state = data;
+
+	sme_assert(! state->in_block, "Nested block");
+	assert_equals_int(index, state->block);
+	assert_equals_int(len, block_sizes[nonempty_size(index)]);
+	state->in_block = 1;
+	state->block_len = len;
+	state->offset = 0;
+}
+
+void test_chunk(const void *mem, size_t len, void *data)
+{
+	StreamState *state = data;
+	size_t src = nonempty_size(state->block);
+	size_t i;
+
+	sme_assert(state->in_block, "Chunk outside a block");
+	sme_assert(len > 0 && len <= CHUNK_SIZE, "Bad chunk length %d", (int) len);
+	for (i = 0; i < len; i++)
+	{
+		if (((const char *) mem)[i] != block_byte(src, state->offset + i))
+			sme_error("Unequal data");
+	}
+	state->offset += len;
+	state->n_chunks++;
+}
+
+void test_block_end(size_t index, void *data)
+{
+	StreamState *state = data;
+
+	assert_equals_int(index, state->block);
+	assert_equals_int(state->offset, state->block_len);
+	state->in_block = 0;
+	state->block++;
+}
+
+void test_msg_end(void *data)
+{
+	StreamState *state = data;
+
+	assert_equals_int(state->block, state->n_blocks);
+	state->n_msgs++;
+}
+
+void test_notify_call(MmcMsg *msg, void *data)
+{
+	sme_error("Message delivered in streaming mode");
+}
+
+void testcase(int crc)
+{
+	int fds[2];
+	SmeFdChannel *wch, *rch;
+	SmeMsgWriter *writer;
+	SmeMsgReader *reader;
+	SmeMsgReaderNotify notify = {test_notify_call, NULL};
+	StreamState state;
+	SmeMsgReaderStream stream = {test_msg_begin, test_block_begin, 
+		test_chunk, test_block_end, test_msg_end, &state};
+	MmcMsg *msg, *empty;
+	size_t n_chunks;
+	int i;
+
+	memset(&state, 0, sizeof(state));
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		sme_error("socketpair() failed");
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	wch = sme_fd_channel_new(fds[0]);
+	rch = sme_fd_channel_new(fds[1]);
+	writer = sme_msg_writer_new((SmeChannel *) wch);
+	reader = sme_msg_reader_new((SmeChannel *) rch, notify);
+	sme_msg_reader_set_stream(reader, stream, CHUNK_SIZE);
+	sme_msg_writer_set_crc(writer, crc);
+	sme_msg_reader_set_crc(reader, crc);
+
+	//Message without blocks in between
+	msg = create_msg();
+	empty = mmc_msg_newa(0, 0);
+	sme_msg_writer_add_msg(writer, msg);
+	sme_msg_writer_add_msg(writer, empty);
+	sme_msg_writer_add_msg(writer, msg);
+	mmc_msg_unref(msg);
+	mmc_msg_unref(empty);
+
+	for (i = 0; i < 100000 && state.n_msgs < 3; i++)
+	{
+		sme_channel_write((SmeChannel *) wch);
+		sme_channel_read((SmeChannel *) rch);
+	}
+	assert_equals_int(state.n_msgs, 3);
+	assert_equals_int(sme_msg_reader_is_failed(reader), 0);
+
+	//Every block is read in as few chunks as possible
+	n_chunks = 0;
+	for (i = 0; i <= N_SUBS; i++)
+		n_chunks += (block_sizes[i] + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	assert_equals_int(state.n_chunks, 2 * n_chunks);
+
+	sme_msg_reader_unref(reader);
+	sme_msg_writer_unref(writer);
+	sme_channel_unref((SmeChannel *) wch);
+	sme_channel_unref((SmeChannel *) rch);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+//Message larger than the address space left to the process, 
+//written directly to the socket
+#define LARGE_N_BLOCKS 4
+#define LARGE_BLOCK_SIZE (64 * 1024 * 1024)
+#define LARGE_HEADROOM (128 * 1024 * 1024)
+#define LARGE_PATTERN 251
+
+typedef struct
+{
+	int n_msgs;
+	uint64_t n_bytes;
+} LargeState;
+
+void large_block_begin(size_t index, size_t len, void *data)
+{
+	assert_equals_int(len, LARGE_BLOCK_SIZE);
+}
+
+void large_chunk(const void *mem, size_t len, void *data)
+{
+	LargeState *state = data;
+
+	if (((const unsigned char *) mem)[0] != state->n_bytes % LARGE_PATTERN)
+		sme_error("Unequal data");
+	state->n_bytes += len;
+}
+
+void large_block_end(size_t index, void *data)
+{
+}
+
+void large_msg_end(void *data)
+{
+	LargeState *state = data;
+
+	state->n_msgs++;
+}
+
+//Keeps address space within what the process uses now plus headroom.
+//AddressSanitizer reserves too much address space for this.
+static void limit_address_space()
+{
+#ifndef __SANITIZE_ADDRESS__
+	struct rlimit limit;
+	unsigned long vm_pages;
+	FILE *statm;
+
+	statm = fopen("/proc/self/statm", "r");
+	if (! statm)
+		return;
+	if (fscanf(statm, "%lu", &vm_pages) != 1)
+		vm_pages = 0;
+	fclose(statm);
+	if (! vm_pages)
+		return;
+
+	getrlimit(RLIMIT_AS, &limit);
+	limit.rlim_cur = vm_pages * sysconf(_SC_PAGESIZE) + LARGE_HEADROOM;
+	setrlimit(RLIMIT_AS, &limit);
+#endif
+}
+
+void testcase_large()
+{
+	int fds[2];
+	SmeFdChannel *rch;
+	SmeMsgReader *reader;
+	SmeMsgReaderNotify notify = {test_notify_call, NULL};
+	LargeState state;
+	SmeMsgReaderStream stream = {NULL, large_block_begin, 
+		large_chunk, large_block_end, large_msg_end, &state};
+	uint32_t preamble[3 + 2 * LARGE_N_BLOCKS];
+	static unsigned char pattern[65536 + LARGE_PATTERN];
+	uint64_t total = (uint64_t) LARGE_N_BLOCKS * LARGE_BLOCK_SIZE;
+	uint64_t written;
+	size_t preamble_done, len;
+	ssize_t res;
+	int i;
+
+	memset(&state, 0, sizeof(state));
+	for (i = 0; i < sizeof(pattern); i++)
+		pattern[i] = i % LARGE_PATTERN;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		sme_error("socketpair() failed");
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	rch = sme_fd_channel_new(fds[1]);
+	reader = sme_msg_reader_new((SmeChannel *) rch, notify);
+	sme_msg_reader_set_stream(reader, stream, CHUNK_SIZE);
+
+	//Empty root with large submessages
+	preamble[0] = ssc_uint32_to_le(2 + 2 * LARGE_N_BLOCKS);
+	preamble[1] = ssc_uint32_to_le(0);
+	preamble[2] = ssc_uint32_to_le(LARGE_N_BLOCKS);
+	for (i = 0; i < LARGE_N_BLOCKS; i++)
+	{
+		preamble[3 + 2 * i] = ssc_uint32_to_le(LARGE_BLOCK_SIZE);
+		preamble[4 + 2 * i] = ssc_uint32_to_le(0);
+	}
+
+	limit_address_space();
+
+	preamble_done = 0;
+	written = 0;
+	while (state.n_msgs == 0)
+	{
+		if (preamble_done < sizeof(preamble))
+		{
+			res = write(fds[0], (char *) preamble + preamble_done, 
+					sizeof(preamble) - preamble_done);
+			if (res > 0)
+				preamble_done += res;
+		}
+		else if (written < total)
+		{
+			len = 65536;
+			if (len > total - written)
+				len = total - written;
+			res = write(fds[0], pattern + written % LARGE_PATTERN, len);
+			if (res > 0)
+				written += res;
+		}
+		sme_channel_read((SmeChannel *) rch);
+		assert_equals_int(sme_msg_reader_is_failed(reader), 0);
+	}
+	assert_equals_int(state.n_bytes, total);
+
+	sme_msg_reader_unref(reader);
+	sme_channel_unref((SmeChannel *) rch);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int main()
+{
+	testcase(0);
+	testcase(1);
+	testcase_large();
+
+	return 0;
+}
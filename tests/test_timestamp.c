@@ -0,0 +1,172 @@
+/* test_timestamp.c
+ * Unit test for kernel receive timestamps in fd_channel.c and msg.c
+ *
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ *
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sme/sme.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define assert_equals_int(a, b) \
+	do {\
+		int64_t _a = (a); \
+		int64_t _b = (b); \
+		if (_a != _b) \
+		{ \
+			sme_error("Assertion failed a == b (a = %" PRId64 ", " \
+					"b = %" PRId64 ")", \
+					_a, _b); \
+		} \
+	} while (0)
+
+#define N_MSGS 3
+
+SmeMsgReader *reader;
+uint64_t timestamps[N_MSGS];
+int n_recvd;
+
+void test_notify_call(MmcMsg *msg, void *data)
+{
+	sme_assert(n_recvd < N_MSGS, "Capacity exceeded");
+	timestamps[n_recvd++] = sme_msg_reader_get_rx_timestamp(reader);
+	mmc_msg_unref(msg);
+}
+
+//Connected pair of TCP sockets over loopback
+void tcp_pair(int fds[2])
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int lfd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = 0;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (lfd < 0
+		|| bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+		|| listen(lfd, 1) < 0
+		|| getsockname(lfd, (struct sockaddr *) &addr, &len) < 0)
+		sme_error("Cannot listen");
+
+	fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+	if (fds[0] < 0
+		|| connect(fds[0], (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		sme_error("connect() failed");
+	fds[1] = accept(lfd, NULL, NULL);
+	if (fds[1] < 0)
+		sme_error("accept() failed");
+	close(lfd);
+
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+}
+
+//Returns 0 if timestamping is not supported
+int testcase(int enabled)
+{
+	int fds[2];
+	SmeFdChannel *wch, *rch;
+	SmeMsgWriter *writer;
+	SmeMsgReaderNotify notify = {test_notify_call, NULL};
+	SmeLatency latency;
+	uint64_t sent[N_MSGS];
+	MmcMsg *msg;
+	int i, j;
+
+	n_recvd = 0;
+	sme_latency_reset(&latency);
+
+	tcp_pair(fds);
+	wch = sme_fd_channel_new(fds[0]);
+	rch = sme_fd_channel_new(fds[1]);
+	if (enabled && sme_fd_channel_set_timestamping(rch, 1) < 0)
+	{
+		sme_channel_unref((SmeChannel *) wch);
+		sme_channel_unref((SmeChannel *) rch);
+		close(fds[0]);
+		close(fds[1]);
+		return 0;
+	}
+	writer = sme_msg_writer_new((SmeChannel *) wch);
+	reader = sme_msg_reader_new((SmeChannel *) rch, notify);
+	sme_msg_reader_set_latency(reader, &latency);
+
+	//Messages are sent apart, each is received before the next is sent
+	msg = mmc_msg_newa(100, 0);
+	memset(msg->mem, 'x', 100);
+	for (i = 0; i < N_MSGS; i++)
+	{
+		sent[i] = sme_latency_now_realtime();
+		sme_msg_writer_add_msg(writer, msg);
+		for (j = 0; j < 100000 && n_recvd <= i; j++)
+		{
+			sme_channel_write((SmeChannel *) wch);
+			sme_channel_read((SmeChannel *) rch);
+		}
+		assert_equals_int(n_recvd, i + 1);
+		usleep(1000);
+	}
+	mmc_msg_unref(msg);
+
+	for (i = 0; i < N_MSGS; i++)
+	{
+		if (! enabled)
+		{
+			assert_equals_int(timestamps[i], 0);
+			continue;
+		}
+
+		//Each message has the timestamp of its own header
+		sme_assert(timestamps[i] >= sent[i], "Timestamp before sending");
+		if (i + 1 < N_MSGS)
+			sme_assert(timestamps[i] < sent[i + 1],
+					"Timestamp after next message");
+	}
+
+	assert_equals_int(latency.receive.count, N_MSGS);
+	assert_equals_int(latency.wire.count, enabled ? N_MSGS : 0);
+
+	sme_msg_reader_unref(reader);
+	sme_msg_writer_unref(writer);
+	sme_channel_unref((SmeChannel *) wch);
+	sme_channel_unref((SmeChannel *) rch);
+	close(fds[0]);
+	close(fds[1]);
+
+	return 1;
+}
+
+int main()
+{
+	testcase(0);
+	if (! testcase(1))
+	{
+		printf("SO_TIMESTAMPING is not supported\n");
+		return 77;
+	}
+
+	return 0;
+}
@@ -0,0 +1,222 @@
+/* test_view.c
+ * Unit test for borrowed receive views in msg.c
+ *
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ *
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sme/sme.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define assert_equals_int(a, b) \
+	do {\
+		int64_t _a = (a); \
+		int64_t _b = (b); \
+		if (_a != _b) \
+		{ \
+			sme_error("Assertion failed a == b (a = %" PRId64 ", " \
+					"b = %" PRId64 ")", \
+					_a, _b); \
+		} \
+	} while (0)
+
+#define BUF_SIZE 4096
+#define N_MSGS 6
+
+//Small messages of two layouts, an empty one, and one too large for views.
+//Fifth one also has an empty block between others.
+static const size_t msg_sizes[N_MSGS] = {5, 5, 0, 100000, 7, 5};
+
+//Expected to arrive as views
+static const int msg_is_view[N_MSGS] = {1, 1, 1, 0, 1, 1};
+
+MmcMsg *sent[N_MSGS];
+
+typedef struct
+{
+	int n_recvd;
+	int n_views;
+} ViewState;
+
+MmcMsg *create_msg(int idx)
+{
+	MmcMsg *msg;
+	size_t i;
+
+	if (msg_sizes[idx] == 0)
+		return mmc_msg_newa(0, 0);
+
+	msg = mmc_msg_newa(msg_sizes[idx], 1);
+	for (i = 0; i < msg_sizes[idx]; i++)
+		((char *) msg->mem)[i] = (char) (i * 13 + idx);
+	msg->submsgs[0] = mmc_msg_newa(10, idx == 4 ? 2 : 0);
+	memset(msg->submsgs[0]->mem, 'a' + idx, 10);
+	if (idx == 4)
+	{
+		msg->submsgs[0]->submsgs[0] = mmc_msg_newa(0, 0);
+		msg->submsgs[0]->submsgs[1] = mmc_msg_newa(3, 0);
+		memset(msg->submsgs[0]->submsgs[1]->mem, 'z', 3);
+	}
+
+	return msg;
+}
+
+void assert_equals_msg(MmcMsg* a, MmcMsg* b)
+{
+	int i;
+
+	assert_equals_int(a->mem_len, b->mem_len);
+	if (a->mem_len > 0)
+	{
+		if (memcmp(a->mem, b->mem, a->mem_len) != 0)
+			sme_error("Unequal memory blocks");
+	}
+
+	assert_equals_int(a->submsgs_len, b->submsgs_len);
+	for (i = 0; i < a->submsgs_len; i++)
+		assert_equals_msg(a->submsgs[i], b->submsgs[i]);
+}
+
+void test_notify_call(MmcMsg *msg, void *data)
+{
+	ViewState *state = data;
+
+	sme_assert(state->n_recvd < N_MSGS, "Capacity exceeded");
+	assert_equals_int(msg_is_view[state->n_recvd], 0);
+	assert_equals_msg(msg, sent[state->n_recvd]);
+	state->n_recvd++;
+	mmc_msg_unref(msg);
+}
+
+void test_view_call(SmeMsgView *view, void *data)
+{
+	ViewState *state = data;
+	MmcMsg *msg;
+
+	sme_assert(state->n_recvd < N_MSGS, "Capacity exceeded");
+	assert_equals_int(msg_is_view[state->n_recvd], 1);
+
+	msg = sme_msg_view_copy(view);
+	assert_equals_msg(msg, sent[state->n_recvd]);
+	mmc_msg_unref(msg);
+
+	state->n_recvd++;
+	state->n_views++;
+}
+
+void testcase(int crc)
+{
+	int fds[2];
+	SmeFdChannel *wch, *rch;
+	SmeMsgWriter *writer;
+	SmeMsgReader *reader;
+	ViewState state;
+	SmeMsgReaderNotify notify = {test_notify_call, &state};
+	SmeMsgReaderView view = {test_view_call, &state};
+	int i;
+
+	memset(&state, 0, sizeof(state));
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		sme_error("socketpair() failed");
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	wch = sme_fd_channel_new(fds[0]);
+	rch = sme_fd_channel_new(fds[1]);
+	writer = sme_msg_writer_new((SmeChannel *) wch);
+	reader = sme_msg_reader_new((SmeChannel *) rch, notify);
+	sme_msg_reader_set_view(reader, view, BUF_SIZE);
+	sme_msg_writer_set_crc(writer, crc);
+	sme_msg_reader_set_crc(reader, crc);
+
+	for (i = 0; i < N_MSGS; i++)
+	{
+		sent[i] = create_msg(i);
+		sme_msg_writer_add_msg(writer, sent[i]);
+	}
+
+	for (i = 0; i < 100000 && state.n_recvd < N_MSGS; i++)
+	{
+		sme_channel_write((SmeChannel *) wch);
+		sme_channel_read((SmeChannel *) rch);
+	}
+	assert_equals_int(state.n_recvd, N_MSGS);
+	assert_equals_int(state.n_views, 5);
+	assert_equals_int(sme_msg_reader_is_failed(reader), 0);
+
+	for (i = 0; i < N_MSGS; i++)
+		mmc_msg_unref(sent[i]);
+	sme_msg_reader_unref(reader);
+	sme_msg_writer_unref(writer);
+	sme_channel_unref((SmeChannel *) wch);
+	sme_channel_unref((SmeChannel *) rch);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+//Layout that does not add up fails the reader
+void testcase_malformed()
+{
+	int fds[2];
+	SmeFdChannel *rch;
+	SmeMsgReader *reader;
+	ViewState state;
+	SmeMsgReaderNotify notify = {test_notify_call, &state};
+	SmeMsgReaderView view = {test_view_call, &state};
+	uint32_t preamble[3];
+	int i;
+
+	memset(&state, 0, sizeof(state));
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		sme_error("socketpair() failed");
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	rch = sme_fd_channel_new(fds[1]);
+	reader = sme_msg_reader_new((SmeChannel *) rch, notify);
+	sme_msg_reader_set_view(reader, view, BUF_SIZE);
+
+	//One submessage announced, none follows
+	preamble[0] = ssc_uint32_to_le(2);
+	preamble[1] = ssc_uint32_to_le(5);
+	preamble[2] = ssc_uint32_to_le(1);
+	assert_equals_int(write(fds[0], preamble, sizeof(preamble)), 
+			sizeof(preamble));
+
+	for (i = 0; i < 100 && ! sme_msg_reader_is_failed(reader); i++)
+		sme_channel_read((SmeChannel *) rch);
+	assert_equals_int(sme_msg_reader_is_failed(reader), 1);
+	assert_equals_int(state.n_recvd, 0);
+
+	sme_msg_reader_unref(reader);
+	sme_channel_unref((SmeChannel *) rch);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int main()
+{
+	testcase_malformed();
+	testcase(0);
+	testcase(1);
+
+	return 0;
+}
@@ -0,0 +1,266 @@
+/* test_vmsplice.c
+ * Unit test for gifting pages to a pipe in fd_channel.c
+ *
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ *
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sme/sme.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <event2/event.h>
+
+#define assert_equals_int(a, b) \
+	do {\
+		int64_t _a = (a); \
+		int64_t _b = (b); \
+		if (_a != _b) \
+		{ \
+			sme_error("Assertion failed a == b (a = %" PRId64 ", " \
+					"b = %" PRId64 ")", \
+					_a, _b); \
+		} \
+	} while (0)
+
+#define N_PAGES 4
+
+int n_notified;
+
+void test_notify(void *source_ptr, int n_jobs)
+{
+	n_notified += n_jobs;
+}
+
+//Event loops poll held completions instead of spinning on the writable
+//fd, and release them once the pipe is drained
+void testcase_poll(int use_reactor)
+{
+	int fds[2];
+	SmeFdChannel *wch;
+	SmeChannel *ch;
+	SmeJobSource source = {NULL, test_notify, NULL};
+	SmeChannelCB cb = {NULL, NULL};
+	struct event_base *base = NULL;
+	SmeReactor *reactor = NULL;
+	SmeChannelStats stats;
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	char *big, *recvd;
+	SscMBlock job[1];
+	size_t done;
+	ssize_t res;
+	int i;
+
+	n_notified = 0;
+
+	if (pipe(fds) < 0)
+		sme_error("pipe() failed");
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	wch = sme_fd_channel_new_pair(fds[0], fds[1]);
+	ch = (SmeChannel *) wch;
+	assert_equals_int(sme_fd_channel_set_vmsplice(wch, 1), 0);
+	sme_channel_set_write_source(ch, source);
+
+	if (use_reactor)
+	{
+		reactor = sme_reactor_new(1000000);
+		assert_equals_int(sme_reactor_add_channel(reactor, wch, cb), 0);
+	}
+	else
+	{
+		base = event_base_new();
+		assert_equals_int(sme_fd_channel_attach_event_base(wch, base, cb), 0);
+	}
+
+	if (posix_memalign((void **) &big, page_size, N_PAGES * page_size) != 0)
+		sme_error("posix_memalign() failed");
+	memset(big, 'g', N_PAGES * page_size);
+	job[0].mem = big;
+	job[0].len = N_PAGES * page_size;
+	sme_channel_add_write_job(ch, job, 1);
+
+	//Pages are gifted once, then nothing is written while they are held
+	for (i = 0; i < 100; i++)
+	{
+		if (use_reactor)
+			sme_reactor_run_once(reactor, 0);
+		else
+			event_base_loop(base, EVLOOP_NONBLOCK);
+	}
+	assert_equals_int(sme_fd_channel_is_write_held(wch), 1);
+	assert_equals_int(n_notified, 0);
+	sme_channel_get_stats(ch, &stats);
+	assert_equals_int(stats.write.n_syscalls, 1);
+
+	//Waiting does not block while completions are held
+	if (use_reactor)
+		sme_reactor_run_once(reactor, -1);
+	else
+		event_base_loop(base, EVLOOP_ONCE);
+	assert_equals_int(n_notified, 0);
+
+	//Drain the pipe
+	recvd = (char *) malloc(N_PAGES * page_size);
+	done = 0;
+	while (done < N_PAGES * page_size)
+	{
+		res = read(fds[0], recvd + done, N_PAGES * page_size - done);
+		if (res <= 0)
+			sme_error("read() failed");
+		done += res;
+	}
+	if (memcmp(recvd, big, N_PAGES * page_size) != 0)
+		sme_error("Unequal data");
+
+	for (i = 0; i < 1000 && n_notified == 0; i++)
+	{
+		if (use_reactor)
+			sme_reactor_run_once(reactor, 10);
+		else
+			event_base_loop(base, EVLOOP_ONCE);
+	}
+	assert_equals_int(n_notified, 1);
+	assert_equals_int(sme_fd_channel_is_write_held(wch), 0);
+	assert_equals_int(sme_fd_channel_get_write_queue_len(wch), 0);
+
+	if (use_reactor)
+	{
+		sme_reactor_remove_channel(reactor, wch);
+		sme_reactor_unref(reactor);
+	}
+	else
+	{
+		sme_fd_channel_detach_event_base(wch);
+		event_base_free(base);
+	}
+	sme_channel_unref(ch);
+	free(recvd);
+	free(big);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int main()
+{
+	int fds[2];
+	SmeFdChannel *wch;
+	SmeChannel *ch;
+	SmeJobSource source = {NULL, test_notify, NULL};
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	char small1[] = "hello", small2[] = "world";
+	char *big, *recvd;
+	SscMBlock job1[2], job2[1];
+	size_t total, done;
+	ssize_t res;
+	size_t i;
+
+	if (pipe(fds) < 0)
+		sme_error("pipe() failed");
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	wch = sme_fd_channel_new_pair(-1, fds[1]);
+	ch = (SmeChannel *) wch;
+	assert_equals_int(sme_fd_channel_get_fd(wch), -1);
+	assert_equals_int(sme_fd_channel_get_write_fd(wch), fds[1]);
+	if (sme_fd_channel_set_vmsplice(wch, 1) < 0)
+	{
+		printf("vmsplice is not supported\n");
+		sme_channel_unref(ch);
+		return 77;
+	}
+	sme_channel_set_write_source(ch, source);
+
+	if (posix_memalign((void **) &big, page_size, N_PAGES * page_size) != 0)
+		sme_error("posix_memalign() failed");
+	for (i = 0; i < N_PAGES * page_size; i++)
+		big[i] = (char) (i * 7);
+
+	//Unaligned block followed by a gifted one, then another unaligned one
+	job1[0].mem = small1;
+	job1[0].len = 5;
+	job1[1].mem = big;
+	job1[1].len = N_PAGES * page_size;
+	job2[0].mem = small2;
+	job2[0].len = 5;
+	sme_channel_add_write_job(ch, job1, 2);
+	sme_channel_add_write_job(ch, job2, 1);
+	total = 10 + N_PAGES * page_size;
+
+	//Small block is copied on its own
+	assert_equals_int(sme_channel_write(ch), 5);
+
+	//Gifted block completes the first job, but completion is held
+	assert_equals_int(sme_channel_write(ch), N_PAGES * page_size);
+	assert_equals_int(n_notified, 0);
+	assert_equals_int(sme_fd_channel_get_write_queue_len(wch), 2);
+
+	//Completion of later job is held as well
+	assert_equals_int(sme_channel_write(ch), 5);
+	assert_equals_int(n_notified, 0);
+	assert_equals_int(sme_fd_channel_get_write_queue_len(wch), 2);
+
+	//Jobs are inserted after the held ones
+	sme_channel_insert_write_job(ch, 2, job2, 1);
+	assert_equals_int(sme_fd_channel_get_write_queue_len(wch), 3);
+	sme_channel_remove_write_job(ch, 2);
+	assert_equals_int(sme_fd_channel_get_write_queue_len(wch), 2);
+
+	//Nothing is released while the pipe still has gifted pages
+	assert_equals_int(sme_channel_write(ch), 0);
+	assert_equals_int(n_notified, 0);
+
+	//Drain the pipe
+	recvd = (char *) malloc(total);
+	done = 0;
+	while (done < total)
+	{
+		res = read(fds[0], recvd + done, total - done);
+		if (res <= 0)
+			sme_error("read() failed");
+		done += res;
+	}
+	if (memcmp(recvd, "hello", 5) != 0
+		|| memcmp(recvd + 5, big, N_PAGES * page_size) != 0
+		|| memcmp(recvd + 5 + N_PAGES * page_size, "world", 5) != 0)
+		sme_error("Unequal data");
+
+	//Next write releases held completions
+	assert_equals_int(sme_channel_write(ch), 0);
+	assert_equals_int(n_notified, 2);
+	assert_equals_int(sme_fd_channel_get_write_queue_len(wch), 0);
+
+	//Without gifted pages completions are not held
+	sme_channel_add_write_job(ch, job2, 1);
+	assert_equals_int(sme_channel_write(ch), 5);
+	assert_equals_int(n_notified, 3);
+	assert_equals_int(read(fds[0], recvd, total), 5);
+
+	sme_channel_unref(ch);
+	free(recvd);
+	free(big);
+	close(fds[0]);
+	close(fds[1]);
+
+	testcase_poll(0);
+	testcase_poll(1);
+
+	return 0;
+}